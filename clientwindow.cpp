@@ -1,9 +1,26 @@
 #include "clientwindow.h"
 
+#include <cstring>
+
+#include <QGuiApplication>
+#include <QScreen>
+
 #include <xcb/xcb_event.h>
 #include <xcb/xcb_icccm.h>
 
 #include "windowpixmap.h"
+#include "xcbasyncreplies.h"
+
+// How long a resized window may keep showing its old pixmap if the client doesn't redraw
+static const int MaxContentsWait = 100;
+
+// Pixmaps aren't reallocated during resize more often than frames are shown
+static int frameInterval()
+{
+    auto screen = QGuiApplication::primaryScreen();
+    auto refreshRate = screen ? screen->refreshRate() : 60.0;
+    return qMax(1, qRound(1000.0 / (refreshRate > 0 ? refreshRate : 60.0)));
+}
 
 class XcbServerGrab
 {
@@ -26,82 +43,309 @@ private:
     xcb_connection_t *connection;
 };
 
-ClientWindow::ClientWindow(xcb_ewmh_connection_t *ewmh, xcb_window_t window, QObject *parent)
+ClientWindow::ClientWindow(xcb_ewmh_connection_t *ewmh, const Atoms &atoms, xcb_window_t window, QObject *parent)
+    : ClientWindow(ewmh, atoms, window, parent, DeferredInit)
+{
+    XcbServerGrab grab(connection_);
+    init(requestInit(ewmh_, atoms_, window_));
+}
+
+ClientWindow::ClientWindow(xcb_ewmh_connection_t *ewmh, const Atoms &atoms, xcb_window_t window,
+                           QObject *parent, DeferredInitTag)
     : QObject(parent),
       connection_(ewmh->connection),
       ewmh_(ewmh),
+      atoms_(atoms),
       window_(window),
       windowClass_(XCB_WINDOW_CLASS_COPY_FROM_PARENT),
       valid_(false),
       mapped_(false),
-      pixmapRealloc_(true),
-      above_(XCB_NONE),
+      pendingWaitsForContents_(false),
+      pixmapRequests_(0),
+      mapLatency_(-1),
+      zIndex_(0),
+      borderWidth_(0),
+      visual_(XCB_NONE),
+      depth_(0),
       overrideRedirect_(false),
       transientFor_(XCB_NONE),
-      wmType_(XCB_NONE)
+      wmType_(XCB_NONE),
+      bypassCompositor_(BYPASS_NO_PREFERENCE),
+      opacity_(1),
+      occluded_(false)
 {
-    XcbServerGrab grab(connection_);
+    resizeTimer_.setSingleShot(true);
+    connect(&resizeTimer_, SIGNAL(timeout()), SLOT(requestResizedPixmap()));
+    contentsTimer_.setSingleShot(true);
+    contentsTimer_.setInterval(MaxContentsWait);
+    connect(&contentsTimer_, SIGNAL(timeout()), SLOT(promotePendingPixmap()));
+}
 
-    auto attributesCookie = xcb_get_window_attributes(connection_, window_);
-    auto attributes = xcb_get_window_attributes_reply(connection_, attributesCookie, Q_NULLPTR);
-    if (!attributes) {
-        return;
+QSharedPointer<ClientWindow> ClientWindow::create(xcb_ewmh_connection_t *ewmh, const Atoms &atoms,
+                                                  xcb_window_t window)
+{
+    return QSharedPointer<ClientWindow>(new ClientWindow(ewmh, atoms, window));
+}
+
+QVector<QSharedPointer<ClientWindow> > ClientWindow::create(xcb_ewmh_connection_t *ewmh, const Atoms &atoms,
+                                                            const QVector<xcb_window_t> &windows)
+{
+    XcbServerGrab grab(ewmh->connection);
+
+    // Send all requests first, so creating N windows costs one round trip instead of N
+    QVector<InitCookies> cookies;
+    cookies.reserve(windows.size());
+    for (auto window : windows) {
+        cookies.append(requestInit(ewmh, atoms, window));
     }
 
-    attributes->your_event_mask = attributes->your_event_mask
-            | XCB_EVENT_MASK_STRUCTURE_NOTIFY
-            | XCB_EVENT_MASK_PROPERTY_CHANGE;
-    xcb_change_window_attributes(connection_, window_, XCB_CW_EVENT_MASK, &attributes->your_event_mask);
+    QVector<QSharedPointer<ClientWindow> > result;
+    result.reserve(windows.size());
+    for (int i = 0; i < windows.size(); i++) {
+        QSharedPointer<ClientWindow> w(new ClientWindow(ewmh, atoms, windows[i], Q_NULLPTR, DeferredInit));
+        w->init(cookies[i]);
+        result.append(w);
+    }
+    return result;
+}
+
+QSharedPointer<ClientWindow> ClientWindow::createDetached(xcb_ewmh_connection_t *ewmh, const Atoms &atoms,
+                                                          xcb_window_t window, const QRect &geometry, bool mapped)
+{
+    QSharedPointer<ClientWindow> w(new ClientWindow(ewmh, atoms, window, Q_NULLPTR, DeferredInit));
+    w->geometry_ = geometry;
+    w->mapped_ = mapped;
+    return w;
+}
+
+ClientWindow::InitCookies ClientWindow::requestInit(xcb_ewmh_connection_t *ewmh, const Atoms &atoms,
+                                                    xcb_window_t window)
+{
+    InitCookies cookies;
+    cookies.attributes = xcb_get_window_attributes_unchecked(ewmh->connection, window);
+    cookies.geometry = xcb_get_geometry_unchecked(ewmh->connection, window);
+    cookies.transientFor = xcb_icccm_get_wm_transient_for_unchecked(ewmh->connection, window);
+    cookies.wmType = xcb_ewmh_get_wm_window_type_unchecked(ewmh, window);
+    cookies.bypassCompositor = xcb_get_property_unchecked(ewmh->connection, 0, window,
+                                                          atoms.bypassCompositor, XCB_ATOM_CARDINAL, 0, 1);
+    cookies.opacity = xcb_get_property_unchecked(ewmh->connection, 0, window, atoms.opacity,
+                                                 XCB_ATOM_CARDINAL, 0, 1);
+    return cookies;
+}
+
+static xcb_intern_atom_cookie_t internAtom(xcb_connection_t *connection, const char *name)
+{
+    return xcb_intern_atom(connection, 0, std::strlen(name), name);
+}
+
+static xcb_atom_t internAtomReply(xcb_connection_t *connection, xcb_intern_atom_cookie_t cookie)
+{
+    auto reply = xcb_intern_atom_reply(connection, cookie, Q_NULLPTR);
+    if (!reply) {
+        return XCB_NONE;
+    }
+    auto atom = reply->atom;
+    std::free(reply);
+    return atom;
+}
+
+ClientWindow::AtomCookies ClientWindow::internAtoms(xcb_connection_t *connection)
+{
+    AtomCookies cookies;
+    cookies.bypassCompositor = internAtom(connection, "_NET_WM_BYPASS_COMPOSITOR");
+    cookies.opacity = internAtom(connection, "_NET_WM_WINDOW_OPACITY");
+    return cookies;
+}
+
+ClientWindow::Atoms ClientWindow::internAtomsReplies(xcb_connection_t *connection, const AtomCookies &cookies)
+{
+    Atoms atoms;
+    atoms.bypassCompositor = internAtomReply(connection, cookies.bypassCompositor);
+    atoms.opacity = internAtomReply(connection, cookies.opacity);
+    return atoms;
+}
+
+qreal ClientWindow::opacityFromReply(xcb_get_property_reply_t *reply)
+{
+    if (!reply || reply->type != XCB_ATOM_CARDINAL || reply->format != 32 ||
+            xcb_get_property_value_length(reply) < 4) {
+        return 1;
+    }
+    return *static_cast<uint32_t *>(xcb_get_property_value(reply)) / qreal(0xffffffffu);
+}
 
-    auto geometryCookie = xcb_get_geometry_unchecked(connection_, window_);
-    auto transientCookie = xcb_icccm_get_wm_transient_for_unchecked(connection_, window_);
-    auto wmTypeCookie = xcb_ewmh_get_wm_window_type_unchecked(ewmh_, window_);
+ClientWindow::BypassCompositor ClientWindow::bypassCompositorFromReply(xcb_get_property_reply_t *reply)
+{
+    if (!reply || reply->type != XCB_ATOM_CARDINAL || reply->format != 32 ||
+            xcb_get_property_value_length(reply) < 4) {
+        return BYPASS_NO_PREFERENCE;
+    }
+    switch (*static_cast<uint32_t *>(xcb_get_property_value(reply))) {
+    case BYPASS_REQUESTED:
+        return BYPASS_REQUESTED;
+    case BYPASS_FORBIDDEN:
+        return BYPASS_FORBIDDEN;
+    default:
+        return BYPASS_NO_PREFERENCE;
+    }
+}
 
-    auto geometry = xcb_get_geometry_reply(connection_, geometryCookie, Q_NULLPTR);
-    xcb_icccm_get_wm_transient_for_reply(connection_, transientCookie, &transientFor_, Q_NULLPTR);
+void ClientWindow::init(const InitCookies &cookies)
+{
+    // All replies have to be collected even if the window is already gone
+    auto attributes = xcb_get_window_attributes_reply(connection_, cookies.attributes, Q_NULLPTR);
+    auto geometry = xcb_get_geometry_reply(connection_, cookies.geometry, Q_NULLPTR);
+    xcb_icccm_get_wm_transient_for_reply(connection_, cookies.transientFor, &transientFor_, Q_NULLPTR);
     xcb_ewmh_get_atoms_reply_t wmType = {0};
-    xcb_ewmh_get_wm_window_type_reply(ewmh_, wmTypeCookie, &wmType, Q_NULLPTR);
+    xcb_ewmh_get_wm_window_type_reply(ewmh_, cookies.wmType, &wmType, Q_NULLPTR);
     if (wmType.atoms_len > 0) {
         wmType_ = wmType.atoms[0];
     }
     xcb_ewmh_get_atoms_reply_wipe(&wmType);
-    if (!geometry) {
+    auto bypassCompositor = xcb_get_property_reply(connection_, cookies.bypassCompositor, Q_NULLPTR);
+    bypassCompositor_ = bypassCompositorFromReply(bypassCompositor);
+    std::free(bypassCompositor);
+    auto opacity = xcb_get_property_reply(connection_, cookies.opacity, Q_NULLPTR);
+    opacity_ = opacityFromReply(opacity);
+    std::free(opacity);
+
+    if (!attributes || !geometry) {
         std::free(attributes);
         std::free(geometry);
         return;
     }
 
+    attributes->your_event_mask = attributes->your_event_mask
+            | XCB_EVENT_MASK_STRUCTURE_NOTIFY
+            | XCB_EVENT_MASK_PROPERTY_CHANGE;
+    xcb_change_window_attributes(connection_, window_, XCB_CW_EVENT_MASK, &attributes->your_event_mask);
+
     valid_ = true;
     windowClass_ = static_cast<xcb_window_class_t>(attributes->_class);
     geometry_ = QRect(geometry->x, geometry->y, geometry->width, geometry->height);
+    borderWidth_ = geometry->border_width;
+    visual_ = attributes->visual;
+    depth_ = geometry->depth;
     mapped_ = (attributes->map_state == XCB_MAP_STATE_VIEWABLE);
+    if (mapped_) {
+        mappedSince_.start();
+    }
     overrideRedirect_ = attributes->override_redirect;
 
     std::free(attributes);
     std::free(geometry);
+
+    requestPixmap();
 }
 
 ClientWindow::~ClientWindow()
 {
 }
 
-const QSharedPointer<WindowPixmap> &ClientWindow::pixmap()
+void ClientWindow::requestPixmap(bool waitForContents)
 {
-    if (!pixmapRealloc_ || !mapped_) {
-        return pixmap_;
+    if (!valid_ || !mapped_) {
+        return;
     }
-    pixmapRealloc_ = false;
 
-    XcbServerGrab grab(connection_);
-    QSharedPointer<WindowPixmap> newPixmap(new WindowPixmap(connection_, window_)); // TODO: replace with ::create
-    if (newPixmap->isValid()) {
-        if (newPixmap->thread() != thread()) { // This method is called from render thread
-            newPixmap->moveToThread(thread());
-        }
-        pixmap_ = newPixmap;
-        Q_EMIT pixmapChanged(pixmap_.data());
+    // A newer request supersedes the one still in flight
+    cancelPendingPixmap();
+    lastPixmapRequest_.start();
+    pixmapRequests_++;
+
+    pendingPixmap_ = WindowPixmap::create(connection_, window_, visual_);
+    pendingWaitsForContents_ = waitForContents && !pixmap_.isNull();
+    connect(pendingPixmap_.data(), SIGNAL(ready()), SLOT(pendingPixmapReady()));
+    connect(pendingPixmap_.data(), SIGNAL(invalidated()), SLOT(pendingPixmapInvalidated()));
+    xcb_flush(connection_);
+    Q_EMIT pixmapCreated(pendingPixmap_.data());
+}
+
+void ClientWindow::refreshPixmap()
+{
+    requestPixmap();
+}
+
+void ClientWindow::requestResizedPixmap()
+{
+    requestPixmap(true);
+}
+
+void ClientWindow::scheduleResizedPixmap()
+{
+    // During interactive resize, configure events come much faster than frames
+    if (!valid_ || !mapped_ || resizeTimer_.isActive()) {
+        return;
+    }
+
+    auto interval = frameInterval();
+    if (!lastPixmapRequest_.isValid() || lastPixmapRequest_.elapsed() >= interval) {
+        requestResizedPixmap();
+    } else {
+        resizeTimer_.start(interval - lastPixmapRequest_.elapsed());
+    }
+}
+
+void ClientWindow::cancelPendingPixmap()
+{
+    resizeTimer_.stop();
+    contentsTimer_.stop();
+    if (pendingPixmap_) {
+        pendingPixmap_->disconnect(this);
+        pendingPixmap_.clear();
+    }
+}
+
+void ClientWindow::pendingPixmapReady()
+{
+    if (sender() != pendingPixmap_.data()) {
+        return;
     }
-    return pixmap_;
+
+    // The old pixmap stays on screen until the client has drawn the new one
+    if (pendingWaitsForContents_ && !pendingPixmap_->isDrawn()) {
+        connect(pendingPixmap_.data(), SIGNAL(drawn()), SLOT(promotePendingPixmap()));
+        contentsTimer_.start();
+        return;
+    }
+    promotePendingPixmap();
+}
+
+void ClientWindow::promotePendingPixmap()
+{
+    if (!pendingPixmap_ || !pendingPixmap_->isReady()) {
+        return;
+    }
+    contentsTimer_.stop();
+    pendingPixmap_->disconnect(this);
+    pixmap_.swap(pendingPixmap_);
+    pendingPixmap_.clear();
+    Q_EMIT pixmapChanged(pixmap_.data());
+}
+
+void ClientWindow::pendingPixmapInvalidated()
+{
+    if (sender() == pendingPixmap_.data()) {
+        contentsTimer_.stop();
+        pendingPixmap_.clear();
+    }
+}
+
+void ClientWindow::pixmapRendered(WindowPixmap *pixmap)
+{
+    // The GUI thread is blocked during sync, so the timer can be read here
+    if (pixmap != pixmap_.data() || !mapTimer_.isValid()) {
+        return;
+    }
+    auto latency = mapTimer_.elapsed();
+    mapTimer_.invalidate();
+    QMetaObject::invokeMethod(this, "setMapLatency", Qt::QueuedConnection, Q_ARG(qint64, latency));
+}
+
+void ClientWindow::setMapLatency(qint64 latency)
+{
+    mapLatency_ = latency;
+    Q_EMIT mapLatencyChanged(latency);
 }
 
 ClientWindow::WmType ClientWindow::wmType() const
@@ -144,11 +388,12 @@ void ClientWindow::invalidate()
 void ClientWindow::setGeometry(const QRect &geometry)
 {
     if (geometry_ != geometry) {
-        if (geometry.size() != geometry_.size()) {
-            pixmapRealloc_ = true;
-        }
+        auto resized = (geometry.size() != geometry_.size());
         geometry_ = geometry;
         Q_EMIT geometryChanged(geometry);
+        if (resized) {
+            scheduleResizedPixmap();
+        }
     }
 }
 
@@ -171,24 +416,33 @@ void ClientWindow::setOverrideRedirect(bool overrideRedirect)
 void ClientWindow::xcbEvent(const xcb_configure_notify_event_t *e)
 {
     Q_ASSERT(e->window == window_);
+    auto borderChanged = (e->border_width != borderWidth_);
+    borderWidth_ = e->border_width;
+    auto oldSize = geometry_.size();
     setGeometry(QRect(e->x, e->y, e->width, e->height));
-    setOverrideRedirect(e->override_redirect);
-    if (e->above_sibling != above_) {
-        Q_EMIT stackingOrderChanged();
+    if (borderChanged && oldSize == geometry_.size()) {
+        scheduleResizedPixmap();
     }
+    setOverrideRedirect(e->override_redirect);
 }
 
 void ClientWindow::xcbEvent(const xcb_map_notify_event_t *e)
 {
     Q_ASSERT(e->window == window_);
-    pixmapRealloc_ = true;
+    mapTimer_.start();
+    mappedSince_.start();
     setOverrideRedirect(e->override_redirect);
     setMapped(true);
+    requestPixmap();
 }
 
 void ClientWindow::xcbEvent(const xcb_unmap_notify_event_t *e)
 {
     Q_ASSERT(e->window == window_);
+    // The old pixmap stays around, so unmap animations can still show the contents
+    cancelPendingPixmap();
+    mapTimer_.invalidate();
+    mappedSince_.invalidate();
     setMapped(false);
 }
 
@@ -205,47 +459,89 @@ void ClientWindow::xcbEvent(const xcb_gravity_notify_event_t *e)
     setGeometry(QRect(e->x, e->y, geometry_.width(), geometry_.height()));
 }
 
-void ClientWindow::xcbEvent(const xcb_circulate_notify_event_t *e)
+void ClientWindow::updateTransientFor()
 {
-    Q_ASSERT(e->window == window_);
-    Q_EMIT stackingOrderChanged();
+    auto cookie = xcb_icccm_get_wm_transient_for(connection_, window_);
+    XcbAsyncReplies::instance(connection_)->await<xcb_get_property_reply_t>(cookie, this,
+            [this](xcb_get_property_reply_t *reply, xcb_generic_error_t *error)
+    {
+        if (error || !reply) {
+            return;
+        }
+
+        auto oldIsTransient = isTransient();
+        auto oldTransientFor = transientFor_;
+
+        if (!xcb_icccm_get_wm_transient_for_from_reply(&transientFor_, reply)) {
+            transientFor_ = XCB_NONE;
+        }
+
+        if (oldTransientFor != transientFor_) {
+            Q_EMIT transientForChanged();
+        }
+        if (oldIsTransient != isTransient()) {
+            Q_EMIT transientChanged(isTransient());
+        }
+    });
 }
 
-void ClientWindow::updateTransientFor()
+void ClientWindow::updateWmType()
 {
-    auto oldIsTransient = isTransient();
-    auto oldTransientFor = transientFor_;
+    auto cookie = xcb_ewmh_get_wm_window_type(ewmh_, window_);
+    XcbAsyncReplies::instance(connection_)->await<xcb_get_property_reply_t>(cookie, this,
+            [this](xcb_get_property_reply_t *reply, xcb_generic_error_t *error)
+    {
+        if (error || !reply) {
+            return;
+        }
 
-    auto cookie = xcb_icccm_get_wm_transient_for(connection_, window_);
-    xcb_icccm_get_wm_transient_for_reply(connection_, cookie, &transientFor_, Q_NULLPTR);
+        xcb_atom_t newWmType = wmType_;
+        if (reply->type == XCB_ATOM_ATOM && reply->format == 32 && xcb_get_property_value_length(reply) >= 4) {
+            newWmType = *static_cast<xcb_atom_t *>(xcb_get_property_value(reply));
+        }
 
-    if (oldTransientFor != transientFor_) {
-        Q_EMIT transientForChanged();
-    }
-    if (oldIsTransient != isTransient()) {
-        Q_EMIT transientChanged(isTransient());
-    }
+        if (newWmType != wmType_) {
+            wmType_ = newWmType;
+            Q_EMIT wmTypeChanged(wmType());
+        }
+    });
 }
 
-void ClientWindow::updateWmType()
+void ClientWindow::updateBypassCompositor()
 {
-    auto wmTypeCookie = xcb_ewmh_get_wm_window_type(ewmh_, window_);
+    auto cookie = xcb_get_property(connection_, 0, window_, atoms_.bypassCompositor,
+                                   XCB_ATOM_CARDINAL, 0, 1);
+    XcbAsyncReplies::instance(connection_)->await<xcb_get_property_reply_t>(cookie, this,
+            [this](xcb_get_property_reply_t *reply, xcb_generic_error_t *error)
+    {
+        if (error) {
+            return;
+        }
 
-    xcb_ewmh_get_atoms_reply_t wmTypeReply = {0};
-    if (!xcb_ewmh_get_wm_window_type_reply(ewmh_, wmTypeCookie, &wmTypeReply, Q_NULLPTR)) {
-        return;
-    }
+        auto newBypassCompositor = bypassCompositorFromReply(reply);
+        if (newBypassCompositor != bypassCompositor_) {
+            bypassCompositor_ = newBypassCompositor;
+            Q_EMIT bypassCompositorChanged(bypassCompositor_);
+        }
+    });
+}
 
-    xcb_atom_t newWmType = wmType_;
-    if (wmTypeReply.atoms_len > 0) {
-        newWmType = wmTypeReply.atoms[0];
-    }
-    xcb_ewmh_get_atoms_reply_wipe(&wmTypeReply);
+void ClientWindow::updateOpacity()
+{
+    auto cookie = xcb_get_property(connection_, 0, window_, atoms_.opacity, XCB_ATOM_CARDINAL, 0, 1);
+    XcbAsyncReplies::instance(connection_)->await<xcb_get_property_reply_t>(cookie, this,
+            [this](xcb_get_property_reply_t *reply, xcb_generic_error_t *error)
+    {
+        if (error) {
+            return;
+        }
 
-    if (newWmType != wmType_) {
-        wmType_ = newWmType;
-        Q_EMIT wmTypeChanged(wmType());
-    }
+        auto newOpacity = opacityFromReply(reply);
+        if (newOpacity != opacity_) {
+            opacity_ = newOpacity;
+            Q_EMIT opacityChanged(opacity_);
+        }
+    });
 }
 
 void ClientWindow::xcbEvent(const xcb_property_notify_event_t *e)
@@ -256,5 +552,9 @@ void ClientWindow::xcbEvent(const xcb_property_notify_event_t *e)
         updateTransientFor();
     } else if (e->atom == ewmh_->_NET_WM_WINDOW_TYPE) {
         updateWmType();
+    } else if (e->atom == atoms_.bypassCompositor) {
+        updateBypassCompositor();
+    } else if (e->atom == atoms_.opacity) {
+        updateOpacity();
     }
 }
@@ -1,8 +1,11 @@
 #pragma once
 
+#include <QElapsedTimer>
 #include <QObject>
 #include <QEnableSharedFromThis>
 #include <QRect>
+#include <QTimer>
+#include <QVector>
 
 #include <xcb/xcb.h>
 #include <xcb/xcb_ewmh.h>
@@ -20,8 +23,12 @@ class ClientWindow : public QObject, public QEnableSharedFromThis<ClientWindow>
     Q_PROPERTY(bool overrideRedirect READ isOverrideRedirect NOTIFY overrideRedirectChanged)
     Q_PROPERTY(bool transient READ isTransient NOTIFY transientChanged)
     Q_PROPERTY(WmType wmType READ wmType NOTIFY wmTypeChanged)
+    Q_PROPERTY(BypassCompositor bypassCompositor READ bypassCompositor NOTIFY bypassCompositorChanged)
+    Q_PROPERTY(qreal opacity READ opacity NOTIFY opacityChanged)
+    Q_PROPERTY(bool occluded READ isOccluded NOTIFY occludedChanged)
+    Q_PROPERTY(qint64 mapLatency READ mapLatency NOTIFY mapLatencyChanged)
 
-    Q_ENUMS(WmType)
+    Q_ENUMS(WmType BypassCompositor)
 public:
     enum WmType {
         NONE,
@@ -42,9 +49,43 @@ public:
         NORMAL
     };
 
-    ClientWindow(xcb_ewmh_connection_t *, xcb_window_t, QObject *parent = Q_NULLPTR);
+    // Values of _NET_WM_BYPASS_COMPOSITOR
+    enum BypassCompositor {
+        BYPASS_NO_PREFERENCE = 0,
+        BYPASS_REQUESTED = 1,
+        BYPASS_FORBIDDEN = 2
+    };
+
+    // Atoms missing from xcb-ewmh. Interned like xcb_ewmh_init_atoms() does it: the requests
+    // are sent first and the replies collected later, together with the ewmh ones.
+    struct Atoms
+    {
+        xcb_atom_t bypassCompositor;
+        xcb_atom_t opacity;
+    };
+    struct AtomCookies
+    {
+        xcb_intern_atom_cookie_t bypassCompositor;
+        xcb_intern_atom_cookie_t opacity;
+    };
+    static AtomCookies internAtoms(xcb_connection_t *);
+    // Atoms that couldn't be interned are XCB_NONE
+    static Atoms internAtomsReplies(xcb_connection_t *, const AtomCookies &);
+
+    ClientWindow(xcb_ewmh_connection_t *, const Atoms &, xcb_window_t, QObject *parent = Q_NULLPTR);
     ~ClientWindow() Q_DECL_OVERRIDE;
 
+    static QSharedPointer<ClientWindow> create(xcb_ewmh_connection_t *, const Atoms &, xcb_window_t);
+    // Pipelined creation: requests for all windows are sent before the first reply is read.
+    // Windows that disappeared in the meantime are returned invalid.
+    static QVector<QSharedPointer<ClientWindow> > create(xcb_ewmh_connection_t *, const Atoms &,
+                                                         const QVector<xcb_window_t> &);
+    // Window with the given initial state that isn't looked up on the server and never gets
+    // a pixmap. Lets the event handlers run without an X server (benchmarks, replay);
+    // property changes still send requests.
+    static QSharedPointer<ClientWindow> createDetached(xcb_ewmh_connection_t *, const Atoms &, xcb_window_t,
+                                                       const QRect &geometry = QRect(), bool mapped = false);
+
     xcb_connection_t *connection() const
     {
         return connection_;
@@ -75,6 +116,52 @@ public:
         return mapped_;
     }
 
+    int borderWidth() const
+    {
+        return borderWidth_;
+    }
+
+    xcb_visualid_t visual() const
+    {
+        return visual_;
+    }
+
+    int depth() const
+    {
+        return depth_;
+    }
+
+    // From _NET_WM_WINDOW_OPACITY, 1 if not set
+    qreal opacity() const
+    {
+        return opacity_;
+    }
+
+    // Windows with an alpha channel or translucency can't hide what's below them
+    bool isOpaque() const
+    {
+        return depth_ != 32 && opacity_ >= 1;
+    }
+
+    // Milliseconds since the window was mapped or discovered mapped, -1 if it isn't mapped
+    qint64 mappedFor() const
+    {
+        return mappedSince_.isValid() ? mappedSince_.elapsed() : -1;
+    }
+
+    // Entirely hidden by windows above it, so it doesn't need to be drawn or rebound
+    bool isOccluded() const
+    {
+        return occluded_;
+    }
+    void setOccluded(bool occluded)
+    {
+        if (occluded != occluded_) {
+            occluded_ = occluded;
+            Q_EMIT occludedChanged(occluded);
+        }
+    }
+
     int zIndex() const
     {
         return zIndex_;
@@ -104,20 +191,44 @@ public:
 
     WmType wmType() const;
 
+    BypassCompositor bypassCompositor() const
+    {
+        return bypassCompositor_;
+    }
+
+    // Names a new pixmap for a mapped window, e.g. after the window was redirected again
+    void refreshPixmap();
+
     void xcbEvent(const xcb_configure_notify_event_t *);
     void xcbEvent(const xcb_map_notify_event_t *);
     void xcbEvent(const xcb_unmap_notify_event_t *);
     void xcbEvent(const xcb_reparent_notify_event_t *);
     void xcbEvent(const xcb_gravity_notify_event_t *);
-    void xcbEvent(const xcb_circulate_notify_event_t *);
     void xcbEvent(const xcb_property_notify_event_t *);
     void invalidate();
-    void setAbove(xcb_window_t above)
+
+    // Pixmaps are named on the GUI thread when the window is mapped or resized; this
+    // only returns the latest one the server has confirmed. Safe to call during sync.
+    const QSharedPointer<WindowPixmap> &pixmap() const
     {
-        above_ = above;
+        return pixmap_;
     }
 
-    const QSharedPointer<WindowPixmap> &pixmap();
+    // Time from MapNotify to the first frame with the window's contents, in milliseconds.
+    // -1 until the window has been shown once.
+    qint64 mapLatency() const
+    {
+        return mapLatency_;
+    }
+
+    // Called by the scene graph during sync when contents of a new pixmap get rendered
+    void pixmapRendered(WindowPixmap *);
+
+    // Number of window pixmaps named so far
+    int pixmapRequests() const
+    {
+        return pixmapRequests_;
+    }
 
 Q_SIGNALS:
     void invalidated();
@@ -128,32 +239,82 @@ Q_SIGNALS:
     void transientChanged(bool transient);
     void transientForChanged();
     void wmTypeChanged(WmType wmType);
+    void bypassCompositorChanged(BypassCompositor bypassCompositor);
+    void opacityChanged(qreal opacity);
+    void occludedChanged(bool occluded);
 
+    // A pixmap was named and waits to become current. Damage on it has to be tracked already.
+    void pixmapCreated(WindowPixmap *pixmap);
     void pixmapChanged(WindowPixmap *pixmap);
-    void stackingOrderChanged();
+    void mapLatencyChanged(qint64 mapLatency);
+
+private Q_SLOTS:
+    void requestResizedPixmap();
+    void promotePendingPixmap();
+    void pendingPixmapReady();
+    void pendingPixmapInvalidated();
+    void setMapLatency(qint64);
 
 private:
+    enum DeferredInitTag { DeferredInit };
+
+    struct InitCookies
+    {
+        xcb_get_window_attributes_cookie_t attributes;
+        xcb_get_geometry_cookie_t geometry;
+        xcb_get_property_cookie_t transientFor;
+        xcb_get_property_cookie_t wmType;
+        xcb_get_property_cookie_t bypassCompositor;
+        xcb_get_property_cookie_t opacity;
+    };
+
+    ClientWindow(xcb_ewmh_connection_t *, const Atoms &, xcb_window_t, QObject *parent, DeferredInitTag);
+
+    static InitCookies requestInit(xcb_ewmh_connection_t *, const Atoms &, xcb_window_t);
+    void init(const InitCookies &);
+
     void setMapped(bool);
     void setGeometry(const QRect &);
     void setOverrideRedirect(bool);
 
+    void requestPixmap(bool waitForContents = false);
+    void scheduleResizedPixmap();
+    void cancelPendingPixmap();
     void updateTransientFor();
     void updateWmType();
+    void updateBypassCompositor();
+    void updateOpacity();
+    static BypassCompositor bypassCompositorFromReply(xcb_get_property_reply_t *);
+    static qreal opacityFromReply(xcb_get_property_reply_t *);
 
     xcb_connection_t *connection_;
     xcb_ewmh_connection_t *ewmh_;
+    Atoms atoms_;
     xcb_window_t window_;
     xcb_window_class_t windowClass_;
     bool valid_;
     QRect geometry_;
     bool mapped_;
     QSharedPointer<WindowPixmap> pixmap_;
-    bool pixmapRealloc_;
+    QSharedPointer<WindowPixmap> pendingPixmap_;
+    bool pendingWaitsForContents_;
+    QTimer resizeTimer_;
+    QTimer contentsTimer_;
+    QElapsedTimer lastPixmapRequest_;
+    int pixmapRequests_;
+    QElapsedTimer mapTimer_;
+    QElapsedTimer mappedSince_;
+    qint64 mapLatency_;
     int zIndex_;
-    xcb_window_t above_;
+    int borderWidth_;
+    xcb_visualid_t visual_;
+    int depth_;
     bool overrideRedirect_;
     xcb_window_t transientFor_;
     xcb_atom_t wmType_;
+    BypassCompositor bypassCompositor_;
+    qreal opacity_;
+    bool occluded_;
 };
 
 Q_DECLARE_METATYPE(ClientWindow*)
@@ -4,6 +4,8 @@
 
 #include <QDebug>
 #include <QCoreApplication>
+#include <QLoggingCategory>
+#include <QQuickWindow>
 #include <QWindow>
 #include <QX11Info>
 
@@ -12,7 +14,52 @@
 #include <xcb/xcb_event.h>
 
 #include "clientwindow.h"
+#include "eventrecording.h"
 #include "windowpixmap.h"
+#include "windowtexture.h"
+#include "xcbasyncreplies.h"
+#include "xcbeventdispatch.h"
+
+#include <X11/Xlib.h>
+
+// Debug output is off unless enabled with QT_LOGGING_RULES="qmlcompmgr.compositor.debug=true"
+static const QLoggingCategory &log()
+{
+    static const QLoggingCategory log_("qmlcompmgr.compositor", QtWarningMsg);
+    return log_;
+}
+
+// How long a window has to stay a bypass candidate before compositing is turned off
+static const int BypassDelay = 1000;
+
+// Windows fade and scale in after mapping (see main.qml); until then they don't hide anything
+static const qint64 OccluderSettleTime = 500;
+
+// Event processing that takes longer than this delays everything else in the event loop
+static const qint64 StallThreshold = 1000000;
+
+class StallMeter
+{
+public:
+    explicit StallMeter(quint64 *stalls)
+        : stalls(stalls)
+    {
+        timer.start();
+    }
+
+    ~StallMeter()
+    {
+        if (timer.nsecsElapsed() > StallThreshold) {
+            ++*stalls;
+        }
+    }
+
+private:
+    Q_DISABLE_COPY(StallMeter)
+
+    quint64 *stalls;
+    QElapsedTimer timer;
+};
 
 template<typename T>
 std::unique_ptr<T, decltype(&std::free)> xcbReply(T *ptr)
@@ -24,17 +71,55 @@ Compositor::Compositor()
     : connection_(QX11Info::connection()),
       root_(QX11Info::appRootWindow()),
       damageExt_(xcb_get_extension_data(connection_, &xcb_damage_id)),
-      initFinished_(false)
+      topLevelCacheHits_(0),
+      topLevelCacheMisses_(0),
+      topLevelCacheGeneration_(0),
+      activeWindowSerial_(0),
+      eventLoopStalls_(0),
+      xEvents_(0),
+      recorder_(Q_NULLPTR),
+      initFinished_(false),
+      stackingRebuildPending_(false),
+      stackingRebuildInFlight_(false),
+      activeWindowUpdatePending_(false),
+      bypassUpdatePending_(false),
+      bypassEnabled_(false),
+      bypassActive_(false),
+      bypassWindow_(XCB_NONE),
+      occlusionUpdatePending_(false),
+      startupTime_(-1),
+      separateRenderConnection_(true),
+      renderConnection_(Q_NULLPTR),
+      renderFlushNsecs_(0),
+      renderFlushMaxNsecs_(0),
+      renderConnectionErrors_(0)
 {
+    startupTimer_.start();
     qRegisterMetaType<ClientWindow *>();
 
+    // Created here so that replies are processed on this thread
+    XcbAsyncReplies::instance(connection_);
+
+    updateTimer_.setSingleShot(true);
+    updateTimer_.setInterval(0);
+    connect(&updateTimer_, SIGNAL(timeout()), SLOT(processPendingUpdates()));
+
+    bypassTimer_.setSingleShot(true);
+    bypassTimer_.setInterval(BypassDelay);
+    connect(&bypassTimer_, SIGNAL(timeout()), SLOT(bypassTimeout()));
+
+    occlusionTimer_.setSingleShot(true);
+    connect(&occlusionTimer_, SIGNAL(timeout()), SLOT(scheduleOcclusionUpdate()));
+
     Q_ASSERT(QCoreApplication::instance());
     QCoreApplication::instance()->installNativeEventFilter(this);
 
     auto ewmhCookie = xcb_ewmh_init_atoms(connection_, &ewmh_);
+    auto atomCookies = ClientWindow::internAtoms(connection_);
     if (!xcb_ewmh_init_atoms_replies(&ewmh_, ewmhCookie, Q_NULLPTR)) {
         qFatal("Cannot init EWMH");
     }
+    atoms_ = ClientWindow::internAtomsReplies(connection_, atomCookies);
 
     auto wmCmCookie = xcb_ewmh_get_wm_cm_owner_unchecked(&ewmh_, QX11Info::appScreen());
     xcb_window_t wmCmOwnerWin = XCB_NONE;
@@ -96,17 +181,31 @@ Compositor::Compositor()
     }
 
     auto children = xcb_query_tree_children(tree.get());
-    for (int i = 0; i < xcb_query_tree_children_length(tree.get()); i++) {
-        addChildWindow(children[i]);
+    auto nChildren = xcb_query_tree_children_length(tree.get());
+    stacking_.reset(children, nChildren);
+
+    QVector<xcb_window_t> childWindows;
+    childWindows.reserve(nChildren);
+    for (int i = 0; i < nChildren; i++) {
+        if (children[i] != overlayWindow->overlay_win) {
+            childWindows.append(children[i]);
+        }
+    }
+    for (const auto &w : ClientWindow::create(&ewmh_, atoms_, childWindows)) {
+        addClientWindow(w);
     }
-    updateActiveWindow();
+    processPendingUpdates();
 
     initFinished_ = true;
 }
 
 Compositor::~Compositor()
 {
+    setBypassActive(false);
     xcb_ewmh_connection_wipe(&ewmh_);
+    if (renderConnection_) {
+        xcb_disconnect(renderConnection_);
+    }
 }
 
 void Compositor::registerCompositor(QWindow *w)
@@ -121,17 +220,95 @@ void Compositor::registerCompositor(QWindow *w)
     if (wmCmOwnerWin != w->winId()) {
         qFatal("Another compositing manager is already running");
     }
+
+    // Any other window only owns the selection (XRenderCompositor draws on the overlay window)
+    // and isn't hidden during bypass
+    auto quickWindow = qobject_cast<QQuickWindow *>(w);
+    if (!quickWindow) {
+        return;
+    }
+    compositorWindow_ = w;
+
+    // Opened before the render thread starts; pixmaps are handed over as they are registered
+    if (separateRenderConnection_ && !renderConnection_) {
+        renderConnection_ = xcb_connect(DisplayString(QX11Info::display()), Q_NULLPTR);
+        if (xcb_connection_has_error(renderConnection_)) {
+            qWarning() << "Can't open render thread connection, sharing the GUI one";
+            xcb_disconnect(renderConnection_);
+            renderConnection_ = Q_NULLPTR;
+        }
+        for (auto pixmap : pixmaps_) {
+            pixmap->setRenderConnection(renderConnection_);
+        }
+    }
+    connect(quickWindow, SIGNAL(sceneGraphInitialized()), SLOT(sceneGraphInitialized()), Qt::DirectConnection);
+    connect(quickWindow, SIGNAL(afterSynchronizing()), SLOT(frameSynchronized()), Qt::DirectConnection);
+    if (startupTime_ < 0) {
+        connect(quickWindow, SIGNAL(frameSwapped()), SLOT(firstFrameSwapped()), Qt::DirectConnection);
+    }
+}
+
+void Compositor::sceneGraphInitialized()
+{
+    // Called from render thread, before the first frame
+    WindowTexture::prepareBackend();
+}
+
+void Compositor::resetRenderFlushTimes()
+{
+    renderFlushNsecs_.store(0);
+    renderFlushMaxNsecs_.store(0);
+}
+
+void Compositor::frameSynchronized()
+{
+    // Called from render thread, after all items cleared their damage
+    frames_.fetchAndAddRelaxed(1);
+    culledDrawCalls_.fetchAndAddRelaxed(occludedWindows_.load());
+    QElapsedTimer flushTimer;
+    flushTimer.start();
+    auto acknowledgements = WindowPixmap::flushDamageAcknowledgements(renderConnection());
+    if (acknowledgements) {
+        auto nsecs = flushTimer.nsecsElapsed();
+        renderFlushNsecs_.fetchAndAddRelaxed(nsecs);
+        auto max = renderFlushMaxNsecs_.load();
+        while (nsecs > max && !renderFlushMaxNsecs_.testAndSetRelaxed(max, nsecs)) {
+            max = renderFlushMaxNsecs_.load();
+        }
+        damageAcknowledgements_.fetchAndAddRelaxed(acknowledgements);
+        damageFlushes_.fetchAndAddRelaxed(1);
+    }
+
+    // Nothing selects events on the render connection; only errors end up there
+    if (renderConnection_) {
+        while (auto e = xcb_poll_for_event(renderConnection_)) {
+            if (!e->response_type) {
+                renderConnectionErrors_.fetchAndAddRelaxed(1);
+            }
+            std::free(e);
+        }
+    }
+}
+
+void Compositor::firstFrameSwapped()
+{
+    // Called from render thread
+    if (firstFrameSwapped_.testAndSetOrdered(0, 1)) {
+        startupTime_ = startupTimer_.elapsed();
+        QMetaObject::invokeMethod(this, "startupFinished", Qt::QueuedConnection);
+    }
+}
+
+void Compositor::startupFinished()
+{
+    qDebug(log) << "Startup time:" << startupTime_ << "ms";
+    Q_EMIT startupTimeChanged(startupTime_);
 }
 
 template<typename T>
 bool Compositor::xcbDispatchEvent(const T *e, xcb_window_t window)
 {
-    auto i = windows_.constFind(window);
-    if (i != windows_.constEnd()) {
-        (*i)->xcbEvent(e);
-        return true;
-    }
-    return false;
+    return xcbDeliverEvent(windows_, window, e);
 }
 
 template<typename T>
@@ -157,7 +334,11 @@ bool Compositor::xcbEvent(const xcb_configure_notify_event_t *e)
         if (rootGeometry_ != newGeometry) {
             rootGeometry_ = newGeometry;
             Q_EMIT rootGeometryChanged(rootGeometry_);
+            windowLayoutChanged();
         }
+    } else if (e->event == root_) {
+        changeStacking(StackingChange::Restack, e->window, e->above_sibling, e->sequence);
+        scheduleZIndexUpdate();
     }
 
     if (e->window != e->event) {
@@ -174,43 +355,67 @@ bool Compositor::xcbEvent(const xcb_create_notify_event_t *e)
         return false;
     }
 
+    changeStacking(StackingChange::Add, e->window, XCB_NONE, e->sequence);
     addChildWindow(e->window);
+    scheduleZIndexUpdate();
     return true;
 }
 
 template<>
 bool Compositor::xcbEvent(const xcb_destroy_notify_event_t *e)
 {
+    invalidateTopLevelCache(e->window);
+
     if (e->event != root_) {
         return false;
     }
 
     removeChildWindow(e->window);
+    changeStacking(StackingChange::Remove, e->window, XCB_NONE, e->sequence);
+    scheduleZIndexUpdate();
     return true;
 }
 
 template<>
 bool Compositor::xcbEvent(const xcb_reparent_notify_event_t *e)
 {
+    invalidateTopLevelCache(e->window);
+
     if (e->event != root_) {
         return false;
     }
 
     if (e->parent == root_) {
+        changeStacking(StackingChange::Add, e->window, XCB_NONE, e->sequence);
         addChildWindow(e->window);
     } else {
         removeChildWindow(e->window);
+        changeStacking(StackingChange::Remove, e->window, XCB_NONE, e->sequence);
     }
+    scheduleZIndexUpdate();
 
     return xcbDispatchEvent(e);
 }
 
+template<>
+bool Compositor::xcbEvent(const xcb_circulate_notify_event_t *e)
+{
+    if (e->event != root_) {
+        return false;
+    }
+
+    changeStacking(e->place == XCB_PLACE_ON_TOP ? StackingChange::Raise : StackingChange::Lower,
+                   e->window, XCB_NONE, e->sequence);
+    scheduleZIndexUpdate();
+    return windows_.contains(e->window);
+}
+
 template<>
 bool Compositor::xcbEvent(const xcb_property_notify_event_t *e)
 {
     if (e->window == root_) {
         if (e->atom == ewmh_._NET_ACTIVE_WINDOW) {
-            updateActiveWindow();
+            scheduleActiveWindowUpdate();
         }
         return false;
     }
@@ -218,43 +423,23 @@ bool Compositor::xcbEvent(const xcb_property_notify_event_t *e)
     return xcbDispatchEvent(e);
 }
 
+template<>
+bool Compositor::xcbEvent(const xcb_damage_notify_event_t *e)
+{
+    return xcbDeliverEvent(pixmaps_, e->damage, e);
+}
+
 bool Compositor::nativeEventFilter(const QByteArray &eventType, void *message, long *)
 {
     Q_ASSERT(eventType == QByteArrayLiteral("xcb_generic_event_t"));
-
-    auto responseType = XCB_EVENT_RESPONSE_TYPE(static_cast<xcb_generic_event_t *>(message));
-    if (responseType == damageExt_->first_event + XCB_DAMAGE_NOTIFY) {
-        auto e = static_cast<xcb_damage_notify_event_t *>(message);
-        auto i = pixmaps_.constFind(e->damage);
-        if (i == pixmaps_.constEnd()) {
-            return false;
-        }
-        (*i)->xcbEvent(e);
-        return true;
+    StallMeter stallMeter(&eventLoopStalls_);
+    xEvents_.fetchAndAddRelaxed(1);
+    if (recorder_) {
+        recorder_->recordEvent(static_cast<xcb_generic_event_t *>(message));
     }
 
-    switch (responseType) {
-    case XCB_CREATE_NOTIFY:
-        return xcbEvent(static_cast<xcb_create_notify_event_t *>(message));
-    case XCB_DESTROY_NOTIFY:
-        return xcbEvent(static_cast<xcb_destroy_notify_event_t *>(message));
-    case XCB_REPARENT_NOTIFY:
-        return xcbEvent(static_cast<xcb_reparent_notify_event_t *>(message));
-    case XCB_CONFIGURE_NOTIFY:
-        return xcbEvent(static_cast<xcb_configure_notify_event_t *>(message));
-    case XCB_MAP_NOTIFY:
-        return xcbEvent(static_cast<xcb_map_notify_event_t *>(message));
-    case XCB_UNMAP_NOTIFY:
-        return xcbEvent(static_cast<xcb_unmap_notify_event_t *>(message));
-    case XCB_GRAVITY_NOTIFY:
-        return xcbEvent(static_cast<xcb_gravity_notify_event_t *>(message));
-    case XCB_CIRCULATE_NOTIFY:
-        return xcbEvent(static_cast<xcb_circulate_notify_event_t *>(message));
-    case XCB_PROPERTY_NOTIFY:
-        return xcbEvent(static_cast<xcb_property_notify_event_t *>(message));
-    default:
-        return false;
-    }
+    return xcbDecodeEvent(this, damageExt_->first_event + XCB_DAMAGE_NOTIFY,
+                          static_cast<xcb_generic_event_t *>(message));
 }
 
 void Compositor::addChildWindow(xcb_window_t window)
@@ -266,12 +451,29 @@ void Compositor::addChildWindow(xcb_window_t window)
         return;
     }
 
-    QSharedPointer<ClientWindow> w(new ClientWindow(&ewmh_, window)); // TODO: replace with ::create
+    addClientWindow(ClientWindow::create(&ewmh_, atoms_, window));
+}
+
+void Compositor::addClientWindow(const QSharedPointer<ClientWindow> &w)
+{
+    auto window = w->window();
     if (w->isValid() && w->windowClass() != XCB_WINDOW_CLASS_INPUT_ONLY) {
         windows_.insert(window, w);
+        connect(w.data(), SIGNAL(pixmapCreated(WindowPixmap*)), SLOT(registerPixmap(WindowPixmap*)));
+        // The first pixmap may have been requested before we were connected
         connect(w.data(), SIGNAL(pixmapChanged(WindowPixmap*)), SLOT(registerPixmap(WindowPixmap*)));
-        connect(w.data(), SIGNAL(stackingOrderChanged()), SLOT(restack()));
-        restack();
+        connect(w.data(), SIGNAL(mapStateChanged(bool)), SLOT(windowLayoutChanged()));
+        connect(w.data(), SIGNAL(geometryChanged(QRect)), SLOT(windowLayoutChanged()));
+        connect(w.data(), SIGNAL(zIndexChanged(int)), SLOT(windowLayoutChanged()));
+        connect(w.data(), SIGNAL(opacityChanged(qreal)), SLOT(windowLayoutChanged()));
+        connect(w.data(), SIGNAL(bypassCompositorChanged(BypassCompositor)), SLOT(scheduleBypassUpdate()));
+
+        auto zIndex = stacking_.indexOf(window);
+        if (zIndex < 0) {
+            scheduleStackingRebuild();
+        } else {
+            w->setZIndex(zIndex);
+        }
 
         if (initFinished_) {
             Q_EMIT windowCreated(w.data());
@@ -279,81 +481,479 @@ void Compositor::addChildWindow(xcb_window_t window)
             QMetaObject::invokeMethod(this, "windowCreated", Qt::QueuedConnection, Q_ARG(ClientWindow*, w.data()));
         }
 
-        updateActiveWindow();
+        scheduleActiveWindowUpdate();
     }
 }
 
 void Compositor::removeChildWindow(xcb_window_t window)
 {
-    auto i = windows_.find(window);
-    if (i == windows_.end()) {
+    auto w = windows_.take(window);
+    if (!w) {
         return;
     }
-    (*i)->invalidate();
-    (*i)->disconnect(this);
-    windows_.erase(i);
+    w->invalidate();
+    w->disconnect(this);
+    invalidateTopLevelCache(window);
+    windowLayoutChanged();
 }
 
 void Compositor::registerPixmap(WindowPixmap *pixmap)
 {
     if (pixmap->isValid()) {
         connect(pixmap, SIGNAL(destroyed(WindowPixmap*)),
-                SLOT(unregisterPixmap(WindowPixmap*)), Qt::DirectConnection);
+                SLOT(unregisterPixmap(WindowPixmap*)),
+                static_cast<Qt::ConnectionType>(Qt::DirectConnection | Qt::UniqueConnection));
+        if (recorder_ && !pixmaps_.contains(pixmap->damage())) {
+            recorder_->recordPixmapNamed(pixmap->window(), pixmap->pixmap(), pixmap->damage());
+        }
         pixmaps_.insert(pixmap->damage(), pixmap);
+        pixmap->setRenderConnection(renderConnection_);
     }
 }
 
 void Compositor::unregisterPixmap(WindowPixmap *pixmap)
 {
-    pixmaps_.remove(pixmap->damage());
+    if (pixmaps_.remove(pixmap->damage()) && recorder_) {
+        recorder_->recordPixmapRemoved(pixmap->damage());
+    }
 }
 
-void Compositor::restack() // TODO: maintain stacking order somehow
+void Compositor::setEventRecorder(EventRecorder *recorder)
 {
-    auto treeCookie = xcb_query_tree_unchecked(connection_, root_);
-    auto tree = xcbReply(xcb_query_tree_reply(connection_, treeCookie, Q_NULLPTR));
-    auto children = xcb_query_tree_children(tree.get());
-    for (int i = 0; i < xcb_query_tree_children_length(tree.get()); i++) {
-        auto w = windows_.constFind(children[i]);
-        if (w != windows_.constEnd()) {
-            (*w)->setZIndex(i);
-            if (i) {
-                (*w)->setAbove(children[i - 1]);
-            } else {
-                (*w)->setAbove(XCB_NONE);
+    recorder_ = recorder;
+    if (!recorder_) {
+        return;
+    }
+
+    QVector<EventRecord::Window> windows;
+    for (int i = 0; i < stacking_.size(); i++) {
+        auto w = windows_.value(stacking_.at(i));
+        if (w) {
+            windows.append({ w->window(), w->geometry(), w->isMapped(), w->isOverrideRedirect() });
+        }
+    }
+    recorder_->begin(root_, rootGeometry_.size(), damageExt_->first_event + XCB_DAMAGE_NOTIFY, windows);
+    for (auto i = pixmaps_.constBegin(); i != pixmaps_.constEnd(); ++i) {
+        recorder_->recordPixmapNamed((*i)->window(), (*i)->pixmap(), i.key());
+    }
+}
+
+void Compositor::scheduleStackingRebuild()
+{
+    stackingRebuildPending_ = true;
+    if (!updateTimer_.isActive()) {
+        updateTimer_.start();
+    }
+}
+
+void Compositor::scheduleZIndexUpdate()
+{
+    if (stacking_.isDirty() && !updateTimer_.isActive()) {
+        updateTimer_.start();
+    }
+}
+
+void Compositor::scheduleActiveWindowUpdate()
+{
+    activeWindowUpdatePending_ = true;
+    if (!updateTimer_.isActive()) {
+        updateTimer_.start();
+    }
+}
+
+void Compositor::processPendingUpdates()
+{
+    StallMeter stallMeter(&eventLoopStalls_);
+    updateTimer_.stop();
+
+    if (stackingRebuildPending_) {
+        stackingRebuildPending_ = false;
+        rebuildStackingOrder();
+    }
+    updateZIndices();
+
+    if (activeWindowUpdatePending_) {
+        activeWindowUpdatePending_ = false;
+        updateActiveWindow();
+    }
+
+    if (bypassUpdatePending_) {
+        bypassUpdatePending_ = false;
+        updateBypass();
+    }
+
+    if (occlusionUpdatePending_) {
+        occlusionUpdatePending_ = false;
+        updateOcclusion();
+    }
+}
+
+void Compositor::windowLayoutChanged()
+{
+    scheduleBypassUpdate();
+    scheduleOcclusionUpdate();
+}
+
+void Compositor::scheduleOcclusionUpdate()
+{
+    occlusionUpdatePending_ = true;
+    if (!updateTimer_.isActive()) {
+        updateTimer_.start();
+    }
+}
+
+void Compositor::updateOcclusion()
+{
+    occlusionTable_.clear();
+    QVector<ClientWindow *> mapped;
+    mapped.reserve(stacking_.size());
+    qint64 nextSettle = -1;
+    for (int i = 0; i < stacking_.size(); i++) {
+        auto w = windows_.value(stacking_.at(i));
+        if (!w) {
+            continue;
+        }
+        if (!w->isMapped()) {
+            // Unmapped windows may still be fading out
+            w->setOccluded(false);
+            continue;
+        }
+
+        auto mappedFor = w->mappedFor();
+        auto settled = mappedFor >= OccluderSettleTime;
+        if (!settled) {
+            auto remaining = OccluderSettleTime - qMax<qint64>(0, mappedFor);
+            nextSettle = (nextSettle < 0) ? remaining : qMin(nextSettle, remaining);
+        }
+
+        auto border = w->borderWidth();
+        occlusionTable_.append(w->geometry().adjusted(0, 0, 2 * border, 2 * border),
+                               settled && w->isOpaque());
+        mapped.append(w.data());
+    }
+
+    occlusionTable_.compute(rootGeometry_, &occluded_);
+    int occludedCount = 0;
+    for (int i = 0; i < mapped.size(); i++) {
+        mapped[i]->setOccluded(occluded_.at(i));
+        occludedCount += occluded_.at(i);
+    }
+    occludedWindows_.store(occludedCount);
+
+    if (nextSettle >= 0) {
+        occlusionTimer_.start(static_cast<int>(nextSettle));
+    }
+}
+
+void Compositor::scheduleBypassUpdate()
+{
+    if (!bypassEnabled_) {
+        return;
+    }
+    bypassUpdatePending_ = true;
+    if (!updateTimer_.isActive()) {
+        updateTimer_.start();
+    }
+}
+
+void Compositor::setBypassEnabled(bool enabled)
+{
+    if (bypassEnabled_ == enabled) {
+        return;
+    }
+    bypassEnabled_ = enabled;
+    if (enabled) {
+        scheduleBypassUpdate();
+    } else {
+        bypassTimer_.stop();
+        bypassWindow_ = XCB_NONE;
+        setBypassActive(false);
+    }
+    Q_EMIT bypassEnabledChanged(enabled);
+}
+
+xcb_window_t Compositor::bypassCandidate() const
+{
+    // Only the top-most mapped window matters
+    for (int i = stacking_.size() - 1; i >= 0; i--) {
+        auto w = windows_.value(stacking_.at(i));
+        if (!w || !w->isMapped()) {
+            continue;
+        }
+
+        // A request to bypass skips the opacity check, but the window still has to cover the
+        // screen: unredirecting is all or nothing, everything else would go undrawn
+        auto border = w->borderWidth();
+        auto outer = w->geometry().adjusted(0, 0, 2 * border, 2 * border);
+        if (!outer.contains(rootGeometry_)) {
+            return XCB_NONE;
+        }
+
+        switch (w->bypassCompositor()) {
+        case ClientWindow::BYPASS_REQUESTED:
+            return w->window();
+        case ClientWindow::BYPASS_FORBIDDEN:
+            return XCB_NONE;
+        default:
+            return w->isOpaque() ? w->window() : XCB_NONE;
+        }
+    }
+    return XCB_NONE;
+}
+
+void Compositor::updateBypass()
+{
+    auto candidate = bypassEnabled_ ? bypassCandidate() : XCB_NONE;
+    if (candidate == XCB_NONE) {
+        bypassTimer_.stop();
+        bypassWindow_ = XCB_NONE;
+        setBypassActive(false);
+        return;
+    }
+
+    if (bypassActive_) {
+        // Another full-screen window replaced the first one, nothing to redraw
+        bypassWindow_ = candidate;
+        return;
+    }
+
+    if (candidate != bypassWindow_ || !bypassTimer_.isActive()) {
+        bypassWindow_ = candidate;
+        bypassTimer_.start();
+    }
+}
+
+void Compositor::bypassTimeout()
+{
+    if (bypassEnabled_ && bypassWindow_ != XCB_NONE && bypassCandidate() == bypassWindow_) {
+        setBypassActive(true);
+    }
+}
+
+void Compositor::setBypassActive(bool active)
+{
+    if (bypassActive_ == active) {
+        return;
+    }
+    bypassActive_ = active;
+
+    // The overlay window is made transparent for output while windows draw directly
+    auto overlay = overlayWindow_->winId();
+    if (active) {
+        auto region = xcb_generate_id(connection_);
+        xcb_xfixes_create_region(connection_, region, 0, Q_NULLPTR);
+        xcb_xfixes_set_window_shape_region(connection_, overlay, XCB_SHAPE_SK_BOUNDING, 0, 0, region);
+        xcb_xfixes_destroy_region(connection_, region);
+        xcb_composite_unredirect_subwindows(connection_, root_, XCB_COMPOSITE_REDIRECT_MANUAL);
+        if (compositorWindow_) {
+            compositorWindow_->hide();
+        }
+    } else {
+        xcb_composite_redirect_subwindows(connection_, root_, XCB_COMPOSITE_REDIRECT_MANUAL);
+        xcb_xfixes_set_window_shape_region(connection_, overlay, XCB_SHAPE_SK_BOUNDING, 0, 0, XCB_NONE);
+
+        // Old pixmaps stopped following their windows when they were unredirected
+        for (const auto &w : windows_) {
+            w->refreshPixmap();
+        }
+        if (compositorWindow_) {
+            compositorWindow_->show();
+        }
+    }
+    xcb_flush(connection_);
+
+    Q_EMIT bypassActiveChanged(active);
+}
+
+void Compositor::rebuildStackingOrder()
+{
+    if (stackingRebuildInFlight_) {
+        return;
+    }
+    stackingRebuildInFlight_ = true;
+
+    qWarning() << "Stacking order is out of sync with the server, rebuilding";
+
+    // Events dispatched before the reply arrives may have happened after the server answered
+    // the query; changeStacking() journals them so they can be applied on top of the snapshot
+    auto treeCookie = xcb_query_tree(connection_, root_);
+    auto treeSequence = quint16(treeCookie.sequence);
+    XcbAsyncReplies::instance(connection_)->await<xcb_query_tree_reply_t>(treeCookie, this,
+            [this, treeSequence](xcb_query_tree_reply_t *tree, xcb_generic_error_t *)
+    {
+        stackingRebuildInFlight_ = false;
+        QVector<StackingChange> journal;
+        journal.swap(stackingJournal_);
+        if (!tree) {
+            qWarning() << "Cannot query window tree";
+            return;
+        }
+        stacking_.reset(xcb_query_tree_children(tree), xcb_query_tree_children_length(tree));
+
+        // An event carries the sequence number of the last request the server had processed,
+        // so from the query's own number on it wasn't reflected in the reply
+        for (const auto &change : journal) {
+            if (qint16(change.sequence - treeSequence) >= 0 && !applyStackingChange(change)) {
+                scheduleStackingRebuild();
             }
         }
+        updateZIndices();
+    });
+}
+
+void Compositor::changeStacking(StackingChange::Type type, xcb_window_t window, xcb_window_t sibling,
+                                quint16 sequence)
+{
+    StackingChange change = { type, window, sibling, sequence };
+
+    // While a rebuild is in flight the list is about to be replaced, so mismatches are expected
+    if (stackingRebuildInFlight_) {
+        stackingJournal_.append(change);
+        applyStackingChange(change);
+    } else if (!applyStackingChange(change)) {
+        scheduleStackingRebuild();
     }
 }
 
-QSharedPointer<ClientWindow> Compositor::findTopLevel(xcb_window_t subWindow)
+bool Compositor::applyStackingChange(const StackingChange &change)
 {
-    while (subWindow && subWindow != root_) {
-        auto found = windows_.constFind(subWindow);
-        if (found != windows_.constEnd()) {
-            return *found;
+    switch (change.type) {
+    case StackingChange::Add:
+        stacking_.add(change.window);
+        return true;
+    case StackingChange::Remove:
+        stacking_.remove(change.window);
+        return true;
+    case StackingChange::Restack:
+        return stacking_.restack(change.window, change.sibling);
+    case StackingChange::Raise:
+        return stacking_.raise(change.window);
+    case StackingChange::Lower:
+        return stacking_.lower(change.window);
+    }
+    return false;
+}
+
+void Compositor::updateZIndices()
+{
+    if (!stacking_.isDirty()) {
+        return;
+    }
+
+    auto last = qMin(stacking_.dirtyLast(), stacking_.size() - 1);
+    for (int i = stacking_.dirtyFirst(); i <= last; i++) {
+        auto w = windows_.constFind(stacking_.at(i));
+        if (w != windows_.constEnd()) {
+            (*w)->setZIndex(i);
         }
+    }
+    stacking_.clearDirty();
+}
+
+void Compositor::findTopLevel(xcb_window_t subWindow, const TopLevelContinuation &continuation)
+{
+    if (!subWindow || subWindow == root_) {
+        continuation(QSharedPointer<ClientWindow>());
+        return;
+    }
 
-        auto cookie = xcb_query_tree(connection_, subWindow);
-        auto tree = xcb_query_tree_reply(connection_, cookie, Q_NULLPTR);
-        subWindow = tree->parent;
-        std::free(tree);
+    auto found = windows_.constFind(subWindow);
+    if (found != windows_.constEnd()) {
+        continuation(*found);
+        return;
     }
-    return QSharedPointer<ClientWindow>();
+
+    auto cached = topLevelCache_.constFind(subWindow);
+    if (cached != topLevelCache_.constEnd()) {
+        topLevelCacheHits_++;
+        continuation(windows_.value(*cached));
+        return;
+    }
+
+    topLevelCacheMisses_++;
+    walkToTopLevel(subWindow, QVector<xcb_window_t>(), topLevelCacheGeneration_, continuation);
 }
 
-void Compositor::updateActiveWindow()
+void Compositor::walkToTopLevel(xcb_window_t window, QVector<xcb_window_t> chain, quint64 generation,
+                                const TopLevelContinuation &continuation)
 {
-    auto cookie = xcb_ewmh_get_active_window_unchecked(&ewmh_, QX11Info::appScreen());
-    xcb_window_t activeWindow = XCB_NONE;
-    if (!xcb_ewmh_get_active_window_reply(&ewmh_, cookie, &activeWindow, Q_NULLPTR)) {
+    if (!window || window == root_) {
+        continuation(QSharedPointer<ClientWindow>());
         return;
     }
 
-    auto newActiveWindow = findTopLevel(activeWindow);
-    if (activeWindow_ == newActiveWindow) {
+    auto found = windows_.constFind(window);
+    if (found != windows_.constEnd()) {
+        // The chain may be outdated if something was reparented while walking it
+        if (generation == topLevelCacheGeneration_) {
+            // Cached entries are invalidated by ReparentNotify/DestroyNotify, so they have to be selected
+            uint32_t eventMask = XCB_EVENT_MASK_STRUCTURE_NOTIFY;
+            for (auto w : chain) {
+                if (!topLevelCache_.contains(w)) {
+                    topLevelCache_.insert(w, window);
+                    topLevelChildren_.insert(window, w);
+                }
+                if (!isOwnWindow(w)) {
+                    xcb_change_window_attributes(connection_, w, XCB_CW_EVENT_MASK, &eventMask);
+                }
+            }
+        }
+        continuation(*found);
         return;
     }
-    activeWindow_ = newActiveWindow;
-    Q_EMIT activeWindowChanged();
+    chain.append(window);
+
+    auto cookie = xcb_query_tree(connection_, window);
+    XcbAsyncReplies::instance(connection_)->await<xcb_query_tree_reply_t>(cookie, this,
+            [this, chain, generation, continuation](xcb_query_tree_reply_t *tree, xcb_generic_error_t *)
+    {
+        if (!tree) {
+            continuation(QSharedPointer<ClientWindow>());
+            return;
+        }
+        walkToTopLevel(tree->parent, chain, generation, continuation);
+    });
+}
+
+void Compositor::invalidateTopLevelCache(xcb_window_t window)
+{
+    topLevelCacheGeneration_++;
+
+    // Descendants of the window aren't known, so drop everything under the same top-level
+    auto topLevel = topLevelCache_.value(window, window);
+    for (auto child : topLevelChildren_.values(topLevel)) {
+        topLevelCache_.remove(child);
+    }
+    topLevelChildren_.remove(topLevel);
+}
+
+bool Compositor::isOwnWindow(xcb_window_t window) const
+{
+    // Event masks of our own windows belong to Qt and must not be overwritten
+    auto setup = xcb_get_setup(connection_);
+    return (window & ~setup->resource_id_mask) == setup->resource_id_base;
+}
+
+void Compositor::updateActiveWindow()
+{
+    auto serial = ++activeWindowSerial_;
+    auto cookie = xcb_ewmh_get_active_window(&ewmh_, QX11Info::appScreen());
+    XcbAsyncReplies::instance(connection_)->await<xcb_get_property_reply_t>(cookie, this,
+            [this, serial](xcb_get_property_reply_t *reply, xcb_generic_error_t *)
+    {
+        xcb_window_t activeWindow = XCB_NONE;
+        if (serial != activeWindowSerial_ || !reply
+                || !xcb_ewmh_get_window_from_reply(&activeWindow, reply)) {
+            return;
+        }
+
+        findTopLevel(activeWindow, [this, serial](const QSharedPointer<ClientWindow> &newActiveWindow) {
+            // Only the latest _NET_ACTIVE_WINDOW counts
+            if (serial != activeWindowSerial_ || activeWindow_ == newActiveWindow) {
+                return;
+            }
+            activeWindow_ = newActiveWindow;
+            Q_EMIT activeWindowChanged();
+        });
+    });
 }
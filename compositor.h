@@ -1,25 +1,41 @@
 #pragma once
 
+#include <functional>
+
 #include <QAbstractNativeEventFilter>
-#include <QMap>
+#include <QAtomicInt>
+#include <QAtomicInteger>
+#include <QElapsedTimer>
+#include <QHash>
 #include <QObject>
+#include <QPointer>
 #include <QSet>
 #include <QSharedPointer>
 #include <QRect>
+#include <QRegion>
+#include <QTimer>
 
 #include <xcb/xcb.h>
 #include <xcb/damage.h>
 #include <xcb/xcb_ewmh.h>
 
+#include "clientwindow.h"
+#include "occlusiontable.h"
+#include "stackingorder.h"
+#include "xidmap.h"
+
 class QWindow;
-class ClientWindow;
 class WindowPixmap;
+class EventRecorder;
 
 class Compositor : public QObject, private QAbstractNativeEventFilter
 {
     Q_OBJECT
 
     Q_PROPERTY(ClientWindow* activeWindow READ activeWindow NOTIFY activeWindowChanged)
+    Q_PROPERTY(qint64 startupTime READ startupTime NOTIFY startupTimeChanged)
+    Q_PROPERTY(bool bypassEnabled READ isBypassEnabled WRITE setBypassEnabled NOTIFY bypassEnabledChanged)
+    Q_PROPERTY(bool bypassActive READ isBypassActive NOTIFY bypassActiveChanged)
 public:
     Compositor();
     ~Compositor() Q_DECL_OVERRIDE;
@@ -39,39 +55,245 @@ public:
         return activeWindow_.data();
     }
 
+    // Milliseconds from construction to the first frame swapped by the
+    // registered compositor window, -1 until that frame is presented
+    qint64 startupTime() const
+    {
+        return startupTime_;
+    }
+
+    // findTopLevel() lookups of sub-windows resolved from the cache and lookups that had to
+    // walk the tree; top-level windows themselves are found directly and not counted
+    quint64 topLevelCacheHits() const
+    {
+        return topLevelCacheHits_;
+    }
+
+    quint64 topLevelCacheMisses() const
+    {
+        return topLevelCacheMisses_;
+    }
+
+    // X events seen by the compositor, handled or not
+    quint64 xEvents() const
+    {
+        return xEvents_.load();
+    }
+
+    // Number of X event handlers and deferred updates that blocked the event loop for more than 1 ms
+    quint64 eventLoopStalls() const
+    {
+        return eventLoopStalls_;
+    }
+
+    // Frames synchronized by the registered compositor window, damage acknowledgements sent
+    // and X connection flushes done for them (at most one per frame)
+    quint64 frames() const
+    {
+        return frames_.load();
+    }
+
+    quint64 damageAcknowledgements() const
+    {
+        return damageAcknowledgements_.load();
+    }
+
+    quint64 damageFlushes() const
+    {
+        return damageFlushes_.load();
+    }
+
+    // Whether an opaque full-screen window on top, or one that sets _NET_WM_BYPASS_COMPOSITOR,
+    // is shown without compositing. Off by default.
+    bool isBypassEnabled() const
+    {
+        return bypassEnabled_;
+    }
+    void setBypassEnabled(bool);
+
+    // All windows are unredirected and the scene isn't rendered
+    bool isBypassActive() const
+    {
+        return bypassActive_;
+    }
+
+    // Windows skipped by the registered compositor window because they were occluded,
+    // summed over frames
+    quint64 culledDrawCalls() const
+    {
+        return culledDrawCalls_.load();
+    }
+
+    int occludedWindows() const
+    {
+        return occludedWindows_.load();
+    }
+
+    // Takes _NET_WM_CM_Sn with the window. A QQuickWindow is also the one being rendered.
     void registerCompositor(QWindow *);
 
+    // Whether the render thread of a registered QQuickWindow sends its X requests (damage
+    // acknowledgements, MIT-SHM reads) on a connection of its own, so they don't compete
+    // with event reads for the socket and the libxcb lock. On by default; has to be set
+    // before registerCompositor().
+    bool hasSeparateRenderConnection() const
+    {
+        return separateRenderConnection_;
+    }
+    void setSeparateRenderConnection(bool separate)
+    {
+        separateRenderConnection_ = separate;
+    }
+
+    // Connection used by the render thread: the separate one if it was opened, or the GUI one
+    xcb_connection_t *renderConnection() const
+    {
+        return renderConnection_ ? renderConnection_ : connection_;
+    }
+
+    // Time the render thread spent flushing damage acknowledgements: the sum over all
+    // flushes and the longest single one. A flush takes microseconds, so a distribution
+    // in the frame time histogram's buckets would say nothing.
+    qint64 renderFlushNsecs() const
+    {
+        return renderFlushNsecs_.load();
+    }
+    qint64 renderFlushMaxNsecs() const
+    {
+        return renderFlushMaxNsecs_.load();
+    }
+    void resetRenderFlushTimes();
+
+    // X errors received on the separate render connection, e.g. damage acknowledged
+    // after the GUI thread destroyed the pixmap
+    quint64 renderConnectionErrors() const
+    {
+        return renderConnectionErrors_.load();
+    }
+
+    // Writes the current windows, then every X event and pixmap change to the recorder,
+    // until it's reset to null
+    void setEventRecorder(EventRecorder *);
+
 Q_SIGNALS:
     void windowCreated(ClientWindow *clientWindow);
     void rootGeometryChanged(const QRect &);
     void activeWindowChanged();
+    void startupTimeChanged(qint64 startupTime);
+    void bypassEnabledChanged(bool bypassEnabled);
+    void bypassActiveChanged(bool bypassActive);
 
 private Q_SLOTS:
     void registerPixmap(WindowPixmap *);
     void unregisterPixmap(WindowPixmap *);
-    void restack();
-    void updateActiveWindow();
+    void processPendingUpdates();
+    void sceneGraphInitialized();
+    void frameSynchronized();
+    void firstFrameSwapped();
+    void startupFinished();
+    void windowLayoutChanged();
+    void scheduleBypassUpdate();
+    void bypassTimeout();
+    void scheduleOcclusionUpdate();
 
 private:
     template<typename T> bool xcbDispatchEvent(const T *, xcb_window_t);
     template<typename T> bool xcbDispatchEvent(const T *);
     template<typename T> bool xcbEvent(const T *);
+    template<typename Handler>
+    friend bool xcbDecodeEvent(Handler *, uint8_t, const xcb_generic_event_t *);
 
     bool nativeEventFilter(const QByteArray &eventType, void *message, long *) Q_DECL_OVERRIDE;
 
     void addChildWindow(xcb_window_t);
+    void addClientWindow(const QSharedPointer<ClientWindow> &);
     void removeChildWindow(xcb_window_t);
-    QSharedPointer<ClientWindow> findTopLevel(xcb_window_t);
+    void scheduleStackingRebuild();
+    void scheduleZIndexUpdate();
+    void scheduleActiveWindowUpdate();
+    void rebuildStackingOrder();
+    struct StackingChange
+    {
+        enum Type { Add, Remove, Restack, Raise, Lower } type;
+        xcb_window_t window;
+        xcb_window_t sibling;
+        quint16 sequence;
+    };
+    void changeStacking(StackingChange::Type, xcb_window_t window, xcb_window_t sibling, quint16 sequence);
+    bool applyStackingChange(const StackingChange &);
+    void updateZIndices();
+    void updateActiveWindow();
+    xcb_window_t bypassCandidate() const;
+    void updateBypass();
+    void setBypassActive(bool);
+    void updateOcclusion();
+    typedef std::function<void (const QSharedPointer<ClientWindow> &)> TopLevelContinuation;
+    void findTopLevel(xcb_window_t, const TopLevelContinuation &);
+    void walkToTopLevel(xcb_window_t, QVector<xcb_window_t> chain, quint64 generation,
+                        const TopLevelContinuation &);
+    void invalidateTopLevelCache(xcb_window_t);
+    bool isOwnWindow(xcb_window_t) const;
 
     xcb_connection_t *connection_;
     xcb_window_t root_;
     const xcb_query_extension_reply_t *damageExt_;
     xcb_ewmh_connection_t ewmh_;
+    ClientWindow::Atoms atoms_;
 
-    QMap<xcb_damage_damage_t, WindowPixmap *> pixmaps_;
-    QMap<xcb_window_t, QSharedPointer<ClientWindow> > windows_;
+    XidMap<WindowPixmap *> pixmaps_;
+    XidMap<QSharedPointer<ClientWindow> > windows_;
+    StackingOrder stacking_;
+    EventRecorder *recorder_;
+    QHash<xcb_window_t, xcb_window_t> topLevelCache_;
+    // Reverse index of topLevelCache_, for invalidation
+    QMultiHash<xcb_window_t, xcb_window_t> topLevelChildren_;
+    quint64 topLevelCacheHits_;
+    quint64 topLevelCacheMisses_;
+    quint64 topLevelCacheGeneration_;
+    quint64 activeWindowSerial_;
+    quint64 eventLoopStalls_;
+    QAtomicInteger<quint64> xEvents_;
     QScopedPointer<QWindow> overlayWindow_;
     QRect rootGeometry_;
     QSharedPointer<ClientWindow> activeWindow_;
     bool initFinished_;
+
+    // Stacking and active window changes are coalesced and processed once per event loop iteration
+    QTimer updateTimer_;
+    bool stackingRebuildPending_;
+    bool stackingRebuildInFlight_;
+    // Stacking changes seen while a rebuild's QueryTree is in flight
+    QVector<StackingChange> stackingJournal_;
+    bool activeWindowUpdatePending_;
+    bool bypassUpdatePending_;
+
+    // Bypass starts only after the same candidate stayed on top for a while,
+    // and ends as soon as it doesn't qualify anymore
+    bool bypassEnabled_;
+    bool bypassActive_;
+    xcb_window_t bypassWindow_;
+    QTimer bypassTimer_;
+    QPointer<QWindow> compositorWindow_;
+
+    bool occlusionUpdatePending_;
+    OcclusionTable occlusionTable_;
+    QVector<bool> occluded_;
+    QTimer occlusionTimer_;
+
+    QElapsedTimer startupTimer_;
+    QAtomicInt firstFrameSwapped_;
+    qint64 startupTime_;
+
+    QAtomicInteger<quint64> frames_;
+    QAtomicInteger<quint64> damageAcknowledgements_;
+    QAtomicInteger<quint64> damageFlushes_;
+    QAtomicInteger<quint64> culledDrawCalls_;
+    QAtomicInt occludedWindows_;
+
+    // Opened on the GUI thread before the render thread starts, used by the render thread after that
+    bool separateRenderConnection_;
+    xcb_connection_t *renderConnection_;
+    QAtomicInteger<qint64> renderFlushNsecs_;
+    QAtomicInteger<qint64> renderFlushMaxNsecs_;
+    QAtomicInteger<quint64> renderConnectionErrors_;
 };
@@ -0,0 +1,74 @@
+#include "eventlatencyprobe.h"
+
+#include <cstdlib>
+
+#include <QCoreApplication>
+#include <QX11Info>
+
+#include <xcb/xcb_event.h>
+
+EventLatencyProbe::EventLatencyProbe(int interval, QObject *parent)
+    : QObject(parent),
+      connection_(QX11Info::connection()),
+      window_(xcb_generate_id(connection_)),
+      atom_(XCB_NONE),
+      serial_(0),
+      pending_(false)
+{
+    static const char name[] = "_QMLCOMPMGR_LATENCY_PROBE";
+    auto atomCookie = xcb_intern_atom(connection_, false, sizeof(name) - 1, name);
+
+    // Input-only, so the compositor doesn't track it as a client window
+    uint32_t eventMask = XCB_EVENT_MASK_PROPERTY_CHANGE;
+    xcb_create_window(connection_, XCB_COPY_FROM_PARENT, window_, QX11Info::appRootWindow(), -1, -1, 1, 1, 0,
+                      XCB_WINDOW_CLASS_INPUT_ONLY, XCB_COPY_FROM_PARENT, XCB_CW_EVENT_MASK, &eventMask);
+
+    auto atom = xcb_intern_atom_reply(connection_, atomCookie, Q_NULLPTR);
+    if (atom) {
+        atom_ = atom->atom;
+        std::free(atom);
+    }
+
+    QCoreApplication::instance()->installNativeEventFilter(this);
+
+    timer_.setInterval(interval);
+    connect(&timer_, SIGNAL(timeout()), SLOT(probe()));
+    timer_.start();
+}
+
+EventLatencyProbe::~EventLatencyProbe()
+{
+    QCoreApplication::instance()->removeNativeEventFilter(this);
+    xcb_destroy_window(connection_, window_);
+    xcb_flush(connection_);
+}
+
+void EventLatencyProbe::probe()
+{
+    // One probe at a time, so a late one isn't mistaken for the next
+    if (pending_ || atom_ == XCB_NONE) {
+        return;
+    }
+    serial_++;
+    sent_.start();
+    pending_ = true;
+    xcb_change_property(connection_, XCB_PROP_MODE_REPLACE, window_, atom_, XCB_ATOM_CARDINAL, 32, 1, &serial_);
+    xcb_flush(connection_);
+}
+
+bool EventLatencyProbe::nativeEventFilter(const QByteArray &, void *message, long *)
+{
+    auto e = static_cast<xcb_generic_event_t *>(message);
+    if (XCB_EVENT_RESPONSE_TYPE(e) != XCB_PROPERTY_NOTIFY) {
+        return false;
+    }
+    auto notify = reinterpret_cast<xcb_property_notify_event_t *>(e);
+    if (notify->window != window_ || notify->atom != atom_) {
+        return false;
+    }
+    if (pending_) {
+        latency_.record(sent_.nsecsElapsed());
+        pending_ = false;
+    }
+    return true;
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <QAbstractNativeEventFilter>
+#include <QElapsedTimer>
+#include <QObject>
+#include <QTimer>
+
+#include <xcb/xcb.h>
+
+#include "latencyhistogram.h"
+
+// Measures how long X events wait before the GUI thread reads them. A property of a
+// private window is changed at a fixed interval, and the time until its PropertyNotify
+// comes through the native event filters is recorded. Everything that keeps the GUI
+// thread from reading the connection shows up: busy event handlers, and the render
+// thread holding the libxcb lock or the socket.
+class EventLatencyProbe : public QObject, private QAbstractNativeEventFilter
+{
+    Q_OBJECT
+public:
+    explicit EventLatencyProbe(int interval = 50, QObject *parent = Q_NULLPTR);
+    ~EventLatencyProbe() Q_DECL_OVERRIDE;
+
+    LatencyHistogram &latency()
+    {
+        return latency_;
+    }
+
+private Q_SLOTS:
+    void probe();
+
+private:
+    bool nativeEventFilter(const QByteArray &eventType, void *message, long *) Q_DECL_OVERRIDE;
+
+    xcb_connection_t *connection_;
+    xcb_window_t window_;
+    xcb_atom_t atom_;
+    quint32 serial_;
+    bool pending_;
+    QElapsedTimer sent_;
+    QTimer timer_;
+    LatencyHistogram latency_;
+};
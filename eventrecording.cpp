@@ -0,0 +1,159 @@
+#include "eventrecording.h"
+
+#include <QDebug>
+
+#include <xcb/xcb_event.h>
+
+// GenericEvent carries its length beyond the fixed 32 bytes
+static int eventSize(const xcb_generic_event_t *e)
+{
+    auto size = 32;
+    if (XCB_EVENT_RESPONSE_TYPE(e) == XCB_GE_GENERIC) {
+        size += 4 * reinterpret_cast<const xcb_ge_generic_event_t *>(e)->length;
+    }
+    return size;
+}
+
+EventRecorder::EventRecorder(const QString &fileName)
+    : file_(fileName),
+      lastRecord_(0),
+      records_(0)
+{
+    if (!file_.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        qWarning() << "Can't open event recording" << fileName << file_.errorString();
+        return;
+    }
+    stream_.setDevice(&file_);
+    stream_.setVersion(QDataStream::Qt_5_4);
+}
+
+void EventRecorder::begin(xcb_window_t root, const QSize &rootSize, uint8_t damageNotify,
+                          const QVector<EventRecord::Window> &windows)
+{
+    if (!isOpen()) {
+        return;
+    }
+
+    stream_ << EventRecord::Magic << EventRecord::Version
+            << quint32(root) << rootSize << quint8(damageNotify);
+    stream_ << quint32(windows.size());
+    for (const auto &w : windows) {
+        stream_ << quint32(w.window) << w.geometry << w.mapped << w.overrideRedirect;
+    }
+    clock_.start();
+}
+
+void EventRecorder::beginRecord(EventRecord::Type type)
+{
+    auto now = clock_.nsecsElapsed() / 1000;
+    stream_ << quint8(type) << quint32(now - lastRecord_);
+    lastRecord_ = now;
+    records_++;
+}
+
+void EventRecorder::recordEvent(const xcb_generic_event_t *e)
+{
+    if (!isOpen()) {
+        return;
+    }
+    beginRecord(EventRecord::Event);
+    auto size = eventSize(e);
+    stream_ << quint16(size);
+    stream_.writeRawData(reinterpret_cast<const char *>(e), size);
+}
+
+void EventRecorder::recordPixmapNamed(xcb_window_t window, xcb_pixmap_t pixmap, xcb_damage_damage_t damage)
+{
+    if (!isOpen()) {
+        return;
+    }
+    beginRecord(EventRecord::PixmapNamed);
+    stream_ << quint32(window) << quint32(pixmap) << quint32(damage);
+}
+
+void EventRecorder::recordPixmapRemoved(xcb_damage_damage_t damage)
+{
+    if (!isOpen()) {
+        return;
+    }
+    beginRecord(EventRecord::PixmapRemoved);
+    stream_ << quint32(damage);
+}
+
+EventRecording::EventRecording(const QString &fileName)
+    : file_(fileName),
+      valid_(false),
+      root_(XCB_NONE),
+      damageNotify_(0)
+{
+    if (!file_.open(QIODevice::ReadOnly)) {
+        qWarning() << "Can't open event recording" << fileName << file_.errorString();
+        return;
+    }
+    stream_.setDevice(&file_);
+    stream_.setVersion(QDataStream::Qt_5_4);
+
+    quint32 magic = 0, version = 0, root = 0, windowCount = 0;
+    quint8 damageNotify = 0;
+    stream_ >> magic >> version >> root >> rootSize_ >> damageNotify >> windowCount;
+    if (magic != EventRecord::Magic || version != EventRecord::Version || stream_.status() != QDataStream::Ok) {
+        qWarning() << fileName << "is not an event recording";
+        return;
+    }
+    root_ = root;
+    damageNotify_ = damageNotify;
+
+    windows_.reserve(windowCount);
+    for (quint32 i = 0; i < windowCount && stream_.status() == QDataStream::Ok; i++) {
+        quint32 window = 0;
+        EventRecord::Window w;
+        stream_ >> window >> w.geometry >> w.mapped >> w.overrideRedirect;
+        w.window = window;
+        windows_.append(w);
+    }
+    valid_ = (stream_.status() == QDataStream::Ok);
+}
+
+bool EventRecording::next(EventRecord::Record *record)
+{
+    if (!valid_ || stream_.atEnd()) {
+        return false;
+    }
+
+    quint8 type = 0;
+    quint32 usecs = 0;
+    stream_ >> type >> usecs;
+    record->type = static_cast<EventRecord::Type>(type);
+    record->usecs = usecs;
+
+    quint32 window = 0, pixmap = 0, damage = 0;
+    switch (record->type) {
+    case EventRecord::Event: {
+        quint16 size = 0;
+        stream_ >> size;
+        // Handlers read fixed-size structs, so short events are padded
+        record->event.fill(0, qMax<int>(size, sizeof(xcb_generic_event_t)));
+        stream_.readRawData(record->event.data(), size);
+        break;
+    }
+    case EventRecord::PixmapNamed:
+        stream_ >> window >> pixmap >> damage;
+        break;
+    case EventRecord::PixmapRemoved:
+        stream_ >> damage;
+        break;
+    default:
+        qWarning() << "Unknown record type" << type;
+        valid_ = false;
+        return false;
+    }
+    record->window = window;
+    record->pixmap = pixmap;
+    record->damage = damage;
+
+    if (stream_.status() != QDataStream::Ok) {
+        valid_ = false;
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,132 @@
+#pragma once
+
+#include <QDataStream>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QRect>
+#include <QVector>
+
+#include <xcb/xcb.h>
+#include <xcb/damage.h>
+
+// Recording of the X event stream as seen by Compositor, for replaying a session offline.
+//
+// File layout (QDataStream, Qt 5.4 format):
+//   header:  magic, version, root window, root size, DamageNotify response type
+//   windows: count, then window, geometry, mapped, override-redirect of each root child,
+//            bottom to top
+//   records: type, microseconds since the previous record, then
+//            Event:         size, raw event bytes
+//            PixmapNamed:   window, pixmap, damage
+//            PixmapRemoved: damage
+// Pixmaps are named by the compositor's own connection, so DamageNotify events can only
+// be matched to windows through the PixmapNamed records.
+namespace EventRecord
+{
+    enum Type {
+        Event = 0,
+        PixmapNamed = 1,
+        PixmapRemoved = 2
+    };
+
+    struct Window
+    {
+        xcb_window_t window;
+        QRect geometry;
+        bool mapped;
+        bool overrideRedirect;
+    };
+
+    struct Record
+    {
+        Type type;
+        quint32 usecs;
+        QByteArray event;
+        xcb_window_t window;
+        xcb_pixmap_t pixmap;
+        xcb_damage_damage_t damage;
+    };
+
+    const quint32 Magic = 0x51434d52; // "QCMR"
+    const quint32 Version = 1;
+}
+
+class EventRecorder
+{
+public:
+    explicit EventRecorder(const QString &fileName);
+
+    bool isOpen() const
+    {
+        return file_.isOpen();
+    }
+
+    void begin(xcb_window_t root, const QSize &rootSize, uint8_t damageNotify,
+               const QVector<EventRecord::Window> &windows);
+
+    void recordEvent(const xcb_generic_event_t *);
+    void recordPixmapNamed(xcb_window_t, xcb_pixmap_t, xcb_damage_damage_t);
+    void recordPixmapRemoved(xcb_damage_damage_t);
+
+    qint64 records() const
+    {
+        return records_;
+    }
+
+private:
+    Q_DISABLE_COPY(EventRecorder)
+
+    void beginRecord(EventRecord::Type);
+
+    QFile file_;
+    QDataStream stream_;
+    QElapsedTimer clock_;
+    qint64 lastRecord_;
+    qint64 records_;
+};
+
+class EventRecording
+{
+public:
+    explicit EventRecording(const QString &fileName);
+
+    // False if the file can't be read or isn't a recording
+    bool isValid() const
+    {
+        return valid_;
+    }
+
+    xcb_window_t root() const
+    {
+        return root_;
+    }
+
+    const QSize &rootSize() const
+    {
+        return rootSize_;
+    }
+
+    uint8_t damageNotify() const
+    {
+        return damageNotify_;
+    }
+
+    const QVector<EventRecord::Window> &windows() const
+    {
+        return windows_;
+    }
+
+    // False at the end of the file
+    bool next(EventRecord::Record *);
+
+private:
+    Q_DISABLE_COPY(EventRecording)
+
+    QFile file_;
+    QDataStream stream_;
+    bool valid_;
+    xcb_window_t root_;
+    QSize rootSize_;
+    uint8_t damageNotify_;
+    QVector<EventRecord::Window> windows_;
+};
@@ -0,0 +1,141 @@
+#include "framemetrics.h"
+
+#include <QQuickWindow>
+
+#include "compositor.h"
+#include "glxtexturefrompixmap.h"
+#include "shmtexture.h"
+#include "windowpixmap.h"
+#include "windowthumbnailitem.h"
+
+// Window textures brought up to date, by either backend
+static qint64 textureUpdates()
+{
+    return GLXTextureFromPixmap::rebinds() + ShmTexture::uploads();
+}
+
+FrameMetrics::FrameMetrics(Compositor *compositor, QQuickWindow *window, QObject *parent)
+    : QObject(parent),
+      compositor_(compositor),
+      window_(window),
+      active_(false),
+      syncDone_(0),
+      renderDone_(0),
+      periodFrames_(0),
+      syncNsecs_(0),
+      renderNsecs_(0),
+      swapNsecs_(0),
+      lastDamageAcknowledgements_(0),
+      lastRebinds_(0),
+      lastDamageFlushes_(0),
+      lastXEvents_(0),
+      fps_(0),
+      frameTime50_(0),
+      frameTime90_(0),
+      frameTime99_(0),
+      syncTime_(0),
+      renderTime_(0),
+      swapTime_(0),
+      damagedWindowsPerFrame_(0),
+      rebindsPerFrame_(0),
+      damageFlushesPerFrame_(0),
+      xEventsPerSecond_(0),
+      thumbnailCacheKiB_(0)
+{
+    updateTimer_.setInterval(UpdateInterval);
+    connect(&updateTimer_, SIGNAL(timeout()), SLOT(update()));
+}
+
+FrameMetrics::~FrameMetrics()
+{
+    setActive(false);
+}
+
+void FrameMetrics::setActive(bool active)
+{
+    if (active == active_) {
+        return;
+    }
+    active_ = active;
+
+    if (active_) {
+        resetPeriod();
+        connect(window_, SIGNAL(beforeSynchronizing()), SLOT(beforeSynchronizing()), Qt::DirectConnection);
+        connect(window_, SIGNAL(afterSynchronizing()), SLOT(afterSynchronizing()), Qt::DirectConnection);
+        connect(window_, SIGNAL(afterRendering()), SLOT(afterRendering()), Qt::DirectConnection);
+        connect(window_, SIGNAL(frameSwapped()), SLOT(frameSwapped()), Qt::DirectConnection);
+        updateTimer_.start();
+    } else {
+        updateTimer_.stop();
+        disconnect(window_, Q_NULLPTR, this, Q_NULLPTR);
+    }
+
+    Q_EMIT activeChanged(active_);
+}
+
+void FrameMetrics::resetPeriod()
+{
+    frameTimes_.reset();
+    periodFrames_.store(0);
+    syncNsecs_.store(0);
+    renderNsecs_.store(0);
+    swapNsecs_.store(0);
+    lastDamageAcknowledgements_ = compositor_->damageAcknowledgements();
+    lastRebinds_ = textureUpdates();
+    lastDamageFlushes_ = WindowPixmap::acknowledgementFlushes();
+    lastXEvents_ = compositor_->xEvents();
+    period_.start();
+}
+
+void FrameMetrics::update()
+{
+    auto elapsed = period_.nsecsElapsed();
+    auto frames = periodFrames_.load();
+    auto perFrame = [frames](qreal value) { return frames ? value / frames : 0; };
+
+    fps_ = elapsed ? frames * 1e9 / elapsed : 0;
+    frameTime50_ = frameTimes_.percentile(50);
+    frameTime90_ = frameTimes_.percentile(90);
+    frameTime99_ = frameTimes_.percentile(99);
+    syncTime_ = perFrame(syncNsecs_.load() / 1e6);
+    renderTime_ = perFrame(renderNsecs_.load() / 1e6);
+    swapTime_ = perFrame(swapNsecs_.load() / 1e6);
+    damagedWindowsPerFrame_ = perFrame(compositor_->damageAcknowledgements() - lastDamageAcknowledgements_);
+    rebindsPerFrame_ = perFrame(textureUpdates() - lastRebinds_);
+    damageFlushesPerFrame_ = perFrame(WindowPixmap::acknowledgementFlushes() - lastDamageFlushes_);
+    xEventsPerSecond_ = elapsed ? (compositor_->xEvents() - lastXEvents_) * 1e9 / elapsed : 0;
+    thumbnailCacheKiB_ = WindowThumbnailItem::totalCacheBytes() / 1024.0;
+
+    resetPeriod();
+    Q_EMIT updated();
+}
+
+void FrameMetrics::beforeSynchronizing()
+{
+    frameTimer_.start();
+}
+
+void FrameMetrics::afterSynchronizing()
+{
+    syncDone_ = frameTimer_.nsecsElapsed();
+}
+
+void FrameMetrics::afterRendering()
+{
+    renderDone_ = frameTimer_.nsecsElapsed();
+}
+
+void FrameMetrics::frameSwapped()
+{
+    if (!frameTimer_.isValid()) {
+        return;
+    }
+
+    auto total = frameTimer_.nsecsElapsed();
+    frameTimes_.record(total);
+    syncNsecs_.fetchAndAddRelaxed(syncDone_);
+    renderNsecs_.fetchAndAddRelaxed(renderDone_ - syncDone_);
+    swapNsecs_.fetchAndAddRelaxed(total - renderDone_);
+    periodFrames_.fetchAndAddRelaxed(1);
+    frameTimer_.invalidate();
+}
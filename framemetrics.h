@@ -0,0 +1,158 @@
+#pragma once
+
+#include <QAtomicInteger>
+#include <QElapsedTimer>
+#include <QObject>
+#include <QTimer>
+
+#include "latencyhistogram.h"
+
+class QQuickWindow;
+class Compositor;
+
+// Frame timing of a compositor window, summarized every UpdateInterval for the HUD.
+// Sync/render/swap are measured on the render thread from beforeSynchronizing to
+// afterSynchronizing, afterSynchronizing to afterRendering and afterRendering to
+// frameSwapped. Nothing is measured or updated while inactive.
+class FrameMetrics : public QObject
+{
+    Q_OBJECT
+
+    Q_PROPERTY(bool active READ isActive WRITE setActive NOTIFY activeChanged)
+    Q_PROPERTY(qreal fps READ fps NOTIFY updated)
+    Q_PROPERTY(qreal frameTime50 READ frameTime50 NOTIFY updated)
+    Q_PROPERTY(qreal frameTime90 READ frameTime90 NOTIFY updated)
+    Q_PROPERTY(qreal frameTime99 READ frameTime99 NOTIFY updated)
+    Q_PROPERTY(qreal syncTime READ syncTime NOTIFY updated)
+    Q_PROPERTY(qreal renderTime READ renderTime NOTIFY updated)
+    Q_PROPERTY(qreal swapTime READ swapTime NOTIFY updated)
+    Q_PROPERTY(qreal damagedWindowsPerFrame READ damagedWindowsPerFrame NOTIFY updated)
+    Q_PROPERTY(qreal rebindsPerFrame READ rebindsPerFrame NOTIFY updated)
+    Q_PROPERTY(qreal damageFlushesPerFrame READ damageFlushesPerFrame NOTIFY updated)
+    Q_PROPERTY(qreal xEventsPerSecond READ xEventsPerSecond NOTIFY updated)
+    Q_PROPERTY(qreal thumbnailCacheKiB READ thumbnailCacheKiB NOTIFY updated)
+public:
+    FrameMetrics(Compositor *, QQuickWindow *, QObject *parent = Q_NULLPTR);
+    ~FrameMetrics() Q_DECL_OVERRIDE;
+
+    bool isActive() const
+    {
+        return active_;
+    }
+    void setActive(bool);
+
+    // Values below are for the last UpdateInterval; times are in milliseconds
+    qreal fps() const
+    {
+        return fps_;
+    }
+
+    qreal frameTime50() const
+    {
+        return frameTime50_;
+    }
+
+    qreal frameTime90() const
+    {
+        return frameTime90_;
+    }
+
+    qreal frameTime99() const
+    {
+        return frameTime99_;
+    }
+
+    // Average per frame
+    qreal syncTime() const
+    {
+        return syncTime_;
+    }
+
+    qreal renderTime() const
+    {
+        return renderTime_;
+    }
+
+    qreal swapTime() const
+    {
+        return swapTime_;
+    }
+
+    qreal damagedWindowsPerFrame() const
+    {
+        return damagedWindowsPerFrame_;
+    }
+
+    qreal rebindsPerFrame() const
+    {
+        return rebindsPerFrame_;
+    }
+
+    // Socket writes for damage acknowledgements; at most one per frame and connection
+    qreal damageFlushesPerFrame() const
+    {
+        return damageFlushesPerFrame_;
+    }
+
+    qreal xEventsPerSecond() const
+    {
+        return xEventsPerSecond_;
+    }
+
+    // Texture memory of all WindowThumbnail items, at the end of the period
+    qreal thumbnailCacheKiB() const
+    {
+        return thumbnailCacheKiB_;
+    }
+
+    static const int UpdateInterval = 500;
+
+Q_SIGNALS:
+    void activeChanged(bool active);
+    void updated();
+
+private Q_SLOTS:
+    void update();
+    void beforeSynchronizing();
+    void afterSynchronizing();
+    void afterRendering();
+    void frameSwapped();
+
+private:
+    void resetPeriod();
+
+    Compositor *compositor_;
+    QQuickWindow *window_;
+    bool active_;
+    QTimer updateTimer_;
+    QElapsedTimer period_;
+
+    // Render thread only
+    QElapsedTimer frameTimer_;
+    qint64 syncDone_;
+    qint64 renderDone_;
+
+    LatencyHistogram frameTimes_;
+    QAtomicInteger<qint64> periodFrames_;
+    QAtomicInteger<qint64> syncNsecs_;
+    QAtomicInteger<qint64> renderNsecs_;
+    QAtomicInteger<qint64> swapNsecs_;
+
+    quint64 lastDamageAcknowledgements_;
+    qint64 lastRebinds_;
+    quint64 lastDamageFlushes_;
+    quint64 lastXEvents_;
+
+    qreal fps_;
+    qreal frameTime50_;
+    qreal frameTime90_;
+    qreal frameTime99_;
+    qreal syncTime_;
+    qreal renderTime_;
+    qreal swapTime_;
+    qreal damagedWindowsPerFrame_;
+    qreal rebindsPerFrame_;
+    qreal damageFlushesPerFrame_;
+    qreal xEventsPerSecond_;
+    qreal thumbnailCacheKiB_;
+};
@@ -0,0 +1,222 @@
+#include "framescheduler.h"
+
+#include <QDebug>
+#include <QHash>
+#include <QQuickItem>
+#include <QQuickWindow>
+#include <QScreen>
+#include <QX11Info>
+
+#include <GL/glx.h>
+
+#ifndef GLX_LATE_SWAPS_TEAR_EXT
+#define GLX_LATE_SWAPS_TEAR_EXT 0x20F3
+#endif
+
+typedef void (*SwapIntervalEXT)(Display *, GLXDrawable, int);
+
+// Slack between latching damage and the start of rendering, for event handling and sync
+static const qint64 LatchMargin = 2000000;
+
+// Wakeups remembered for wakeupsPerSecond()
+static const int MaxRecentWakeups = 1024;
+
+static QHash<QQuickWindow *, FrameScheduler *> schedulers;
+
+FrameScheduler::FrameScheduler(QQuickWindow *window, QObject *parent)
+    : QObject(parent),
+      window_(window),
+      swapInterval_(1),
+      adaptiveSwapApplied_(false),
+      adaptiveSwapActive_(0),
+      firstDamage_(-1),
+      wakeups_(0),
+      latchedDamage_(-1),
+      frameDamage_(-1),
+      syncStart_(-1),
+      renderTime_(0),
+      lastSwap_(-1),
+      frames_(0)
+{
+    clock_.start();
+    schedulers.insert(window_, this);
+
+    latchTimer_.setSingleShot(true);
+    latchTimer_.setTimerType(Qt::PreciseTimer);
+    connect(&latchTimer_, SIGNAL(timeout()), SLOT(latch()));
+
+    connect(window_, SIGNAL(beforeSynchronizing()), SLOT(beforeSynchronizing()), Qt::DirectConnection);
+    connect(window_, SIGNAL(afterRendering()), SLOT(afterRendering()), Qt::DirectConnection);
+    connect(window_, SIGNAL(frameSwapped()), SLOT(frameSwapped()), Qt::DirectConnection);
+}
+
+FrameScheduler::~FrameScheduler()
+{
+    schedulers.remove(window_);
+}
+
+FrameScheduler *FrameScheduler::forWindow(QQuickWindow *window)
+{
+    return schedulers.value(window, Q_NULLPTR);
+}
+
+bool FrameScheduler::isAdaptiveSwapSupported()
+{
+    auto extensions = QByteArray(glXQueryExtensionsString(QX11Info::display(), QX11Info::appScreen()));
+    return extensions.split(' ').contains(QByteArrayLiteral("GLX_EXT_swap_control_tear"));
+}
+
+void FrameScheduler::setSwapInterval(int interval)
+{
+    if (interval < 0 && !isAdaptiveSwapSupported()) {
+        qWarning() << "GLX_EXT_swap_control_tear is not supported, using regular vsync";
+        interval = 1;
+    }
+    if (interval == swapInterval_) {
+        return;
+    }
+    swapInterval_ = interval;
+
+    // Qt applies the swap interval of the format when it creates the GL context, but ignores
+    // negative ones: those start with vsync and are changed on the first frame
+    auto format = window_->requestedFormat();
+    format.setSwapInterval(interval < 0 ? 1 : interval);
+    window_->setFormat(format);
+
+    Q_EMIT swapIntervalChanged(interval);
+}
+
+int FrameScheduler::wakeupsPerSecond() const
+{
+    auto since = clock_.nsecsElapsed() - 1000000000;
+    int result = 0;
+    for (auto wakeup : recentWakeups_) {
+        result += (wakeup > since);
+    }
+    return result;
+}
+
+void FrameScheduler::scheduleUpdate(QQuickItem *item)
+{
+    if (firstDamage_ < 0) {
+        firstDamage_ = clock_.nsecsElapsed();
+    }
+
+    QPointer<QQuickItem> pointer(item);
+    if (!pending_.contains(pointer)) {
+        pending_.append(pointer);
+    }
+
+    if (!latchTimer_.isActive()) {
+        latchTimer_.start(latchDelay());
+    }
+}
+
+qint64 FrameScheduler::frameInterval() const
+{
+    auto screen = window_->screen();
+    auto refreshRate = screen ? screen->refreshRate() : 60.0;
+    if (refreshRate <= 0) {
+        refreshRate = 60.0;
+    }
+    return static_cast<qint64>(1e9 / refreshRate);
+}
+
+int FrameScheduler::latchDelay() const
+{
+    // Without vsync there is nothing to wait for
+    auto lastSwap = lastSwap_.load();
+    if (swapInterval_ == 0 || lastSwap < 0) {
+        return 0;
+    }
+
+    // Vblanks are assumed to continue in phase with the last swap
+    auto now = clock_.nsecsElapsed();
+    auto interval = frameInterval();
+    auto vsync = lastSwap + ((now - lastSwap) / interval + 1) * interval;
+    auto latchAt = vsync - renderTime_.load() - LatchMargin;
+    if (latchAt <= now) {
+        return 0;
+    }
+    return static_cast<int>((latchAt - now) / 1000000);
+}
+
+void FrameScheduler::latch()
+{
+    auto now = clock_.nsecsElapsed();
+    wakeups_++;
+    if (recentWakeups_.size() >= MaxRecentWakeups) {
+        recentWakeups_.remove(0, recentWakeups_.size() / 2);
+    }
+    recentWakeups_.append(now);
+
+    for (const auto &item : pending_) {
+        if (item) {
+            item->update();
+        }
+    }
+    pending_.clear();
+
+    // If the previous latch hasn't been synced yet, its damage is older
+    latchedDamage_.testAndSetRelaxed(-1, firstDamage_);
+    firstDamage_ = -1;
+
+    Q_EMIT statisticsChanged();
+}
+
+void FrameScheduler::beforeSynchronizing()
+{
+    // Render thread, GUI thread is blocked
+    syncStart_.store(clock_.nsecsElapsed());
+    if (swapInterval_ < 0 && !adaptiveSwapApplied_) {
+        applyAdaptiveSwap();
+    }
+    auto latched = latchedDamage_.fetchAndStoreRelaxed(-1);
+    if (latched >= 0 && (frameDamage_ < 0 || latched < frameDamage_)) {
+        frameDamage_ = latched;
+    }
+}
+
+void FrameScheduler::applyAdaptiveSwap()
+{
+    // Render thread, with the window's context and drawable current
+    adaptiveSwapApplied_ = true;
+    auto display = QX11Info::display();
+    auto drawable = glXGetCurrentDrawable();
+    auto swapInterval = reinterpret_cast<SwapIntervalEXT>(
+            glXGetProcAddress(reinterpret_cast<const GLubyte *>("glXSwapIntervalEXT")));
+    if (!drawable || !swapInterval) {
+        qWarning() << "glXSwapIntervalEXT is not available, using regular vsync";
+        return;
+    }
+    swapInterval(display, drawable, -1);
+
+    unsigned int tear = 0;
+    glXQueryDrawable(display, drawable, GLX_LATE_SWAPS_TEAR_EXT, &tear);
+    adaptiveSwapActive_.store(tear ? 1 : 0);
+    if (!tear) {
+        qWarning() << "Adaptive vsync was requested, but the driver didn't enable it";
+    }
+}
+
+void FrameScheduler::afterRendering()
+{
+    // Render thread. The swap that follows may block until vblank, so it isn't counted.
+    auto syncStart = syncStart_.load();
+    if (syncStart >= 0) {
+        renderTime_.store(clock_.nsecsElapsed() - syncStart);
+    }
+}
+
+void FrameScheduler::frameSwapped()
+{
+    // Render thread
+    auto now = clock_.nsecsElapsed();
+    lastSwap_.store(now);
+    frames_.fetchAndAddRelaxed(1);
+
+    if (frameDamage_ >= 0) {
+        damageToPresent_.record(now - frameDamage_);
+        frameDamage_ = -1;
+    }
+}
@@ -0,0 +1,114 @@
+#pragma once
+
+#include <QAtomicInt>
+#include <QAtomicInteger>
+#include <QElapsedTimer>
+#include <QObject>
+#include <QPointer>
+#include <QTimer>
+#include <QVector>
+
+#include "latencyhistogram.h"
+
+class QQuickItem;
+class QQuickWindow;
+
+// Decides when window damage is turned into a frame. Damage doesn't update items right
+// away; it is collected until shortly before the next vsync (minus the time the last
+// frame took to render) and then latched all at once. Nothing runs while nothing is
+// damaged: no timers, no frames. QML animations are driven by Qt's render loop as usual.
+class FrameScheduler : public QObject
+{
+    Q_OBJECT
+
+    Q_PROPERTY(int swapInterval READ swapInterval WRITE setSwapInterval NOTIFY swapIntervalChanged)
+    Q_PROPERTY(qint64 wakeups READ wakeups NOTIFY statisticsChanged)
+    Q_PROPERTY(int wakeupsPerSecond READ wakeupsPerSecond NOTIFY statisticsChanged)
+    Q_PROPERTY(qint64 frames READ frames NOTIFY statisticsChanged)
+public:
+    explicit FrameScheduler(QQuickWindow *, QObject *parent = Q_NULLPTR);
+    ~FrameScheduler() Q_DECL_OVERRIDE;
+
+    // Scheduler of the given window, if it has one
+    static FrameScheduler *forWindow(QQuickWindow *);
+
+    // Requests a frame showing new contents of the item
+    void scheduleUpdate(QQuickItem *);
+
+    // 1 syncs to vblank, 0 doesn't, -1 is adaptive (tears only when a frame is late) where
+    // GLX_EXT_swap_control_tear is available, 1 otherwise. Must be set before the window is shown.
+    int swapInterval() const
+    {
+        return swapInterval_;
+    }
+    void setSwapInterval(int);
+
+    static bool isAdaptiveSwapSupported();
+
+    // Whether the driver reports adaptive vsync on the window's drawable. Set on the first
+    // frame; Qt only applies intervals >= 0, so -1 is applied by the scheduler itself.
+    bool isAdaptiveSwapActive() const
+    {
+        return adaptiveSwapActive_.load();
+    }
+
+    // Times the scheduler woke up to latch damage
+    qint64 wakeups() const
+    {
+        return wakeups_;
+    }
+
+    int wakeupsPerSecond() const;
+
+    // Frames presented by the window, for any reason
+    qint64 frames() const
+    {
+        return frames_.load();
+    }
+
+    // From the first damage event included in a frame to the end of its buffer swap
+    const LatencyHistogram &damageToPresent() const
+    {
+        return damageToPresent_;
+    }
+
+Q_SIGNALS:
+    void swapIntervalChanged(int swapInterval);
+    void statisticsChanged();
+
+private Q_SLOTS:
+    void latch();
+    void beforeSynchronizing();
+    void afterRendering();
+    void frameSwapped();
+
+private:
+    qint64 frameInterval() const;
+    int latchDelay() const;
+    void applyAdaptiveSwap();
+
+    QQuickWindow *window_;
+    int swapInterval_;
+    QElapsedTimer clock_;
+
+    // Render thread
+    bool adaptiveSwapApplied_;
+    QAtomicInt adaptiveSwapActive_;
+
+    QTimer latchTimer_;
+    QVector<QPointer<QQuickItem> > pending_;
+    qint64 firstDamage_;
+    qint64 wakeups_;
+    QVector<qint64> recentWakeups_;
+
+    // Damage time handed from latch() to the render thread, and the one of the frame being drawn.
+    // Times are nanoseconds of clock_.
+    QAtomicInteger<qint64> latchedDamage_;
+    qint64 frameDamage_;
+
+    QAtomicInteger<qint64> syncStart_;
+    QAtomicInteger<qint64> renderTime_;
+    QAtomicInteger<qint64> lastSwap_;
+    QAtomicInteger<qint64> frames_;
+    LatencyHistogram damageToPresent_;
+};
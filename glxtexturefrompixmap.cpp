@@ -1,13 +1,21 @@
 #include "glxtexturefrompixmap.h"
 
+#include <QHash>
 #include <QMap>
 #include <QMetaType>
 #include <QDataStream>
 #include <QTextStream>
 
 #include <QDebug>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
 #include <QOpenGLContext>
+#include <QOpenGLFunctions>
 #include <QLoggingCategory>
+#include <QSaveFile>
+#include <QStandardPaths>
 #include <QX11Info>
 
 #include <xcb/xcb_renderutil.h>
@@ -42,17 +50,26 @@ public:
     };
     const VisualInfo &configFor(xcb_visualid_t);
 
+    // Fills the table for every visual of the server, from the cache file if it matches
+    // the current driver. Needs a current GL context.
+    void prepareAllVisuals();
+
 private:
     Q_DISABLE_COPY(GLXInfo)
 
     static const QLoggingCategory &log();
     VisualInfo createVisualInfo(xcb_visualid_t) const;
 
+    QByteArray cacheKey() const;
+    static QString cacheFileName();
+    bool loadCache(const QByteArray &key, qint64 *computeTime);
+    void saveCache(const QByteArray &key, qint64 computeTime) const;
+
     xcb_connection_t *connection;
     int screen;
     xcb_render_query_pict_formats_reply_t *pictFormats;
     QMap<xcb_visualid_t, int> visualDepth;
-    QMap<xcb_visualid_t, VisualInfo> visualInfos;
+    QHash<xcb_visualid_t, VisualInfo> visualInfos;
 
     GLXInfo();
     ~GLXInfo();
@@ -116,7 +133,7 @@ GLXInfo &GLXInfo::instance()
 
 const QLoggingCategory &GLXInfo::log()
 {
-    static const QLoggingCategory log_("GLXInfo");
+    static const QLoggingCategory log_("GLXInfo", QtWarningMsg);
     return log_;
 }
 
@@ -241,11 +258,160 @@ const GLXInfo::VisualInfo &GLXInfo::configFor(xcb_visualid_t visual)
     return visualInfos.insert(visual, createVisualInfo(visual)).value();
 }
 
+static const quint32 CacheMagic = 0x47465843; // "CXFG"
+static const quint32 CacheVersion = 1;
+
+QByteArray GLXInfo::cacheKey() const
+{
+    auto gl = QOpenGLContext::currentContext()->functions();
+    auto setup = xcb_get_setup(connection);
+
+    QByteArray key;
+    QDataStream stream(&key, QIODevice::WriteOnly);
+    stream << QByteArray(reinterpret_cast<const char *>(gl->glGetString(GL_VENDOR)))
+           << QByteArray(reinterpret_cast<const char *>(gl->glGetString(GL_RENDERER)))
+           << QByteArray(reinterpret_cast<const char *>(gl->glGetString(GL_VERSION)))
+           << QByteArray(xcb_setup_vendor(setup), xcb_setup_vendor_length(setup))
+           << setup->release_number
+           << screen;
+    return key;
+}
+
+QString GLXInfo::cacheFileName()
+{
+    return QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + QStringLiteral("/glxfbconfigs");
+}
+
+bool GLXInfo::loadCache(const QByteArray &key, qint64 *computeTime)
+{
+    QFile file(cacheFileName());
+    if (!file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+
+    QDataStream stream(&file);
+    quint32 magic = 0, version = 0;
+    QByteArray fileKey;
+    quint32 count = 0;
+    stream >> magic >> version >> fileKey >> *computeTime >> count;
+    if (stream.status() != QDataStream::Ok || magic != CacheMagic || version != CacheVersion) {
+        return false;
+    }
+    if (fileKey != key) {
+        qDebug(log) << "Driver or X server changed, FBConfig cache is stale";
+        return false;
+    }
+
+    // FBConfig IDs are stable for a given driver and server; handles are looked up once
+    int nConfigs = 0;
+    GLXFBConfig *configs = glXGetFBConfigs(display, screen, &nConfigs);
+    QHash<int, GLXFBConfig> configById;
+    for (int i = 0; i < nConfigs; i++) {
+        int id = 0;
+        if (glXGetFBConfigAttrib(display, configs[i], GLX_FBCONFIG_ID, &id) == Success) {
+            configById.insert(id, configs[i]);
+        }
+    }
+    if (configs) {
+        XFree(configs);
+    }
+
+    QVector<QPair<xcb_visualid_t, VisualInfo> > loaded;
+    for (quint32 i = 0; i < count; i++) {
+        quint32 visual = 0;
+        qint32 configId = 0;
+        VisualInfo info;
+        stream >> visual >> configId >> info.textureFormat >> info.yInverted
+               >> info.depth >> info.stencil >> info.alphaMatches;
+        if (stream.status() != QDataStream::Ok) {
+            return false;
+        }
+        if (configId) {
+            info.config = configById.value(configId, Q_NULLPTR);
+            if (!info.config) {
+                return false;
+            }
+        }
+        loaded.append(qMakePair(xcb_visualid_t(visual), info));
+    }
+
+    for (const auto &entry : loaded) {
+        visualInfos.insert(entry.first, entry.second);
+    }
+    return true;
+}
+
+void GLXInfo::saveCache(const QByteArray &key, qint64 computeTime) const
+{
+    QDir().mkpath(QFileInfo(cacheFileName()).absolutePath());
+    QSaveFile file(cacheFileName());
+    if (!file.open(QIODevice::WriteOnly)) {
+        qWarning(log) << "Can't write FBConfig cache" << file.fileName() << file.errorString();
+        return;
+    }
+
+    QDataStream stream(&file);
+    stream << CacheMagic << CacheVersion << key << computeTime << quint32(visualInfos.size());
+    for (auto i = visualInfos.constBegin(); i != visualInfos.constEnd(); ++i) {
+        int configId = 0;
+        if (i->config) {
+            glXGetFBConfigAttrib(display, i->config, GLX_FBCONFIG_ID, &configId);
+        }
+        stream << quint32(i.key()) << qint32(configId) << i->textureFormat << i->yInverted
+               << i->depth << i->stencil << i->alphaMatches;
+    }
+
+    if (!file.commit()) {
+        qWarning(log) << "Can't write FBConfig cache" << file.fileName() << file.errorString();
+    }
+}
+
+void GLXInfo::prepareAllVisuals()
+{
+    if (!pictFormats) {
+        return;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+
+    auto key = cacheKey();
+    qint64 computeTime = 0;
+    if (loadCache(key, &computeTime)) {
+        auto loadTime = timer.nsecsElapsed();
+        qDebug(log) << "Loaded" << visualInfos.size() << "FBConfigs from cache in" << loadTime / 1000 << "us,"
+                    << "saved" << (computeTime - loadTime) / 1000 << "us";
+        return;
+    }
+
+    for (auto i = visualDepth.constBegin(); i != visualDepth.constEnd(); ++i) {
+        configFor(i.key());
+    }
+    computeTime = timer.nsecsElapsed();
+    qDebug(log) << "Chose FBConfigs for" << visualInfos.size() << "visuals in" << computeTime / 1000 << "us";
+
+    saveCache(key, computeTime);
+}
+
+QAtomicInt GLXTextureFromPixmap::rebinds_;
+
+void GLXTextureFromPixmap::prepareVisuals()
+{
+    GLXInfo::instance().prepareAllVisuals();
+}
+
+bool GLXTextureFromPixmap::isSupported(xcb_visualid_t visual)
+{
+    auto &glx = GLXInfo::instance();
+    return glx.tfpBind && glx.tfpRelease && glx.configFor(visual).config;
+}
+
 GLXTextureFromPixmap::GLXTextureFromPixmap(xcb_pixmap_t pixmap, xcb_visualid_t visual, const QSize &size)
     : QOpenGLFunctions(QOpenGLContext::currentContext()),
       texture_(0),
       glxPixmap_(XCB_NONE),
       pixmap_(pixmap),
+      visual_(visual),
       hasAlpha_(false),
       isYInverted_(false),
       size_(size),
@@ -277,18 +443,17 @@ GLXTextureFromPixmap::GLXTextureFromPixmap(xcb_pixmap_t pixmap, xcb_visualid_t v
 
 GLXTextureFromPixmap::~GLXTextureFromPixmap()
 {
-    if (texture_) {
-        glDeleteTextures(1, &texture_);
+    if (glxPixmap_) {
+        // The image is released before the pixmap it's bound to goes away
+        auto &glx = GLXInfo::instance();
+        glx.tfpRelease(glx.display, glxPixmap_, GLX_FRONT_LEFT_EXT);
+        glXDestroyPixmap(glx.display, glxPixmap_);
+        glxPixmap_ = 0;
     }
 
-    if (!glxPixmap_) {
-        return;
+    if (texture_ && QOpenGLContext::currentContext()) {
+        glDeleteTextures(1, &texture_);
     }
-
-    auto &glx = GLXInfo::instance();
-    glx.tfpRelease(glx.display, glxPixmap_, GLX_FRONT_LEFT_EXT);
-    glXDestroyPixmap(glx.display, glxPixmap_);
-    glxPixmap_ = 0;
 }
 
 int GLXTextureFromPixmap::textureId() const
@@ -318,6 +483,11 @@ void GLXTextureFromPixmap::rebind()
     }
 }
 
+void GLXTextureFromPixmap::update(const QRegion &)
+{
+    rebind();
+}
+
 void GLXTextureFromPixmap::bind()
 {
     glBindTexture(GL_TEXTURE_2D, texture_);
@@ -328,5 +498,6 @@ void GLXTextureFromPixmap::bind()
 
         auto &glx = GLXInfo::instance();
         glx.tfpBind(glx.display, glxPixmap_, GLX_FRONT_LEFT_EXT, Q_NULLPTR);
+        rebinds_.fetchAndAddRelaxed(1);
     }
 }
@@ -1,12 +1,14 @@
 #pragma once
 
-#include <QSGTexture>
+#include <QAtomicInt>
 #include <QOpenGLFunctions>
 
 #include <xcb/xcb.h>
 #include <xcb/glx.h>
 
-class GLXTextureFromPixmap : public QSGTexture,
+#include "windowtexture.h"
+
+class GLXTextureFromPixmap : public WindowTexture,
                              protected QOpenGLFunctions
 {
     Q_OBJECT
@@ -14,6 +16,13 @@ public:
     explicit GLXTextureFromPixmap(xcb_pixmap_t pixmap, xcb_visualid_t visual, const QSize &size);
     ~GLXTextureFromPixmap() Q_DECL_OVERRIDE;
 
+    // Chooses FBConfigs for all visuals up front, so the first window of a visual doesn't
+    // wait for it. Results are cached on disk per driver. Call with a current GL context.
+    static void prepareVisuals();
+
+    // Whether pixmaps of the visual can be bound. Call with a current GL context.
+    static bool isSupported(xcb_visualid_t);
+
     int textureId() const Q_DECL_OVERRIDE;
     QSize textureSize() const Q_DECL_OVERRIDE;
     bool hasAlphaChannel() const Q_DECL_OVERRIDE;
@@ -21,16 +30,25 @@ public:
 
     void bind() Q_DECL_OVERRIDE;
 
+    // The whole pixmap is rebound, whatever the damage
+    void update(const QRegion &) Q_DECL_OVERRIDE;
+
     xcb_pixmap_t pixmap() const
     {
         return pixmap_;
     }
 
-    bool isYInverted() const
+    bool isYInverted() const Q_DECL_OVERRIDE
     {
         return isYInverted_;
     }
 
+    // glXBindTexImageEXT calls made by all textures
+    static int rebinds()
+    {
+        return rebinds_.load();
+    }
+
 public Q_SLOTS:
     void rebind();
 
@@ -38,7 +56,10 @@ private:
     uint texture_;
     xcb_glx_pixmap_t glxPixmap_;
     xcb_pixmap_t pixmap_;
+    xcb_visualid_t visual_;
     bool hasAlpha_, isYInverted_;
     QSize size_;
     bool rebindTFP_;
+
+    static QAtomicInt rebinds_;
 };
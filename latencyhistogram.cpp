@@ -0,0 +1,47 @@
+#include "latencyhistogram.h"
+
+#include <cmath>
+
+LatencyHistogram::LatencyHistogram()
+{
+}
+
+void LatencyHistogram::record(qint64 nsecs)
+{
+    auto bucket = qBound<qint64>(0, nsecs / BucketSize, BucketCount - 1);
+    buckets_[bucket].fetchAndAddRelaxed(1);
+}
+
+void LatencyHistogram::reset()
+{
+    for (auto &bucket : buckets_) {
+        bucket.store(0);
+    }
+}
+
+int LatencyHistogram::count() const
+{
+    int result = 0;
+    for (const auto &bucket : buckets_) {
+        result += bucket.load();
+    }
+    return result;
+}
+
+qreal LatencyHistogram::percentile(qreal p) const
+{
+    auto total = count();
+    if (!total) {
+        return 0;
+    }
+
+    auto target = qMax(1, static_cast<int>(std::ceil(total * p / 100)));
+    int seen = 0;
+    for (int i = 0; i < BucketCount; i++) {
+        seen += buckets_[i].load();
+        if (seen >= target) {
+            return (i + 1) * BucketSize / 1e6;
+        }
+    }
+    return BucketCount * BucketSize / 1e6;
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <QAtomicInt>
+#include <QtGlobal>
+
+// Distribution of durations in 100 us buckets up to 100 ms, with one overflow bucket.
+// Recording is lock-free, so it can be done from the render thread.
+class LatencyHistogram
+{
+public:
+    LatencyHistogram();
+
+    void record(qint64 nsecs);
+    void reset();
+
+    int count() const;
+
+    // Upper bound of the bucket containing the given percentile, in milliseconds.
+    // 0 if nothing was recorded.
+    qreal percentile(qreal p) const;
+
+private:
+    Q_DISABLE_COPY(LatencyHistogram)
+
+    static const int BucketCount = 1001;
+    static const qint64 BucketSize = 100000;
+
+    QAtomicInt buckets_[BucketCount];
+};
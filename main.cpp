@@ -1,5 +1,6 @@
 #include "compositor.h"
 
+#include <QCommandLineParser>
 #include <QGuiApplication>
 #include <QOpenGLContext>
 #include <QOpenGLDebugMessage>
@@ -15,6 +16,11 @@
 #include <xcb/composite.h>
 
 #include "windowpixmapitem.h"
+#include "windowtexture.h"
+#include "framescheduler.h"
+#include "framemetrics.h"
+#include "eventrecording.h"
+#include "xrendercompositor.h"
 
 class DebugLog : public QObject
 {
@@ -60,13 +66,51 @@ int main(int argc, char *argv[])
 {
     QGuiApplication app(argc, argv);
 
+    QCommandLineParser parser;
+    parser.addHelpOption();
+    QCommandLineOption hudOption(QStringLiteral("hud"), QStringLiteral("Show frame timing overlay"));
+    parser.addOption(hudOption);
+    parser.process(app);
+
     auto connection = QX11Info::connection();
     qDebug() << "Damage major_opcode:" << xcb_get_extension_data(connection, &xcb_damage_id)->major_opcode;
     qDebug() << "Composite major_opcode:" << xcb_get_extension_data(connection, &xcb_composite_id)->major_opcode;
 
     WindowPixmapItem::registerQmlTypes();
 
+    auto textureBackend = qgetenv("QMLCOMPMGR_TEXTURE");
+    if (textureBackend == "tfp") {
+        WindowTexture::setBackend(WindowTexture::TextureFromPixmap);
+    } else if (textureBackend == "shm") {
+        WindowTexture::setBackend(WindowTexture::SharedMemory);
+    }
+
+    // Outlives the compositor, which records pixmap removals until it's destroyed
+    QScopedPointer<EventRecorder> recorder;
+    auto recordFile = qgetenv("QMLCOMPMGR_RECORD");
+    if (!recordFile.isEmpty()) {
+        recorder.reset(new EventRecorder(QString::fromLocal8Bit(recordFile)));
+    }
+
     Compositor compositor;
+    if (recorder && recorder->isOpen()) {
+        compositor.setEventRecorder(recorder.data());
+    }
+    compositor.setBypassEnabled(qgetenv("QMLCOMPMGR_BYPASS").toInt());
+    auto renderConnection = qgetenv("QMLCOMPMGR_RENDER_CONNECTION");
+    compositor.setSeparateRenderConnection(renderConnection.isEmpty() || renderConnection.toInt());
+
+    // Server-side compositing without GL and QML, for hosts where GL would be software-rendered
+    if (qgetenv("QMLCOMPMGR_BACKEND") == "xrender") {
+        if (!XRenderCompositor::isSupported(connection)) {
+            qFatal("XRender 0.10 is not available");
+        }
+        XRenderCompositor renderer(&compositor);
+        QWindow selectionOwner;
+        selectionOwner.create();
+        compositor.registerCompositor(&selectionOwner);
+        return app.exec();
+    }
 
     QQuickView view;
     compositor.registerCompositor(&view);
@@ -87,7 +131,16 @@ int main(int argc, char *argv[])
     QObject::connect(&view, SIGNAL(sceneGraphInitialized()),
                      &logger, SLOT(init()), Qt::DirectConnection);
 
+    FrameScheduler frameScheduler(&view);
+    auto swapInterval = qgetenv("QMLCOMPMGR_SWAP_INTERVAL");
+    frameScheduler.setSwapInterval(swapInterval.isEmpty() ? 1 : swapInterval.toInt());
+
+    FrameMetrics metrics(&compositor, &view);
+    metrics.setActive(parser.isSet(hudOption) || qgetenv("QMLCOMPMGR_HUD").toInt());
+
     view.rootContext()->setContextProperty(QStringLiteral("compositor"), &compositor);
+    view.rootContext()->setContextProperty(QStringLiteral("metrics"), &metrics);
+    view.rootContext()->setContextProperty(QStringLiteral("frameScheduler"), &frameScheduler);
     view.setParent(compositor.overlayWindow());
 
     view.setSource(QStringLiteral("qrc:/main.qml"));
@@ -1,6 +1,5 @@
 import QtQuick 2.4
 import QtQuick.Window 2.2
-import QtGraphicalEffects 1.0
 import Compositor 1.0
 
 Item {
@@ -43,22 +42,25 @@ Item {
                 ScaleAnimator { }
             }
 
-            RectangularGlow {
-                cached: true
+            WindowShadow {
                 color: "black"
                 opacity: 0.5
-                glowRadius: 10
+                radius: 10
                 anchors.fill: parent
-                anchors.leftMargin: -glowRadius / 4
-                anchors.topMargin: -glowRadius / 4
-                anchors.rightMargin: -glowRadius
-                anchors.bottomMargin: -glowRadius
+                anchors.leftMargin: -radius / 4
+                anchors.topMargin: -radius / 4
+                anchors.rightMargin: -radius
+                anchors.bottomMargin: -radius
             }
 
             WindowPixmap {
                 id: windowPixmap
                 clientWindow: windowRoot.clientWindow
-                visible: !dimEffect.visible
+                brightness: windowRoot.dim ? -0.5 : 0
+
+                Behavior on brightness {
+                    NumberAnimation { }
+                }
             }
 
             property bool normalWindow: clientWindow.wmType === ClientWindow.NONE ||
@@ -71,19 +73,6 @@ Item {
                                  !compositor.activeWindow
             property bool activeWindow: compositor.activeWindow === clientWindow
             property bool dim: !noDim && !activeWindow
-
-            BrightnessContrast {
-                id: dimEffect
-                brightness: dim ? -0.5 : 0
-                source: windowPixmap
-                anchors.fill: source
-                visible: brightness != 0
-                cached: true
-
-                Behavior on brightness {
-                    NumberAnimation { }
-                }
-            }
         }
     }
 
@@ -108,4 +97,39 @@ Item {
             }
         }
     }
+
+    Loader {
+        active: metrics.active
+        anchors.top: parent.top
+        anchors.right: parent.right
+        anchors.margins: 8
+        z: 1000000
+
+        sourceComponent: Rectangle {
+            color: "#a0000000"
+            radius: 4
+            width: hudText.implicitWidth + 16
+            height: hudText.implicitHeight + 16
+
+            Text {
+                id: hudText
+                x: 8
+                y: 8
+                color: "white"
+                font.family: "monospace"
+                text: "fps         " + metrics.fps.toFixed(1) + "\n" +
+                      "frame p50   " + metrics.frameTime50.toFixed(1) + " ms\n" +
+                      "frame p90   " + metrics.frameTime90.toFixed(1) + " ms\n" +
+                      "frame p99   " + metrics.frameTime99.toFixed(1) + " ms\n" +
+                      "sync        " + metrics.syncTime.toFixed(2) + " ms\n" +
+                      "render      " + metrics.renderTime.toFixed(2) + " ms\n" +
+                      "swap        " + metrics.swapTime.toFixed(2) + " ms\n" +
+                      "damaged/fr  " + metrics.damagedWindowsPerFrame.toFixed(1) + "\n" +
+                      "rebinds/fr  " + metrics.rebindsPerFrame.toFixed(1) + "\n" +
+                      "flushes/fr  " + metrics.damageFlushesPerFrame.toFixed(2) + "\n" +
+                      "X events/s  " + metrics.xEventsPerSecond.toFixed(0) + "\n" +
+                      "thumbs KiB  " + metrics.thumbnailCacheKiB.toFixed(0)
+            }
+        }
+    }
 }
@@ -0,0 +1,90 @@
+#include "occlusiontable.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+static const int Lanes = 4;
+
+OcclusionTable::OcclusionTable()
+    : size_(0)
+{
+}
+
+void OcclusionTable::clear()
+{
+    // Storage is kept for the next frame; stale entries must not cover anything
+    size_ = 0;
+    opaque_.fill(0);
+}
+
+void OcclusionTable::append(const QRect &rect, bool opaque)
+{
+    // A group of four starting at the last entry has to stay in bounds
+    if (size_ + Lanes > x1_.size()) {
+        auto padded = qMax(2 * x1_.size(), size_ + Lanes);
+        x1_.resize(padded);
+        y1_.resize(padded);
+        x2_.resize(padded);
+        y2_.resize(padded);
+        opaque_.resize(padded);
+    }
+
+    // Right and bottom edges are exclusive
+    x1_[size_] = rect.x();
+    y1_[size_] = rect.y();
+    x2_[size_] = rect.x() + rect.width();
+    y2_[size_] = rect.y() + rect.height();
+    opaque_[size_] = opaque ? -1 : 0;
+    size_++;
+}
+
+bool OcclusionTable::coveredAbove(int i) const
+{
+    auto x1 = x1_.constData();
+    auto y1 = y1_.constData();
+    auto x2 = x2_.constData();
+    auto y2 = y2_.constData();
+    auto opaque = opaque_.constData();
+
+    // Entries past size_ are transparent, so whole groups of four can be read
+    int j = i + 1;
+#ifdef __SSE2__
+    auto ix1 = _mm_set1_epi32(x1[i]);
+    auto iy1 = _mm_set1_epi32(y1[i]);
+    auto ix2 = _mm_set1_epi32(x2[i]);
+    auto iy2 = _mm_set1_epi32(y2[i]);
+    auto zero = _mm_setzero_si128();
+    for (; j < size_; j += Lanes) {
+        auto load = [j](const qint32 *a) {
+            return _mm_loadu_si128(reinterpret_cast<const __m128i *>(a + j));
+        };
+        // A lane fails if any edge of window j lies inside window i, or j isn't opaque
+        auto fails = _mm_or_si128(_mm_cmpgt_epi32(load(x1), ix1), _mm_cmpgt_epi32(load(y1), iy1));
+        fails = _mm_or_si128(fails, _mm_cmpgt_epi32(ix2, load(x2)));
+        fails = _mm_or_si128(fails, _mm_cmpgt_epi32(iy2, load(y2)));
+        fails = _mm_or_si128(fails, _mm_cmpeq_epi32(load(opaque), zero));
+        if (_mm_movemask_epi8(fails) != 0xffff) {
+            return true;
+        }
+    }
+#else
+    for (; j < size_; j++) {
+        if (opaque[j] && x1[j] <= x1[i] && y1[j] <= y1[i] && x2[j] >= x2[i] && y2[j] >= y2[i]) {
+            return true;
+        }
+    }
+#endif
+    return false;
+}
+
+void OcclusionTable::compute(const QRect &screen, QVector<bool> *occluded) const
+{
+    occluded->resize(size_);
+    for (int i = 0; i < size_; i++) {
+        auto offScreen = x2_[i] <= screen.left() || y2_[i] <= screen.top() ||
+                x1_[i] > screen.right() || y1_[i] > screen.bottom() ||
+                x1_[i] >= x2_[i] || y1_[i] >= y2_[i];
+        (*occluded)[i] = offScreen || coveredAbove(i);
+    }
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <QRect>
+#include <QVector>
+
+// Window rectangles in stacking order (bottom to top), stored as separate coordinate
+// arrays so that one window can be tested against four others at once.
+// A window is occluded when it is off screen or lies entirely inside a single
+// opaque window above it. Coverage by a union of several windows isn't detected.
+class OcclusionTable
+{
+public:
+    OcclusionTable();
+
+    void clear();
+    void append(const QRect &, bool opaque);
+
+    int size() const
+    {
+        return size_;
+    }
+
+    // occluded[i] is set for every window i covered by windows above it
+    void compute(const QRect &screen, QVector<bool> *occluded) const;
+
+private:
+    bool coveredAbove(int i) const;
+
+    int size_;
+    // Padded to a multiple of 4 with empty, transparent entries
+    QVector<qint32> x1_, y1_, x2_, y2_;
+    QVector<qint32> opaque_; // 0 or -1, usable as a mask
+};
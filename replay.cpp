@@ -0,0 +1,182 @@
+// Feeds an event recording (QMLCOMPMGR_RECORD=file qmlcompmgr) back into ClientWindow
+// and WindowPixmap without an X server, at the recorded pace or as fast as possible,
+// and reports how long it took. Run under a profiler to look at a real session offline.
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QTimer>
+
+#include <cstring>
+#include <ctime>
+
+#include <xcb/xcb.h>
+#include <xcb/xcb_ewmh.h>
+#include <xcb/xcb_event.h>
+
+#include "eventrecording.h"
+#include "replayregistry.h"
+
+// Compositor clears damage once per frame; replay does it every 60 Hz of recorded time
+static const quint32 FrameUsecs = 16667;
+
+class Replay : public QObject
+{
+    Q_OBJECT
+
+public:
+    Replay(EventRecording *recording, xcb_ewmh_connection_t *ewmh, const ClientWindow::Atoms &atoms, bool fast)
+        : recording_(recording),
+          registry_(ewmh, atoms, recording->root(), recording->damageNotify()),
+          fast_(fast),
+          cpuStart_(0),
+          recordedUsecs_(0),
+          frameUsecs_(0),
+          events_(0),
+          consumed_(0),
+          hasRecord_(false)
+    {
+        for (const auto &w : recording->windows()) {
+            registry_.addWindow(w.window, w.geometry, w.mapped);
+        }
+        std::memset(eventCounts_, 0, sizeof(eventCounts_));
+
+        timer_.setSingleShot(true);
+        timer_.setTimerType(Qt::PreciseTimer);
+        connect(&timer_, SIGNAL(timeout()), SLOT(run()));
+    }
+
+    void report() const
+    {
+        auto nsecs = clock_.nsecsElapsed();
+        auto cpu = std::clock() - cpuStart_;
+        qDebug() << "Recorded time:" << recordedUsecs_ / 1000 << "ms";
+        qDebug() << "Replay time:" << nsecs / 1000000 << "ms";
+        qDebug() << "CPU time:" << cpu * 1000 / CLOCKS_PER_SEC << "ms";
+        qDebug() << "Events:" << events_ << "consumed:" << consumed_
+                 << "per second:" << qRound64(events_ * 1e9 / qMax<qint64>(nsecs, 1));
+        qDebug() << "Windows at the end:" << registry_.windowCount();
+        for (int i = 0; i < 128; i++) {
+            if (eventCounts_[i]) {
+                qDebug().nospace() << "  response type " << i << ": " << eventCounts_[i];
+            }
+        }
+    }
+
+public Q_SLOTS:
+    void start()
+    {
+        cpuStart_ = std::clock();
+        clock_.start();
+        run();
+    }
+
+private Q_SLOTS:
+    void run()
+    {
+        Q_FOREVER {
+            if (!hasRecord_) {
+                hasRecord_ = recording_->next(&record_);
+                if (!hasRecord_) {
+                    QCoreApplication::quit();
+                    return;
+                }
+            }
+
+            if (!fast_) {
+                auto due = (recordedUsecs_ + record_.usecs) / 1000 - clock_.elapsed();
+                if (due > 0) {
+                    // Queued signals and timers of the windows run in between, like in the compositor
+                    timer_.start(int(due));
+                    return;
+                }
+            }
+
+            process(record_);
+            hasRecord_ = false;
+        }
+    }
+
+private:
+    void process(const EventRecord::Record &record)
+    {
+        recordedUsecs_ += record.usecs;
+        frameUsecs_ += record.usecs;
+        if (frameUsecs_ >= FrameUsecs) {
+            frameUsecs_ %= FrameUsecs;
+            registry_.clearDamage();
+            if (fast_) {
+                QCoreApplication::processEvents();
+            }
+        }
+
+        switch (record.type) {
+        case EventRecord::Event: {
+            auto e = reinterpret_cast<const xcb_generic_event_t *>(record.event.constData());
+            events_++;
+            eventCounts_[XCB_EVENT_RESPONSE_TYPE(e)]++;
+            consumed_ += registry_.dispatch(e);
+            break;
+        }
+        case EventRecord::PixmapNamed:
+            registry_.addPixmap(record.window, record.pixmap, record.damage);
+            break;
+        case EventRecord::PixmapRemoved:
+            registry_.removePixmap(record.damage);
+            break;
+        }
+    }
+
+    EventRecording *recording_;
+    ReplayRegistry registry_;
+    bool fast_;
+    QTimer timer_;
+    QElapsedTimer clock_;
+    std::clock_t cpuStart_;
+    qint64 recordedUsecs_;
+    quint32 frameUsecs_;
+    qint64 events_;
+    qint64 consumed_;
+    qint64 eventCounts_[128];
+    EventRecord::Record record_;
+    bool hasRecord_;
+};
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+
+    QCommandLineParser parser;
+    parser.addHelpOption();
+    QCommandLineOption fastOption(QStringLiteral("fast"), QStringLiteral("Don't wait between events"));
+    parser.addOption(fastOption);
+    parser.addPositionalArgument(QStringLiteral("file"), QStringLiteral("Event recording"));
+    parser.process(app);
+    if (parser.positionalArguments().size() != 1) {
+        parser.showHelp(1);
+    }
+
+    EventRecording recording(parser.positionalArguments().first());
+    if (!recording.isValid()) {
+        return 1;
+    }
+
+    // Error connection: requests are dropped and replies never come, so windows keep
+    // the state the events give them
+    xcb_ewmh_connection_t ewmh;
+    std::memset(&ewmh, 0, sizeof(ewmh));
+    ewmh.connection = xcb_connect_to_fd(-1, Q_NULLPTR);
+    ClientWindow::Atoms atoms;
+    std::memset(&atoms, 0, sizeof(atoms));
+
+    Replay replay(&recording, &ewmh, atoms, parser.isSet(fastOption));
+    QTimer::singleShot(0, &replay, SLOT(start()));
+    auto result = app.exec();
+    replay.report();
+
+    xcb_disconnect(ewmh.connection);
+    return result;
+}
+
+#include "replay.moc"
@@ -0,0 +1,114 @@
+#include "replayregistry.h"
+
+ReplayRegistry::ReplayRegistry(xcb_ewmh_connection_t *ewmh, const ClientWindow::Atoms &atoms, xcb_window_t root,
+                               uint8_t damageNotify)
+    : ewmh_(ewmh),
+      atoms_(atoms),
+      root_(root),
+      damageNotify_(damageNotify)
+{
+}
+
+void ReplayRegistry::addWindow(xcb_window_t window, const QRect &geometry, bool mapped)
+{
+    stacking_.add(window);
+    if (!windows_.contains(window)) {
+        windows_.insert(window, ClientWindow::createDetached(ewmh_, atoms_, window, geometry, mapped));
+    }
+}
+
+void ReplayRegistry::removeWindow(xcb_window_t window)
+{
+    stacking_.remove(window);
+    windows_.remove(window);
+}
+
+void ReplayRegistry::addPixmap(xcb_window_t window, xcb_pixmap_t pixmap, xcb_damage_damage_t damage)
+{
+    auto w = windows_.value(window);
+    auto size = w ? w->geometry().size() : QSize();
+    pixmaps_.insert(damage, WindowPixmap::createDetached(ewmh_->connection, window, pixmap, damage, size));
+}
+
+void ReplayRegistry::removePixmap(xcb_damage_damage_t damage)
+{
+    pixmaps_.remove(damage);
+}
+
+void ReplayRegistry::clearDamage()
+{
+    for (const auto &pixmap : pixmaps_) {
+        pixmap->clearDamage();
+    }
+    WindowPixmap::flushDamageAcknowledgements(ewmh_->connection);
+}
+
+bool ReplayRegistry::xcbEvent(const xcb_configure_notify_event_t *e)
+{
+    if (e->event == root_ && e->window != root_) {
+        // Compositor rebuilds the stacking order from the server when it gets out of sync,
+        // which can't be done here
+        stacking_.restack(e->window, e->above_sibling);
+    }
+    if (e->window != e->event) {
+        return false;
+    }
+    return xcbDeliverEvent(windows_, e->window, e);
+}
+
+bool ReplayRegistry::xcbEvent(const xcb_create_notify_event_t *e)
+{
+    if (e->parent != root_) {
+        return false;
+    }
+    addWindow(e->window, QRect(e->x, e->y, e->width, e->height));
+    return true;
+}
+
+bool ReplayRegistry::xcbEvent(const xcb_destroy_notify_event_t *e)
+{
+    if (e->event != root_) {
+        return false;
+    }
+    removeWindow(e->window);
+    return true;
+}
+
+bool ReplayRegistry::xcbEvent(const xcb_reparent_notify_event_t *e)
+{
+    if (e->event != root_) {
+        return false;
+    }
+    if (e->parent == root_) {
+        addWindow(e->window, QRect(e->x, e->y, 0, 0));
+    } else {
+        removeWindow(e->window);
+    }
+    return xcbDeliverEvent(windows_, e->window, e);
+}
+
+bool ReplayRegistry::xcbEvent(const xcb_circulate_notify_event_t *e)
+{
+    if (e->event != root_) {
+        return false;
+    }
+    if (e->place == XCB_PLACE_ON_TOP) {
+        stacking_.raise(e->window);
+    } else {
+        stacking_.lower(e->window);
+    }
+    return windows_.contains(e->window);
+}
+
+bool ReplayRegistry::xcbEvent(const xcb_property_notify_event_t *e)
+{
+    if (e->window == root_) {
+        return false;
+    }
+    return xcbDeliverEvent(windows_, e->window, e);
+}
+
+bool ReplayRegistry::xcbEvent(const xcb_damage_notify_event_t *e)
+{
+    return xcbDeliverEvent(pixmaps_, e->damage, e);
+}
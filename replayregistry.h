@@ -0,0 +1,83 @@
+#pragma once
+
+#include <QSharedPointer>
+#include <QVector>
+
+#include <xcb/xcb.h>
+#include <xcb/damage.h>
+#include <xcb/xcb_ewmh.h>
+
+#include "clientwindow.h"
+#include "stackingorder.h"
+#include "windowpixmap.h"
+#include "xcbeventdispatch.h"
+#include "xidmap.h"
+
+// Window and pixmap registry that handles events like Compositor does, but without an
+// X server: windows and pixmaps are detached, and what Compositor would look up on the
+// server is taken from the events. Used to replay event recordings and to benchmark the
+// dispatch path. The handlers mirror Compositor's; testReplayMatchesCompositor replays a
+// recorded session and compares windows and stacking with what Compositor ended up with.
+class ReplayRegistry
+{
+public:
+    ReplayRegistry(xcb_ewmh_connection_t *, const ClientWindow::Atoms &, xcb_window_t root, uint8_t damageNotify);
+
+    void addWindow(xcb_window_t, const QRect &geometry = QRect(), bool mapped = false);
+    void removeWindow(xcb_window_t);
+    void addPixmap(xcb_window_t, xcb_pixmap_t, xcb_damage_damage_t);
+    void removePixmap(xcb_damage_damage_t);
+
+    int windowCount() const
+    {
+        return windows_.size();
+    }
+
+    QSharedPointer<ClientWindow> window(xcb_window_t window) const
+    {
+        return windows_.value(window);
+    }
+
+    const StackingOrder &stacking() const
+    {
+        return stacking_;
+    }
+
+    // Returns whether the event was consumed, like Compositor::nativeEventFilter()
+    bool dispatch(const xcb_generic_event_t *e)
+    {
+        return xcbDecodeEvent(this, damageNotify_, e);
+    }
+
+    // What Compositor does once per frame
+    void clearDamage();
+
+    // Event handlers called by xcbDecodeEvent()
+    template<typename T>
+    bool xcbEvent(const T *e)
+    {
+        if (e->event != root_) {
+            return false;
+        }
+        return xcbDeliverEvent(windows_, e->window, e);
+    }
+
+    bool xcbEvent(const xcb_configure_notify_event_t *);
+    bool xcbEvent(const xcb_create_notify_event_t *);
+    bool xcbEvent(const xcb_destroy_notify_event_t *);
+    bool xcbEvent(const xcb_reparent_notify_event_t *);
+    bool xcbEvent(const xcb_circulate_notify_event_t *);
+    bool xcbEvent(const xcb_property_notify_event_t *);
+    bool xcbEvent(const xcb_damage_notify_event_t *);
+
+private:
+    Q_DISABLE_COPY(ReplayRegistry)
+
+    xcb_ewmh_connection_t *ewmh_;
+    ClientWindow::Atoms atoms_;
+    xcb_window_t root_;
+    uint8_t damageNotify_;
+    XidMap<QSharedPointer<ClientWindow> > windows_;
+    XidMap<QSharedPointer<WindowPixmap> > pixmaps_;
+    StackingOrder stacking_;
+};
@@ -0,0 +1,290 @@
+#include "shmtexture.h"
+
+#include <cstdlib>
+
+#include <QDebug>
+#include <QOpenGLContext>
+
+#include <sys/ipc.h>
+#include <sys/shm.h>
+
+#ifndef GL_TEXTURE_SWIZZLE_A
+#define GL_TEXTURE_SWIZZLE_A 0x8E45
+#endif
+
+#ifndef GL_UNSIGNED_SHORT_5_6_5
+#define GL_UNSIGNED_SHORT_5_6_5 0x8363
+#endif
+
+QAtomicInteger<qint64> ShmTexture::uploads_;
+QAtomicInteger<qint64> ShmTexture::uploadedBytes_;
+
+static int visualDepth(xcb_connection_t *connection, xcb_visualid_t visual)
+{
+    for (auto screen = xcb_setup_roots_iterator(xcb_get_setup(connection)); screen.rem; xcb_screen_next(&screen)) {
+        for (auto depth = xcb_screen_allowed_depths_iterator(screen.data); depth.rem; xcb_depth_next(&depth)) {
+            auto visuals = xcb_depth_visuals(depth.data);
+            for (int i = 0; i < xcb_depth_visuals_length(depth.data); i++) {
+                if (visuals[i].visual_id == visual) {
+                    return depth.data->depth;
+                }
+            }
+        }
+    }
+    return 0;
+}
+
+static const xcb_format_t *pixmapFormat(xcb_connection_t *connection, int depth)
+{
+    auto setup = xcb_get_setup(connection);
+    auto formats = xcb_setup_pixmap_formats(setup);
+    for (int i = 0; i < xcb_setup_pixmap_formats_length(setup); i++) {
+        if (formats[i].depth == depth) {
+            return &formats[i];
+        }
+    }
+    return Q_NULLPTR;
+}
+
+bool ShmTexture::isSupported(xcb_connection_t *connection)
+{
+    // Attaching a segment is the only way to know the server is local
+    static const bool supported = [connection]() {
+        if (xcb_get_setup(connection)->image_byte_order != XCB_IMAGE_ORDER_LSB_FIRST) {
+            return false;
+        }
+
+        auto cookie = xcb_shm_query_version(connection);
+        auto version = xcb_shm_query_version_reply(connection, cookie, Q_NULLPTR);
+        if (!version) {
+            qWarning() << "MIT-SHM is not supported";
+            return false;
+        }
+        std::free(version);
+
+        auto shmId = shmget(IPC_PRIVATE, 4096, IPC_CREAT | 0600);
+        if (shmId < 0) {
+            return false;
+        }
+        auto seg = xcb_generate_id(connection);
+        auto error = xcb_request_check(connection, xcb_shm_attach_checked(connection, seg, shmId, false));
+        shmctl(shmId, IPC_RMID, Q_NULLPTR);
+        if (error) {
+            qWarning() << "MIT-SHM segments can't be attached, the server is probably remote";
+            std::free(error);
+            return false;
+        }
+        xcb_shm_detach(connection, seg);
+        return true;
+    }();
+    return supported;
+}
+
+ShmTexture::ShmTexture(xcb_connection_t *connection, xcb_pixmap_t pixmap, xcb_visualid_t visual,
+                       const QSize &size)
+    : QOpenGLFunctions(QOpenGLContext::currentContext()),
+      connection_(connection),
+      pixmap_(pixmap),
+      visual_(visual),
+      size_(size),
+      depth_(visualDepth(connection, visual)),
+      bytesPerPixel_(0),
+      scanlinePad_(0),
+      texture_(0),
+      allocated_(false),
+      writeOffset_(0)
+{
+    glGenTextures(1, &texture_);
+    glBindTexture(GL_TEXTURE_2D, texture_);
+
+    setFiltering(Linear);
+    setHorizontalWrapMode(ClampToEdge);
+    setVerticalWrapMode(ClampToEdge);
+    updateBindOptions(true);
+
+    auto format = pixmapFormat(connection, depth_);
+    if (format) {
+        bytesPerPixel_ = format->bits_per_pixel / 8;
+        scanlinePad_ = format->scanline_pad / 8;
+    }
+    if (depth_ != 16 && depth_ != 24 && depth_ != 32) {
+        qWarning() << "MIT-SHM textures don't support depth" << depth_;
+        return;
+    }
+    // Rows of the images are padded to this, and GL has to skip the same padding
+    if (scanlinePad_ != 1 && scanlinePad_ != 2 && scanlinePad_ != 4 && scanlinePad_ != 8) {
+        qWarning() << "MIT-SHM textures don't support a scanline pad of" << scanlinePad_ << "bytes";
+        return;
+    }
+    attach(&segment_);
+}
+
+ShmTexture::~ShmTexture()
+{
+    // Replies have to be collected even if nobody wants them
+    for (const auto &image : pending_) {
+        xcb_discard_reply(connection_, image.cookie.sequence);
+    }
+    detach(&segment_);
+
+    if (texture_ && QOpenGLContext::currentContext()) {
+        glDeleteTextures(1, &texture_);
+    }
+}
+
+bool ShmTexture::attach(Segment *segment)
+{
+    auto size = imageBytes(size_);
+    if (size <= 0) {
+        return false;
+    }
+
+    segment->shmId = shmget(IPC_PRIVATE, size, IPC_CREAT | 0600);
+    if (segment->shmId < 0) {
+        qWarning() << "shmget failed for" << size << "bytes";
+        return false;
+    }
+    segment->data = static_cast<uchar *>(shmat(segment->shmId, Q_NULLPTR, 0));
+    if (segment->data == reinterpret_cast<uchar *>(-1)) {
+        segment->data = Q_NULLPTR;
+        shmctl(segment->shmId, IPC_RMID, Q_NULLPTR);
+        segment->shmId = -1;
+        return false;
+    }
+
+    segment->seg = xcb_generate_id(connection_);
+    xcb_shm_attach(connection_, segment->seg, segment->shmId, false);
+    // Marked for removal right away, so it goes away with the last detach even after a crash.
+    // Linux still lets the server attach it while we have it attached.
+    shmctl(segment->shmId, IPC_RMID, Q_NULLPTR);
+    return true;
+}
+
+void ShmTexture::detach(Segment *segment)
+{
+    if (segment->seg != XCB_NONE) {
+        xcb_shm_detach(connection_, segment->seg);
+        segment->seg = XCB_NONE;
+    }
+    if (segment->data) {
+        shmdt(segment->data);
+        segment->data = Q_NULLPTR;
+    }
+}
+
+int ShmTexture::imageBytes(const QSize &size) const
+{
+    // Z-pixmap rows are padded to the scanline pad of the pixmap format
+    auto stride = (size.width() * bytesPerPixel_ + scanlinePad_ - 1) / scanlinePad_ * scanlinePad_;
+    return stride * size.height();
+}
+
+int ShmTexture::textureId() const
+{
+    return static_cast<int>(texture_);
+}
+
+QSize ShmTexture::textureSize() const
+{
+    return size_;
+}
+
+bool ShmTexture::hasAlphaChannel() const
+{
+    return depth_ == 32;
+}
+
+bool ShmTexture::hasMipmaps() const
+{
+    return false;
+}
+
+qint64 ShmTexture::bytes() const
+{
+    qint64 image = qint64(size_.width()) * size_.height();
+    return image * 4 + (segment_.data ? imageBytes(size_) : 0);
+}
+
+void ShmTexture::update(const QRegion &damage)
+{
+    if (!segment_.data) {
+        return;
+    }
+
+    for (const auto &r : (damage & QRect(QPoint(), size_)).rects()) {
+        auto bytes = imageBytes(r.size());
+        if (writeOffset_ + bytes > imageBytes(size_)) {
+            // Damage of several frames piled up without a draw; make room. The images
+            // requested so far are waited for and uploaded before the space is reused.
+            upload();
+        }
+
+        PendingImage image;
+        image.rect = r;
+        image.offset = writeOffset_;
+        image.cookie = xcb_shm_get_image(connection_, pixmap_, r.x(), r.y(), r.width(), r.height(),
+                                         ~0u, XCB_IMAGE_FORMAT_Z_PIXMAP, segment_.seg,
+                                         writeOffset_);
+        pending_.append(image);
+        writeOffset_ += bytes;
+    }
+    xcb_flush(connection_);
+}
+
+void ShmTexture::upload()
+{
+    if (pending_.isEmpty()) {
+        return;
+    }
+
+    glBindTexture(GL_TEXTURE_2D, texture_);
+
+    GLenum format = GL_BGRA, type = GL_UNSIGNED_BYTE;
+    if (depth_ == 16) {
+        format = GL_RGB;
+        type = GL_UNSIGNED_SHORT_5_6_5;
+    }
+
+    if (!allocated_) {
+        glTexImage2D(GL_TEXTURE_2D, 0, depth_ == 16 ? GL_RGB : GL_RGBA, size_.width(), size_.height(), 0,
+                     format, type, Q_NULLPTR);
+        // The padding byte of depth 24 images is undefined
+        auto context = QOpenGLContext::currentContext();
+        if (depth_ == 24 && (context->format().version() >= qMakePair(3, 3) ||
+                             context->hasExtension(QByteArrayLiteral("GL_ARB_texture_swizzle")))) {
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_A, GL_ONE);
+        }
+        allocated_ = true;
+    }
+
+    auto data = segment_.data;
+    glPixelStorei(GL_UNPACK_ALIGNMENT, scanlinePad_);
+    for (const auto &image : pending_) {
+        auto reply = xcb_shm_get_image_reply(connection_, image.cookie, Q_NULLPTR);
+        if (!reply) {
+            // The window is gone; the pixmap will be replaced soon
+            continue;
+        }
+        std::free(reply);
+
+        glTexSubImage2D(GL_TEXTURE_2D, 0, image.rect.x(), image.rect.y(), image.rect.width(),
+                        image.rect.height(), format, type, data + image.offset);
+        uploadedBytes_.fetchAndAddRelaxed(qint64(image.rect.width()) * image.rect.height() * bytesPerPixel_);
+    }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    uploads_.fetchAndAddRelaxed(1);
+
+    pending_.clear();
+    writeOffset_ = 0;
+}
+
+void ShmTexture::bind()
+{
+    // Contents are needed on the first draw, whatever is damaged
+    if (!allocated_ && pending_.isEmpty()) {
+        update(QRect(QPoint(), size_));
+    }
+    upload();
+    glBindTexture(GL_TEXTURE_2D, texture_);
+    updateBindOptions();
+}
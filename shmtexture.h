@@ -0,0 +1,101 @@
+#pragma once
+
+#include <QAtomicInteger>
+#include <QOpenGLFunctions>
+#include <QVector>
+
+#include <xcb/xcb.h>
+#include <xcb/shm.h>
+
+#include "windowtexture.h"
+
+// Window texture filled through MIT-SHM, for hosts without texture-from-pixmap or with
+// software GL, where binding a pixmap copies all of it. Only damaged rectangles are read
+// and uploaded with glTexSubImage2D into a texture that lives as long as the pixmap.
+//
+// Images are requested into a shared memory segment when damage is handed over during
+// sync, and uploaded from it when the texture is bound during rendering, so the server
+// works while the scene graph renders everything before this window. Waiting for the
+// replies there is what makes reuse safe: all of them are in, and the segment has been
+// read, before the next sync requests new images into it. One segment is enough.
+class ShmTexture : public WindowTexture,
+                   protected QOpenGLFunctions
+{
+    Q_OBJECT
+public:
+    ShmTexture(xcb_connection_t *, xcb_pixmap_t, xcb_visualid_t, const QSize &);
+    ~ShmTexture() Q_DECL_OVERRIDE;
+
+    // Whether the server supports MIT-SHM and is on the same host
+    static bool isSupported(xcb_connection_t *);
+
+    int textureId() const Q_DECL_OVERRIDE;
+    QSize textureSize() const Q_DECL_OVERRIDE;
+    bool hasAlphaChannel() const Q_DECL_OVERRIDE;
+    bool hasMipmaps() const Q_DECL_OVERRIDE;
+
+    void bind() Q_DECL_OVERRIDE;
+    void update(const QRegion &damage) Q_DECL_OVERRIDE;
+
+    bool isYInverted() const Q_DECL_OVERRIDE
+    {
+        return false;
+    }
+
+    // The texture and the shared memory segment
+    qint64 bytes() const Q_DECL_OVERRIDE;
+
+    // Totals over all textures
+    static qint64 uploads()
+    {
+        return uploads_.load();
+    }
+
+    static qint64 uploadedBytes()
+    {
+        return uploadedBytes_.load();
+    }
+
+private:
+    struct Segment
+    {
+        xcb_shm_seg_t seg;
+        int shmId;
+        uchar *data;
+
+        Segment()
+            : seg(XCB_NONE), shmId(-1), data(Q_NULLPTR)
+        {
+        }
+    };
+
+    struct PendingImage
+    {
+        QRect rect;
+        int offset;
+        xcb_shm_get_image_cookie_t cookie;
+    };
+
+    bool attach(Segment *);
+    void detach(Segment *);
+    void upload();
+    int imageBytes(const QSize &) const;
+
+    xcb_connection_t *connection_;
+    xcb_pixmap_t pixmap_;
+    xcb_visualid_t visual_;
+    QSize size_;
+    int depth_;
+    int bytesPerPixel_;
+    // In bytes
+    int scanlinePad_;
+    uint texture_;
+    bool allocated_;
+
+    Segment segment_;
+    int writeOffset_;
+    QVector<PendingImage> pending_;
+
+    static QAtomicInteger<qint64> uploads_;
+    static QAtomicInteger<qint64> uploadedBytes_;
+};
@@ -0,0 +1,106 @@
+#include "stackingorder.h"
+
+#include <algorithm>
+#include <climits>
+
+StackingOrder::StackingOrder()
+    : dirtyFirst_(INT_MAX),
+      dirtyLast_(-1)
+{
+}
+
+void StackingOrder::reset(const xcb_window_t *windows, int count)
+{
+    windows_.resize(count);
+    std::copy(windows, windows + count, windows_.begin());
+    markDirty(0, count - 1);
+}
+
+void StackingOrder::add(xcb_window_t window)
+{
+    // May be already known if it was created between XSelectInput and XQueryTree
+    if (windows_.contains(window)) {
+        return;
+    }
+    windows_.append(window);
+    markDirty(windows_.size() - 1, windows_.size() - 1);
+}
+
+void StackingOrder::remove(xcb_window_t window)
+{
+    auto i = windows_.indexOf(window);
+    if (i < 0) {
+        return;
+    }
+    windows_.remove(i);
+    markDirty(i, windows_.size() - 1);
+}
+
+bool StackingOrder::restack(xcb_window_t window, xcb_window_t aboveSibling)
+{
+    auto from = windows_.indexOf(window);
+    if (from < 0) {
+        return false;
+    }
+
+    if (aboveSibling == XCB_NONE) {
+        return move(from, 0);
+    }
+
+    auto sibling = windows_.indexOf(aboveSibling);
+    if (sibling < 0 || sibling == from) {
+        return false;
+    }
+    return move(from, sibling < from ? sibling + 1 : sibling);
+}
+
+bool StackingOrder::raise(xcb_window_t window)
+{
+    auto from = windows_.indexOf(window);
+    if (from < 0) {
+        return false;
+    }
+    return move(from, windows_.size() - 1);
+}
+
+bool StackingOrder::lower(xcb_window_t window)
+{
+    auto from = windows_.indexOf(window);
+    if (from < 0) {
+        return false;
+    }
+    return move(from, 0);
+}
+
+void StackingOrder::clearDirty()
+{
+    dirtyFirst_ = INT_MAX;
+    dirtyLast_ = -1;
+}
+
+bool StackingOrder::move(int from, int to)
+{
+    if (from == to) {
+        return true;
+    }
+
+    auto window = windows_.at(from);
+    if (from < to) {
+        std::copy(windows_.begin() + from + 1, windows_.begin() + to + 1, windows_.begin() + from);
+        markDirty(from, to);
+    } else {
+        std::copy_backward(windows_.begin() + to, windows_.begin() + from, windows_.begin() + from + 1);
+        markDirty(to, from);
+    }
+    windows_[to] = window;
+    return true;
+}
+
+void StackingOrder::markDirty(int first, int last)
+{
+    if (first > last) {
+        return;
+    }
+    dirtyFirst_ = qMin(dirtyFirst_, first);
+    dirtyLast_ = qMax(dirtyLast_, last);
+}
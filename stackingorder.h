@@ -0,0 +1,64 @@
+#pragma once
+
+#include <QVector>
+
+#include <xcb/xcb.h>
+
+// Bottom-to-top list of root window children, kept up to date from
+// CreateNotify/DestroyNotify/ReparentNotify/ConfigureNotify/CirculateNotify.
+// Restacking methods return false if the event doesn't match the current
+// state; the caller should rebuild the list from the server then.
+class StackingOrder
+{
+public:
+    StackingOrder();
+
+    void reset(const xcb_window_t *windows, int count);
+
+    int size() const
+    {
+        return windows_.size();
+    }
+
+    xcb_window_t at(int i) const
+    {
+        return windows_.at(i);
+    }
+
+    int indexOf(xcb_window_t window) const
+    {
+        return windows_.indexOf(window);
+    }
+
+    void add(xcb_window_t);
+    void remove(xcb_window_t);
+    bool restack(xcb_window_t window, xcb_window_t aboveSibling);
+    bool raise(xcb_window_t);
+    bool lower(xcb_window_t);
+
+    // Range of indices changed since the last clearDirty(), inclusive
+    bool isDirty() const
+    {
+        return dirtyFirst_ <= dirtyLast_;
+    }
+
+    int dirtyFirst() const
+    {
+        return dirtyFirst_;
+    }
+
+    int dirtyLast() const
+    {
+        return dirtyLast_;
+    }
+
+    void clearDirty();
+
+private:
+    bool move(int from, int to);
+    void markDirty(int first, int last);
+
+    QVector<xcb_window_t> windows_;
+    int dirtyFirst_;
+    int dirtyLast_;
+};
@@ -0,0 +1,8 @@
+import QtQuick 2.4
+import QtGraphicalEffects 1.0
+
+// How main.qml dimmed inactive windows before WindowPixmap had a brightness
+BrightnessContrast {
+    brightness: -0.5
+    cached: true
+}
@@ -0,0 +1,10 @@
+import QtQuick 2.4
+import QtGraphicalEffects 1.0
+
+// The shadow main.qml used before WindowShadow
+RectangularGlow {
+    cached: true
+    color: "black"
+    opacity: 0.5
+    glowRadius: 10
+}
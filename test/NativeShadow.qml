@@ -0,0 +1,8 @@
+import QtQuick 2.4
+import Compositor 1.0
+
+WindowShadow {
+    color: "black"
+    opacity: 0.5
+    radius: 10
+}
@@ -0,0 +1,490 @@
+#include <QtTest>
+#include <QQmlContext>
+#include <QQuickView>
+#include <QRasterWindow>
+#include <QX11Info>
+
+#include <algorithm>
+#include <ctime>
+
+#include "xephyr.h"
+#include "waitforwindow.h"
+#include "compositor.h"
+#include "clientwindow.h"
+#include "windowpixmapitem.h"
+#include "glxtexturefrompixmap.h"
+#include "framescheduler.h"
+#include "stackingorder.h"
+#include "xidmap.h"
+
+struct EwmhConnection
+{
+    xcb_ewmh_connection_t connection;
+    ClientWindow::Atoms atoms;
+
+    EwmhConnection()
+    {
+        auto atomCookies = ClientWindow::internAtoms(QX11Info::connection());
+        xcb_ewmh_init_atoms_replies(&connection,
+                                    xcb_ewmh_init_atoms(QX11Info::connection(), &connection),
+                                    Q_NULLPTR);
+        atoms = ClientWindow::internAtomsReplies(QX11Info::connection(), atomCookies);
+    }
+
+    ~EwmhConnection()
+    {
+        xcb_ewmh_connection_wipe(&connection);
+    }
+};
+
+class TopLevelWindows
+{
+public:
+    explicit TopLevelWindows(int count)
+    {
+        auto connection = QX11Info::connection();
+        for (int i = 0; i < count; i++) {
+            auto window = xcb_generate_id(connection);
+            xcb_create_window(connection, XCB_COPY_FROM_PARENT, window, QX11Info::appRootWindow(),
+                              0, 0, 1, 1, 0, XCB_WINDOW_CLASS_INPUT_OUTPUT, XCB_COPY_FROM_PARENT,
+                              0, Q_NULLPTR);
+            windows.append(window);
+        }
+        xcb_flush(connection);
+    }
+
+    ~TopLevelWindows()
+    {
+        auto connection = QX11Info::connection();
+        for (auto window : windows) {
+            xcb_destroy_window(connection, window);
+        }
+        xcb_flush(connection);
+    }
+
+    QVector<xcb_window_t> windows;
+
+private:
+    Q_DISABLE_COPY(TopLevelWindows)
+};
+
+// Compositor rendering test/scene.qml, like main.cpp does with main.qml
+class CompositorScene
+{
+public:
+    CompositorScene()
+        : scheduler(&view)
+    {
+        WindowPixmapItem::registerQmlTypes();
+        compositor.registerCompositor(&view);
+        view.rootContext()->setContextProperty(QStringLiteral("compositor"), &compositor);
+        view.setParent(compositor.overlayWindow());
+        view.setSource(QUrl::fromLocalFile(QFINDTESTDATA("scene.qml")));
+        view.setGeometry(compositor.rootGeometry());
+        view.show();
+        QTest::qWaitForWindowExposed(&view);
+    }
+
+    Compositor compositor;
+    QQuickView view;
+    FrameScheduler scheduler;
+};
+
+static qint64 percentile(QVector<qint64> samples, int p)
+{
+    if (samples.isEmpty()) {
+        return 0;
+    }
+    auto nth = samples.begin() + qMin(samples.size() - 1, samples.size() * p / 100);
+    std::nth_element(samples.begin(), nth, samples.end());
+    return *nth;
+}
+
+class CompositorBenchmark : public QObject
+{
+    Q_OBJECT
+private Q_SLOTS:
+    void benchmarkRestack_data()
+    {
+        QTest::addColumn<int>("windowCount");
+        QTest::addColumn<bool>("incremental");
+
+        for (int count : {10, 100, 300, 1000}) {
+            QTest::newRow(qPrintable(QStringLiteral("query tree, %1 windows").arg(count))) << count << false;
+            QTest::newRow(qPrintable(QStringLiteral("incremental, %1 windows").arg(count))) << count << true;
+        }
+    }
+
+    void benchmarkRestack()
+    {
+        QFETCH(int, windowCount);
+        QFETCH(bool, incremental);
+
+        auto connection = QX11Info::connection();
+        auto root = QX11Info::appRootWindow();
+
+        EwmhConnection ewmh;
+        TopLevelWindows topLevels(windowCount);
+        QMap<xcb_window_t, QSharedPointer<ClientWindow> > clientWindows;
+        for (auto window : topLevels.windows) {
+            clientWindows.insert(window, QSharedPointer<ClientWindow>::create(&ewmh.connection, ewmh.atoms, window));
+        }
+
+        auto treeCookie = xcb_query_tree_unchecked(connection, root);
+        auto tree = xcb_query_tree_reply(connection, treeCookie, Q_NULLPTR);
+        QVERIFY(tree);
+        StackingOrder stacking;
+        stacking.reset(xcb_query_tree_children(tree), xcb_query_tree_children_length(tree));
+        std::free(tree);
+
+        int next = 0;
+        if (incremental) {
+            // What Compositor does on ConfigureNotify: move one window, update zIndex of the moved range
+            QBENCHMARK {
+                stacking.raise(topLevels.windows.at(next++ % windowCount));
+                for (int i = stacking.dirtyFirst(); i <= stacking.dirtyLast(); i++) {
+                    auto w = clientWindows.constFind(stacking.at(i));
+                    if (w != clientWindows.constEnd()) {
+                        (*w)->setZIndex(i);
+                    }
+                }
+                stacking.clearDirty();
+            }
+        } else {
+            // Previous implementation of Compositor::restack()
+            QBENCHMARK {
+                treeCookie = xcb_query_tree_unchecked(connection, root);
+                tree = xcb_query_tree_reply(connection, treeCookie, Q_NULLPTR);
+                auto children = xcb_query_tree_children(tree);
+                for (int i = 0; i < xcb_query_tree_children_length(tree); i++) {
+                    auto w = clientWindows.constFind(children[i]);
+                    if (w != clientWindows.constEnd()) {
+                        (*w)->setZIndex(i);
+                    }
+                }
+                std::free(tree);
+            }
+        }
+    }
+
+    void benchmarkRegistryLookup_data()
+    {
+        QTest::addColumn<int>("windowCount");
+        QTest::addColumn<bool>("flat");
+
+        for (int count : {10, 100, 1000}) {
+            QTest::newRow(qPrintable(QStringLiteral("QMap, %1 windows").arg(count))) << count << false;
+            QTest::newRow(qPrintable(QStringLiteral("XidMap, %1 windows").arg(count))) << count << true;
+        }
+    }
+
+    void benchmarkRegistryLookup()
+    {
+        QFETCH(int, windowCount);
+        QFETCH(bool, flat);
+
+        // IDs as allocated by a handful of clients: a resource base per client, sequential low bits
+        QVector<xcb_window_t> ids;
+        for (int i = 0; i < windowCount; i++) {
+            ids.append(((i % 8 + 1) << 21) | (i / 8 * 3 + 1));
+        }
+
+        QMap<xcb_window_t, QSharedPointer<ClientWindow> > map;
+        XidMap<QSharedPointer<ClientWindow> > xidMap;
+        for (auto id : ids) {
+            map.insert(id, QSharedPointer<ClientWindow>());
+            xidMap.insert(id, QSharedPointer<ClientWindow>());
+        }
+
+        // Events mostly hit registered windows, some of them don't
+        QVector<xcb_window_t> events;
+        qsrand(42);
+        for (int i = 0; i < 4096; i++) {
+            events.append(i % 8 ? ids.at(qrand() % ids.size()) : xcb_window_t(qrand()));
+        }
+
+        int found = 0;
+        if (flat) {
+            QBENCHMARK {
+                for (auto e : events) {
+                    found += (xidMap.constFind(e) != xidMap.constEnd());
+                }
+            }
+        } else {
+            QBENCHMARK {
+                for (auto e : events) {
+                    found += (map.constFind(e) != map.constEnd());
+                }
+            }
+        }
+        QVERIFY(found > 0);
+    }
+
+    void benchmarkClientWindowCreation_data()
+    {
+        QTest::addColumn<int>("windowCount");
+        QTest::addColumn<bool>("batch");
+
+        for (int count : {10, 100, 300, 1000}) {
+            QTest::newRow(qPrintable(QStringLiteral("sequential, %1 windows").arg(count))) << count << false;
+            QTest::newRow(qPrintable(QStringLiteral("batch, %1 windows").arg(count))) << count << true;
+        }
+    }
+
+    void benchmarkClientWindowCreation()
+    {
+        QFETCH(int, windowCount);
+        QFETCH(bool, batch);
+
+        EwmhConnection ewmh;
+        TopLevelWindows topLevels(windowCount);
+
+        if (batch) {
+            QBENCHMARK {
+                auto clientWindows = ClientWindow::create(&ewmh.connection, ewmh.atoms, topLevels.windows);
+                QCOMPARE(clientWindows.size(), windowCount);
+            }
+        } else {
+            QBENCHMARK {
+                QVector<QSharedPointer<ClientWindow> > clientWindows;
+                for (auto window : topLevels.windows) {
+                    clientWindows.append(ClientWindow::create(&ewmh.connection, ewmh.atoms, window));
+                }
+            }
+        }
+    }
+
+    void benchmarkStartup_data()
+    {
+        QTest::addColumn<int>("windowCount");
+
+        for (int count : {0, 10, 100, 300, 1000}) {
+            QTest::newRow(qPrintable(QStringLiteral("%1 windows").arg(count))) << count;
+        }
+    }
+
+    void benchmarkStartup()
+    {
+        QFETCH(int, windowCount);
+
+        TopLevelWindows topLevels(windowCount);
+        QBENCHMARK {
+            Compositor comp;
+        }
+        QCoreApplication::processEvents();
+    }
+
+    void benchmarkCreateBurst_data()
+    {
+        QTest::addColumn<int>("windowCount");
+
+        for (int count : {10, 100, 300}) {
+            QTest::newRow(qPrintable(QStringLiteral("%1 windows").arg(count))) << count;
+        }
+    }
+
+    void benchmarkCreateBurst()
+    {
+        QFETCH(int, windowCount);
+
+        Compositor comp;
+        QCoreApplication::processEvents();
+        QSignalSpy spy(&comp, SIGNAL(windowCreated(ClientWindow*)));
+
+        QBENCHMARK {
+            spy.clear();
+            TopLevelWindows topLevels(windowCount);
+            while (spy.count() < windowCount) {
+                QVERIFY(spy.wait());
+            }
+            QCoreApplication::processEvents();
+        }
+    }
+
+    void benchmarkMapToFirstFrame()
+    {
+        CompositorScene scene;
+        QSignalSpy createdSpy(&scene.compositor, SIGNAL(windowCreated(ClientWindow*)));
+
+        QRasterWindow win;
+        win.setGeometry(0, 0, 300, 300);
+        win.create();
+        QVERIFY(createdSpy.wait());
+        auto w = createdSpy.first().first().value<ClientWindow *>()->sharedFromThis();
+
+        QVector<qint64> latencies;
+        QSignalSpy latencySpy(w.data(), SIGNAL(mapLatencyChanged(qint64)));
+        QSignalSpy mapSpy(w.data(), SIGNAL(mapStateChanged(bool)));
+        for (int i = 0; i < 20; i++) {
+            win.show();
+            QVERIFY(latencySpy.wait());
+            latencies.append(w->mapLatency());
+            win.hide();
+            while (w->isMapped()) {
+                QVERIFY(mapSpy.wait());
+            }
+            latencySpy.clear();
+        }
+        QTest::setBenchmarkResult(percentile(latencies, 50), QTest::WalltimeMilliseconds);
+    }
+
+    void benchmarkFullScreenCpu_data()
+    {
+        QTest::addColumn<bool>("bypass");
+
+        QTest::newRow("composited") << false;
+        QTest::newRow("bypass") << true;
+    }
+
+    void benchmarkFullScreenCpu()
+    {
+        QFETCH(bool, bypass);
+
+        CompositorScene scene;
+        scene.compositor.setBypassEnabled(bypass);
+        QSignalSpy bypassSpy(&scene.compositor, SIGNAL(bypassActiveChanged(bool)));
+        QSignalSpy swapSpy(&scene.view, SIGNAL(frameSwapped()));
+
+        // Full-screen window redrawn at ~100 Hz, like video playback
+        QRasterWindow video;
+        video.setGeometry(scene.compositor.rootGeometry());
+        video.show();
+        if (bypass) {
+            QVERIFY(bypassSpy.wait(3000));
+        } else {
+            QTest::qWait(1500);
+        }
+        swapSpy.clear();
+
+        QTimer redraw;
+        redraw.setInterval(10);
+        connect(&redraw, SIGNAL(timeout()), &video, SLOT(update()));
+        redraw.start();
+
+        auto start = std::clock();
+        QTest::qWait(2000);
+        auto cpu = std::clock() - start;
+
+        qDebug() << "CPU ms:" << cpu * 1000 / CLOCKS_PER_SEC << "frames:" << swapSpy.count();
+        QTest::setBenchmarkResult(cpu, QTest::CPUTicks);
+    }
+
+    void benchmarkIdle()
+    {
+        CompositorScene scene;
+
+        QRasterWindow win;
+        win.setGeometry(0, 0, 300, 300);
+        win.show();
+        QTest::qWait(2000);
+
+        // Nothing changes on screen: no wakeups, no frames
+        auto wakeups = scene.scheduler.wakeups();
+        auto frames = scene.scheduler.frames();
+        QTest::qWait(2000);
+        QCOMPARE(scene.scheduler.wakeups(), wakeups);
+        QCOMPARE(scene.scheduler.frames(), frames);
+        QTest::setBenchmarkResult(scene.scheduler.frames() - frames, QTest::Events);
+    }
+
+    void benchmarkDamageToPresent()
+    {
+        CompositorScene scene;
+
+        // Blinking cursor at 20 Hz
+        QRasterWindow win;
+        win.setGeometry(0, 0, 300, 300);
+        win.show();
+        QTest::qWait(1000);
+
+        QTimer blink;
+        blink.setInterval(50);
+        connect(&blink, SIGNAL(timeout()), &win, SLOT(update()));
+        blink.start();
+        QTest::qWait(3000);
+        blink.stop();
+
+        auto &latency = scene.scheduler.damageToPresent();
+        qDebug() << "Damage to present, ms: p50" << latency.percentile(50)
+                 << "p90" << latency.percentile(90)
+                 << "p99" << latency.percentile(99)
+                 << "samples" << latency.count();
+        qDebug() << "Wakeups per second:" << scene.scheduler.wakeupsPerSecond();
+        QTest::setBenchmarkResult(latency.percentile(50), QTest::WalltimeMilliseconds);
+    }
+
+    void benchmarkPopupChurn()
+    {
+        CompositorScene scene;
+        QSignalSpy createdSpy(&scene.compositor, SIGNAL(windowCreated(ClientWindow*)));
+
+        // Override-redirect, like menus and tooltips, without grabbing the pointer
+        QRasterWindow popup;
+        popup.setFlags(Qt::ToolTip);
+        popup.setGeometry(100, 100, 150, 200);
+        popup.create();
+        QVERIFY(createdSpy.wait());
+        auto w = createdSpy.first().first().value<ClientWindow *>()->sharedFromThis();
+        QVERIFY(w->isOverrideRedirect());
+
+        QVector<qint64> latencies;
+        QSignalSpy latencySpy(w.data(), SIGNAL(mapLatencyChanged(qint64)));
+        QSignalSpy mapSpy(w.data(), SIGNAL(mapStateChanged(bool)));
+        for (int i = 0; i < 1000; i++) {
+            popup.show();
+            QVERIFY(latencySpy.wait());
+            latencies.append(w->mapLatency());
+            popup.hide();
+            while (w->isMapped()) {
+                QVERIFY(mapSpy.wait());
+            }
+            latencySpy.clear();
+        }
+
+        qDebug() << "Map to first frame, ms: p50" << percentile(latencies, 50)
+                 << "p90" << percentile(latencies, 90)
+                 << "p99" << percentile(latencies, 99)
+                 << "max" << percentile(latencies, 100);
+        QTest::setBenchmarkResult(percentile(latencies, 50), QTest::WalltimeMilliseconds);
+    }
+
+    void benchmarkResizeStorm()
+    {
+        CompositorScene scene;
+        QRasterWindow win;
+        win.setGeometry(0, 0, 200, 200);
+        win.show();
+        auto w = getWindowPixmap(scene.compositor);
+        QVERIFY(w);
+
+        QSignalSpy reallocationSpy(w.data(), SIGNAL(pixmapCreated(WindowPixmap*)));
+        QSignalSpy swapSpy(&scene.view, SIGNAL(frameSwapped()));
+
+        // Configure requests every 2 ms for a second, like a fast interactive resize
+        QElapsedTimer timer;
+        timer.start();
+        int resizes = 0;
+        while (timer.elapsed() < 1000) {
+            auto size = 200 + resizes % 200;
+            win.resize(size, size);
+            resizes++;
+            QTest::qWait(2);
+        }
+        auto elapsed = timer.elapsed();
+
+        auto refreshRate = scene.view.screen()->refreshRate();
+        auto expectedFrames = static_cast<int>(elapsed * (refreshRate > 0 ? refreshRate : 60.0) / 1000);
+        auto droppedFrames = qMax(0, expectedFrames - swapSpy.count());
+        qDebug() << "Resizes:" << resizes
+                 << "reallocations:" << reallocationSpy.count()
+                 << "frames:" << swapSpy.count()
+                 << "dropped frames:" << droppedFrames;
+        QTest::setBenchmarkResult(reallocationSpy.count(), QTest::Events);
+    }
+};
+
+static Xephyr xephyr(QByteArrayLiteral(":982"));
+
+QTEST_MAIN(CompositorBenchmark)
+
+#include "bench_compositor.moc"
@@ -0,0 +1,265 @@
+#include <QtTest>
+
+#include <atomic>
+
+#include <xcb/xcb.h>
+#include <xcb/damage.h>
+#include <xcb/xcb_ewmh.h>
+
+#include "replayregistry.h"
+
+// Counts heap allocations of the whole process; operator new ends up in malloc too
+#ifdef __GLIBC__
+extern "C" {
+void *__libc_malloc(size_t);
+void *__libc_calloc(size_t, size_t);
+void *__libc_realloc(void *, size_t);
+}
+
+static std::atomic<long> allocations(0);
+
+extern "C" void *malloc(size_t size) throw()
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_malloc(size);
+}
+
+extern "C" void *calloc(size_t count, size_t size) throw()
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_calloc(count, size);
+}
+
+extern "C" void *realloc(void *ptr, size_t size) throw()
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_realloc(ptr, size);
+}
+#else
+static std::atomic<long> allocations(-1);
+#endif
+
+// First event of DAMAGE is assigned by the server; this is what Xorg usually picks
+static const uint8_t DamageNotify = 91;
+
+static const xcb_window_t Root = 0x100;
+
+// A resource base per client, a few IDs per window, like real clients
+static xcb_window_t windowId(int i)
+{
+    return ((i % 8 + 1) << 21) | (i / 8 * 4 + 1);
+}
+
+// All events have the same size on the wire
+typedef xcb_generic_event_t Event;
+Q_STATIC_ASSERT(sizeof(xcb_configure_notify_event_t) == sizeof(Event));
+Q_STATIC_ASSERT(sizeof(xcb_damage_notify_event_t) == sizeof(Event));
+
+class EventGenerator
+{
+public:
+    explicit EventGenerator(const QVector<xcb_window_t> &windows)
+        : windows_(windows)
+    {
+        qsrand(42);
+    }
+
+    xcb_window_t randomWindow()
+    {
+        // Some events are about windows the compositor doesn't track
+        return qrand() % 8 ? windows_.at(qrand() % windows_.size()) : xcb_window_t(qrand());
+    }
+
+    // ConfigureNotify is selected both on the root (restacking) and on the window (geometry)
+    Event configure(bool onRoot)
+    {
+        xcb_configure_notify_event_t e;
+        std::memset(&e, 0, sizeof(e));
+        e.response_type = XCB_CONFIGURE_NOTIFY;
+        e.window = randomWindow();
+        e.event = onRoot ? Root : e.window;
+        e.above_sibling = windows_.at(qrand() % windows_.size());
+        e.x = qrand() % 1000;
+        e.y = qrand() % 1000;
+        e.width = 640;
+        e.height = 480;
+        return pun(e);
+    }
+
+    Event map(bool mapped)
+    {
+        xcb_map_notify_event_t e;
+        std::memset(&e, 0, sizeof(e));
+        e.response_type = mapped ? XCB_MAP_NOTIFY : XCB_UNMAP_NOTIFY;
+        e.window = randomWindow();
+        e.event = Root;
+        return pun(e);
+    }
+
+    // WM_NAME and the like: not interesting to the compositor, and by far the most common
+    Event property()
+    {
+        xcb_property_notify_event_t e;
+        std::memset(&e, 0, sizeof(e));
+        e.response_type = XCB_PROPERTY_NOTIFY;
+        e.window = randomWindow();
+        e.atom = XCB_ATOM_WM_NAME;
+        return pun(e);
+    }
+
+    // Small rectangles, like text being typed or a cursor blinking
+    Event damage()
+    {
+        xcb_damage_notify_event_t e;
+        std::memset(&e, 0, sizeof(e));
+        e.response_type = DamageNotify;
+        e.level = XCB_DAMAGE_REPORT_LEVEL_DELTA_RECTANGLES;
+        auto window = randomWindow();
+        e.drawable = window + 1;
+        e.damage = window + 2;
+        e.area.x = qrand() % 600;
+        e.area.y = qrand() % 440;
+        e.area.width = 8 + qrand() % 32;
+        e.area.height = 16;
+        return pun(e);
+    }
+
+    Event mixed()
+    {
+        auto kind = qrand() % 100;
+        if (kind < 70) {
+            return damage();
+        } else if (kind < 80) {
+            return property();
+        } else if (kind < 95) {
+            return configure(kind % 2);
+        }
+        return map(kind % 2);
+    }
+
+private:
+    template<typename T>
+    static Event pun(const T &e)
+    {
+        Event result;
+        std::memcpy(&result, &e, sizeof(result));
+        return result;
+    }
+
+    QVector<xcb_window_t> windows_;
+};
+
+class DispatchBenchmark : public QObject
+{
+    Q_OBJECT
+
+    enum EventKind { Configure, Map, Property, Damage, Mixed };
+
+private Q_SLOTS:
+    void initTestCase()
+    {
+        // Error connection: requests are dropped, replies never come. Nothing here waits for one.
+        std::memset(&ewmh_, 0, sizeof(ewmh_));
+        ewmh_.connection = xcb_connect_to_fd(-1, Q_NULLPTR);
+        QVERIFY(xcb_connection_has_error(ewmh_.connection));
+        std::memset(&atoms_, 0, sizeof(atoms_));
+    }
+
+    void cleanupTestCase()
+    {
+        xcb_disconnect(ewmh_.connection);
+    }
+
+    void benchmarkDispatch_data()
+    {
+        QTest::addColumn<int>("kind");
+        QTest::addColumn<int>("windowCount");
+
+        for (int count : {10, 100, 1000}) {
+            auto suffix = QStringLiteral(", %1 windows").arg(count);
+            QTest::newRow(qPrintable(QStringLiteral("configure") + suffix)) << int(Configure) << count;
+            QTest::newRow(qPrintable(QStringLiteral("map/unmap") + suffix)) << int(Map) << count;
+            QTest::newRow(qPrintable(QStringLiteral("property") + suffix)) << int(Property) << count;
+            QTest::newRow(qPrintable(QStringLiteral("damage") + suffix)) << int(Damage) << count;
+            QTest::newRow(qPrintable(QStringLiteral("mixed") + suffix)) << int(Mixed) << count;
+        }
+    }
+
+    void benchmarkDispatch()
+    {
+        QFETCH(int, kind);
+        QFETCH(int, windowCount);
+
+        // Every window has its pixmap, with IDs allocated right after the window's
+        ReplayRegistry registry(&ewmh_, atoms_, Root, DamageNotify);
+        QVector<xcb_window_t> windows;
+        for (int i = 0; i < windowCount; i++) {
+            auto window = windowId(i);
+            windows.append(window);
+            registry.addWindow(window, QRect(0, 0, 640, 480), true);
+            registry.addPixmap(window, window + 1, window + 2);
+        }
+        EventGenerator generator(windows);
+
+        // One frame worth of events: damage is cleared after each batch
+        QVector<Event> events;
+        for (int i = 0; i < BatchSize; i++) {
+            switch (kind) {
+            case Configure:
+                events.append(generator.configure(i % 2));
+                break;
+            case Map:
+                events.append(generator.map(i % 2));
+                break;
+            case Property:
+                events.append(generator.property());
+                break;
+            case Damage:
+                events.append(generator.damage());
+                break;
+            default:
+                events.append(generator.mixed());
+                break;
+            }
+        }
+
+        auto dispatchBatch = [&]() {
+            int consumed = 0;
+            for (const auto &e : events) {
+                consumed += registry.dispatch(&e);
+            }
+            registry.clearDamage();
+            return consumed;
+        };
+
+        // Warm up: first-time allocations (QRegion data, signal connection lists) aren't per event
+        dispatchBatch();
+
+        QElapsedTimer timer;
+        auto allocationsBefore = allocations.load();
+        timer.start();
+        int batches = 0;
+        while (timer.elapsed() < 200) {
+            dispatchBatch();
+            batches++;
+        }
+        auto nsecs = timer.nsecsElapsed();
+        auto eventCount = qint64(batches) * BatchSize;
+        qDebug() << "events/s:" << qRound64(eventCount * 1e9 / nsecs)
+                 << "allocations/event:" << double(allocations.load() - allocationsBefore) / eventCount;
+
+        QBENCHMARK {
+            dispatchBatch();
+        }
+    }
+
+private:
+    static const int BatchSize = 1024;
+
+    xcb_ewmh_connection_t ewmh_;
+    ClientWindow::Atoms atoms_;
+};
+
+QTEST_GUILESS_MAIN(DispatchBenchmark)
+
+#include "bench_dispatch.moc"
@@ -0,0 +1,335 @@
+// Runs the compositor on Xvfb with software GL (or XRender) against synthclient and
+// reports frame times, X event throughput, CPU time and memory as JSON. With --thresholds,
+// exits with 1 if a result is outside its bounds, so CTest can catch regressions.
+
+#include <QCommandLineParser>
+#include <QElapsedTimer>
+#include <QEventLoop>
+#include <QFile>
+#include <QGuiApplication>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QQmlContext>
+#include <QQuickView>
+#include <QTimer>
+
+#include <cstdio>
+
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include "xvfb.h"
+#include "compositor.h"
+#include "windowpixmap.h"
+#include "windowpixmapitem.h"
+#include "windowtexture.h"
+#include "glxtexturefrompixmap.h"
+#include "shmtexture.h"
+#include "xrendercompositor.h"
+#include "framescheduler.h"
+#include "latencyhistogram.h"
+#include "eventlatencyprobe.h"
+#include "windowshadowitem.h"
+
+// Results are collected after the scene has settled: windows mapped, textures bound
+static const int WarmupSeconds = 2;
+
+static void wait(int msecs)
+{
+    QEventLoop loop;
+    QTimer::singleShot(msecs, &loop, SLOT(quit()));
+    loop.exec();
+}
+
+static qint64 cpuNsecs()
+{
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return (qint64(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000 +
+            usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) * 1000;
+}
+
+// utime + stime of another process, from /proc/<pid>/stat
+static qint64 processCpuNsecs(qint64 pid)
+{
+    QFile stat(QStringLiteral("/proc/%1/stat").arg(pid));
+    if (!stat.open(QIODevice::ReadOnly)) {
+        return 0;
+    }
+    // The command name may contain spaces, fields are counted after its closing parenthesis
+    auto line = stat.readAll();
+    auto fields = line.mid(line.lastIndexOf(')') + 2).split(' ');
+    if (fields.size() < 13) {
+        return 0;
+    }
+    auto ticks = fields.at(11).toLongLong() + fields.at(12).toLongLong();
+    return ticks * 1000000000 / sysconf(_SC_CLK_TCK);
+}
+
+// VmRSS or VmHWM of this process, in KiB
+static qint64 memoryKiB(const QByteArray &field)
+{
+    QFile status(QStringLiteral("/proc/self/status"));
+    if (!status.open(QIODevice::ReadOnly)) {
+        return 0;
+    }
+    Q_FOREVER {
+        auto line = status.readLine();
+        if (line.isEmpty()) {
+            return 0;
+        }
+        if (line.startsWith(field + ':')) {
+            return line.mid(field.size() + 1).trimmed().split(' ').first().toLongLong();
+        }
+    }
+}
+
+// Frame statistics of the compositor window (render thread) or of XRenderCompositor
+class FrameRecorder : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit FrameRecorder(QQuickWindow *window)
+    {
+        connect(window, SIGNAL(beforeSynchronizing()), SLOT(beforeSynchronizing()), Qt::DirectConnection);
+        connect(window, SIGNAL(frameSwapped()), SLOT(frameSwapped()), Qt::DirectConnection);
+    }
+
+    explicit FrameRecorder(XRenderCompositor *renderer)
+    {
+        connect(renderer, SIGNAL(frameStarted()), SLOT(beforeSynchronizing()));
+        connect(renderer, SIGNAL(frameFinished()), SLOT(frameSwapped()));
+    }
+
+    void reset()
+    {
+        frameTimes.reset();
+        frameIntervals.reset();
+    }
+
+    LatencyHistogram frameTimes;
+    LatencyHistogram frameIntervals;
+
+private Q_SLOTS:
+    void beforeSynchronizing()
+    {
+        frameTimer_.start();
+    }
+
+    void frameSwapped()
+    {
+        if (frameTimer_.isValid()) {
+            frameTimes.record(frameTimer_.nsecsElapsed());
+        }
+        if (lastSwap_.isValid()) {
+            frameIntervals.record(lastSwap_.nsecsElapsed());
+        }
+        lastSwap_.start();
+    }
+
+private:
+    // Render thread only
+    QElapsedTimer frameTimer_;
+    QElapsedTimer lastSwap_;
+};
+
+// Checks results against {"<pattern>": {"<result>": {"min": x, "max": y}}}
+static bool checkThresholds(const QJsonObject &results, const QString &fileName)
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly)) {
+        qCritical() << "Can't open thresholds file" << fileName;
+        return false;
+    }
+    auto thresholds = QJsonDocument::fromJson(file.readAll()).object()
+            .value(results.value(QStringLiteral("pattern")).toString()).toObject();
+
+    bool ok = true;
+    for (auto i = thresholds.constBegin(); i != thresholds.constEnd(); ++i) {
+        auto bounds = i.value().toObject();
+        auto value = results.value(i.key()).toDouble();
+        if (bounds.contains(QStringLiteral("max")) && value > bounds.value(QStringLiteral("max")).toDouble()) {
+            qCritical() << i.key() << value << "is above" << bounds.value(QStringLiteral("max")).toDouble();
+            ok = false;
+        }
+        if (bounds.contains(QStringLiteral("min")) && value < bounds.value(QStringLiteral("min")).toDouble()) {
+            qCritical() << i.key() << value << "is below" << bounds.value(QStringLiteral("min")).toDouble();
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+int main(int argc, char *argv[])
+{
+    QStringList arguments;
+    for (int i = 0; i < argc; i++) {
+        arguments.append(QString::fromLocal8Bit(argv[i]));
+    }
+
+    // Parsed before QGuiApplication, which needs the X server to be running
+    QCommandLineParser parser;
+    QCommandLineOption patternOption(QStringLiteral("pattern"), QStringLiteral("video, cursor, resize or popup"),
+                                     QStringLiteral("pattern"), QStringLiteral("video"));
+    QCommandLineOption windowsOption(QStringLiteral("windows"), QStringLiteral("Number of client windows"),
+                                     QStringLiteral("count"), QStringLiteral("10"));
+    QCommandLineOption secondsOption(QStringLiteral("seconds"), QStringLiteral("Measurement time"),
+                                     QStringLiteral("seconds"), QStringLiteral("5"));
+    QCommandLineOption backendOption(QStringLiteral("backend"), QStringLiteral("Compositing: gl or xrender"),
+                                     QStringLiteral("backend"), QStringLiteral("gl"));
+    QCommandLineOption connectionOption(QStringLiteral("render-connection"),
+                                        QStringLiteral("X connection of the render thread: separate or shared"),
+                                        QStringLiteral("connection"), QStringLiteral("separate"));
+    QCommandLineOption textureOption(QStringLiteral("texture"), QStringLiteral("Window textures: auto, tfp or shm"),
+                                     QStringLiteral("backend"), QStringLiteral("auto"));
+    QCommandLineOption shadowOption(QStringLiteral("shadow"), QStringLiteral("Window shadows: none, glow or native"),
+                                    QStringLiteral("shadow"), QStringLiteral("none"));
+    QCommandLineOption dimOption(QStringLiteral("dim"), QStringLiteral("Dim all windows: none, effect or material"),
+                                 QStringLiteral("dim"), QStringLiteral("none"));
+    QCommandLineOption outputOption(QStringLiteral("output"), QStringLiteral("Write JSON results to file"),
+                                    QStringLiteral("file"));
+    QCommandLineOption thresholdsOption(QStringLiteral("thresholds"), QStringLiteral("Fail if results exceed thresholds"),
+                                        QStringLiteral("file"));
+    parser.addOptions({ patternOption, windowsOption, secondsOption, backendOption, connectionOption, textureOption, shadowOption, dimOption, outputOption, thresholdsOption });
+    parser.parse(arguments);
+
+    auto pattern = parser.value(patternOption);
+    auto windows = parser.value(windowsOption).toInt();
+    auto seconds = parser.value(secondsOption).toInt();
+    auto backend = parser.value(backendOption);
+    auto renderConnection = parser.value(connectionOption);
+    auto texture = parser.value(textureOption);
+    auto shadow = parser.value(shadowOption);
+    auto dim = parser.value(dimOption);
+    if (texture == QLatin1String("tfp")) {
+        WindowTexture::setBackend(WindowTexture::TextureFromPixmap);
+    } else if (texture == QLatin1String("shm")) {
+        WindowTexture::setBackend(WindowTexture::SharedMemory);
+    }
+
+    Xvfb xvfb;
+    if (xvfb.display().isEmpty()) {
+        qCritical() << "Can't start Xvfb";
+        return 1;
+    }
+    QGuiApplication app(argc, argv);
+
+    WindowPixmapItem::registerQmlTypes();
+    Compositor compositor;
+    compositor.setSeparateRenderConnection(renderConnection != QLatin1String("shared"));
+    EventLatencyProbe probe;
+
+    // Either the QML scene rendered with GL, or XRender drawing on the overlay window
+    QScopedPointer<QQuickView> view;
+    QScopedPointer<FrameScheduler> scheduler;
+    QScopedPointer<XRenderCompositor> renderer;
+    QScopedPointer<FrameRecorder> recorder;
+    QWindow selectionOwner;
+    if (backend == QLatin1String("xrender")) {
+        renderer.reset(new XRenderCompositor(&compositor));
+        recorder.reset(new FrameRecorder(renderer.data()));
+        selectionOwner.create();
+        compositor.registerCompositor(&selectionOwner);
+    } else {
+        view.reset(new QQuickView);
+        scheduler.reset(new FrameScheduler(view.data()));
+        recorder.reset(new FrameRecorder(view.data()));
+        compositor.registerCompositor(view.data());
+        view->rootContext()->setContextProperty(QStringLiteral("compositor"), &compositor);
+        view->rootContext()->setContextProperty(QStringLiteral("shadow"), shadow);
+        view->rootContext()->setContextProperty(QStringLiteral("dim"), dim);
+        view->setParent(compositor.overlayWindow());
+        view->setSource(QUrl::fromLocalFile(QStringLiteral(SCENE_QML_PATH)));
+        view->setGeometry(compositor.rootGeometry());
+        view->show();
+    }
+    auto frameCount = [&]() {
+        return renderer ? renderer->frames() : scheduler->frames();
+    };
+
+    QProcess client;
+    client.setProcessChannelMode(QProcess::ForwardedChannels);
+    client.start(QStringLiteral(SYNTHCLIENT_PATH),
+                 { pattern, QString::number(windows), QString::number(WarmupSeconds + seconds) });
+    if (!client.waitForStarted()) {
+        qCritical() << "Can't start" << SYNTHCLIENT_PATH;
+        return 1;
+    }
+    wait(WarmupSeconds * 1000);
+
+    recorder->reset();
+    probe.latency().reset();
+    compositor.resetRenderFlushTimes();
+    auto frames = frameCount();
+    auto xEvents = compositor.xEvents();
+    auto damageFlushes = WindowPixmap::acknowledgementFlushes();
+    auto rebinds = GLXTextureFromPixmap::rebinds();
+    auto uploadedBytes = ShmTexture::uploadedBytes();
+    auto cpu = cpuNsecs();
+    auto serverCpu = processCpuNsecs(xvfb.processId());
+    QElapsedTimer elapsed;
+    elapsed.start();
+
+    wait(seconds * 1000);
+
+    auto nsecs = elapsed.nsecsElapsed();
+    frames = frameCount() - frames;
+    xEvents = compositor.xEvents() - xEvents;
+    damageFlushes = WindowPixmap::acknowledgementFlushes() - damageFlushes;
+    rebinds = GLXTextureFromPixmap::rebinds() - rebinds;
+    uploadedBytes = ShmTexture::uploadedBytes() - uploadedBytes;
+    cpu = cpuNsecs() - cpu;
+    serverCpu = processCpuNsecs(xvfb.processId()) - serverCpu;
+
+    QJsonObject results;
+    results.insert(QStringLiteral("pattern"), pattern);
+    results.insert(QStringLiteral("windows"), windows);
+    results.insert(QStringLiteral("backend"), backend);
+    results.insert(QStringLiteral("renderConnection"), renderConnection);
+    results.insert(QStringLiteral("texture"), texture);
+    results.insert(QStringLiteral("shadow"), shadow);
+    results.insert(QStringLiteral("dim"), dim);
+    results.insert(QStringLiteral("seconds"), seconds);
+    results.insert(QStringLiteral("frames"), double(frames));
+    results.insert(QStringLiteral("fps"), frames * 1e9 / nsecs);
+    results.insert(QStringLiteral("frameTimeP50Ms"), recorder->frameTimes.percentile(50));
+    results.insert(QStringLiteral("frameTimeP90Ms"), recorder->frameTimes.percentile(90));
+    results.insert(QStringLiteral("frameTimeP99Ms"), recorder->frameTimes.percentile(99));
+    results.insert(QStringLiteral("frameIntervalP50Ms"), recorder->frameIntervals.percentile(50));
+    results.insert(QStringLiteral("frameIntervalP99Ms"), recorder->frameIntervals.percentile(99));
+    results.insert(QStringLiteral("damageFlushesPerFrame"), frames ? double(damageFlushes) / frames : 0.0);
+    results.insert(QStringLiteral("xEventsPerSecond"), xEvents * 1e9 / nsecs);
+    results.insert(QStringLiteral("eventLatencyP50Ms"), probe.latency().percentile(50));
+    results.insert(QStringLiteral("eventLatencyP99Ms"), probe.latency().percentile(99));
+    results.insert(QStringLiteral("renderFlushUsPerFrame"),
+                   frames ? compositor.renderFlushNsecs() / 1e3 / frames : 0.0);
+    results.insert(QStringLiteral("renderFlushMaxUs"), compositor.renderFlushMaxNsecs() / 1e3);
+    results.insert(QStringLiteral("tfpRebindsPerSecond"), rebinds * 1e9 / nsecs);
+    results.insert(QStringLiteral("shmUploadMiBPerSecond"), uploadedBytes * 1e9 / nsecs / (1 << 20));
+    results.insert(QStringLiteral("shadowTextureKiB"), WindowShadowItem::textureBytes() / 1024.0);
+    results.insert(QStringLiteral("cpuMs"), cpu / 1e6);
+    results.insert(QStringLiteral("cpuPercent"), cpu * 100.0 / nsecs);
+    results.insert(QStringLiteral("serverCpuPercent"), serverCpu * 100.0 / nsecs);
+    results.insert(QStringLiteral("rssKiB"), double(memoryKiB("VmRSS")));
+    results.insert(QStringLiteral("peakRssKiB"), double(memoryKiB("VmHWM")));
+
+    client.waitForFinished();
+
+    auto json = QJsonDocument(results).toJson();
+    std::fputs(json.constData(), stdout);
+    if (parser.isSet(outputOption)) {
+        QFile output(parser.value(outputOption));
+        if (!output.open(QIODevice::WriteOnly) || output.write(json) != json.size()) {
+            qCritical() << "Can't write" << output.fileName();
+            return 1;
+        }
+    }
+
+    if (parser.isSet(thresholdsOption) && !checkThresholds(results, parser.value(thresholdsOption))) {
+        return 1;
+    }
+    return 0;
+}
+
+#include "headless_bench.moc"
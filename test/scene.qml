@@ -0,0 +1,55 @@
+import QtQuick 2.4
+import Compositor 1.0
+
+// Bare scene for benchmarks: every client window drawn as is, with the shadow picked by the
+// "shadow" context property (none, glow or native) behind it. The "dim" context property
+// dims all windows by half with a BrightnessContrast effect, with the brightness of the
+// WindowPixmap item's material, or not at all (effect, material or none).
+Item {
+    id: root
+
+    Component {
+        id: windowComponent
+        Item {
+            id: windowRoot
+            property var clientWindow
+
+            x: clientWindow.geometry.x
+            y: clientWindow.geometry.y
+            z: clientWindow.zIndex
+            width: windowPixmap.implicitWidth
+            height: windowPixmap.implicitHeight
+            visible: clientWindow.mapped
+
+            // Same extent as the shadow in main.qml, radius 10
+            Loader {
+                anchors.fill: parent
+                anchors.leftMargin: -2.5
+                anchors.topMargin: -2.5
+                anchors.rightMargin: -10
+                anchors.bottomMargin: -10
+                source: shadow === "glow" ? "GlowShadow.qml" : shadow === "native" ? "NativeShadow.qml" : ""
+            }
+
+            WindowPixmap {
+                id: windowPixmap
+                clientWindow: windowRoot.clientWindow
+                brightness: dim === "material" ? -0.5 : 0
+                visible: dim !== "effect"
+            }
+
+            Loader {
+                anchors.fill: windowPixmap
+                source: dim === "effect" ? "DimEffect.qml" : ""
+                onLoaded: item.source = windowPixmap
+            }
+        }
+    }
+
+    Connections {
+        target: compositor
+        onWindowCreated: {
+            windowComponent.createObject(root, { clientWindow: clientWindow })
+        }
+    }
+}
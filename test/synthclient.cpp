@@ -0,0 +1,171 @@
+// Synthetic X client for headless_bench: creates a number of windows and damages
+// them in one of a few patterns typical for desktop sessions. Plain xcb, so its
+// own overhead doesn't depend on a toolkit.
+//
+//   synthclient <pattern> [windows] [seconds]
+//
+// Patterns:
+//   video   - one full-screen window repainted at 60 Hz on top of the others
+//   cursor  - a 2x16 cursor blinking at 2 Hz in every window
+//   resize  - every window resized at 60 Hz, like an interactive resize
+//   popup   - an override-redirect popup created, mapped and destroyed at 30 Hz
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <vector>
+
+#include <xcb/xcb.h>
+
+static const long FrameNsecs = 1000000000L / 60;
+
+static long nowNsecs()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+static void sleepUntil(long deadline)
+{
+    timespec ts;
+    ts.tv_sec = deadline / 1000000000L;
+    ts.tv_nsec = deadline % 1000000000L;
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr);
+}
+
+class Client
+{
+public:
+    Client()
+        : connection_(xcb_connect(nullptr, nullptr))
+    {
+        if (xcb_connection_has_error(connection_)) {
+            std::fprintf(stderr, "synthclient: can't connect to the X server\n");
+            std::exit(1);
+        }
+        screen_ = xcb_setup_roots_iterator(xcb_get_setup(connection_)).data;
+        gc_ = xcb_generate_id(connection_);
+        xcb_create_gc(connection_, gc_, screen_->root, 0, nullptr);
+    }
+
+    ~Client()
+    {
+        xcb_disconnect(connection_);
+    }
+
+    int width() const
+    {
+        return screen_->width_in_pixels;
+    }
+
+    int height() const
+    {
+        return screen_->height_in_pixels;
+    }
+
+    xcb_window_t createWindow(int x, int y, int w, int h, bool overrideRedirect = false)
+    {
+        auto window = xcb_generate_id(connection_);
+        uint32_t values[] = { screen_->white_pixel, overrideRedirect };
+        xcb_create_window(connection_, XCB_COPY_FROM_PARENT, window, screen_->root, x, y, w, h, 0,
+                          XCB_WINDOW_CLASS_INPUT_OUTPUT, XCB_COPY_FROM_PARENT,
+                          XCB_CW_BACK_PIXEL | XCB_CW_OVERRIDE_REDIRECT, values);
+        xcb_map_window(connection_, window);
+        return window;
+    }
+
+    void destroyWindow(xcb_window_t window)
+    {
+        xcb_destroy_window(connection_, window);
+    }
+
+    void fill(xcb_window_t window, uint32_t color, int x, int y, int w, int h)
+    {
+        xcb_change_gc(connection_, gc_, XCB_GC_FOREGROUND, &color);
+        xcb_rectangle_t rect = { int16_t(x), int16_t(y), uint16_t(w), uint16_t(h) };
+        xcb_poly_fill_rectangle(connection_, window, gc_, 1, &rect);
+    }
+
+    void resize(xcb_window_t window, int w, int h)
+    {
+        uint32_t values[] = { uint32_t(w), uint32_t(h) };
+        xcb_configure_window(connection_, window, XCB_CONFIG_WINDOW_WIDTH | XCB_CONFIG_WINDOW_HEIGHT, values);
+    }
+
+    // Round trip, so requests of one frame don't pile up in the server
+    void sync()
+    {
+        std::free(xcb_get_input_focus_reply(connection_, xcb_get_input_focus(connection_), nullptr));
+    }
+
+private:
+    xcb_connection_t *connection_;
+    xcb_screen_t *screen_;
+    xcb_gcontext_t gc_;
+};
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2) {
+        std::fprintf(stderr, "usage: %s video|cursor|resize|popup [windows] [seconds]\n", argv[0]);
+        return 2;
+    }
+    const char *pattern = argv[1];
+    int windowCount = argc > 2 ? std::atoi(argv[2]) : 10;
+    int seconds = argc > 3 ? std::atoi(argv[3]) : 10;
+
+    Client client;
+
+    // Cascaded background windows, a quarter of the screen each
+    std::vector<xcb_window_t> windows;
+    int w = client.width() / 2, h = client.height() / 2;
+    for (int i = 0; i < windowCount; i++) {
+        int x = (i * 32) % (client.width() - w), y = (i * 24) % (client.height() - h);
+        windows.push_back(client.createWindow(x, y, w, h));
+    }
+    xcb_window_t video = XCB_NONE;
+    if (!std::strcmp(pattern, "video")) {
+        video = client.createWindow(0, 0, client.width(), client.height());
+    }
+    client.sync();
+
+    auto start = nowNsecs();
+    auto end = start + seconds * 1000000000L;
+    long frame = 0;
+    xcb_window_t popup = XCB_NONE;
+    for (auto next = start; next < end; next += FrameNsecs, frame++) {
+        sleepUntil(next);
+
+        if (video != XCB_NONE) {
+            client.fill(video, frame % 2 ? 0x202020 : 0x404040, 0, 0, client.width(), client.height());
+        } else if (!std::strcmp(pattern, "cursor")) {
+            if (frame % 15 == 0) {
+                auto color = frame % 30 ? 0xffffff : 0x000000;
+                for (auto window : windows) {
+                    client.fill(window, color, 16, 16, 2, 16);
+                }
+            }
+        } else if (!std::strcmp(pattern, "resize")) {
+            int step = frame % 60;
+            int delta = step < 30 ? step : 60 - step;
+            for (auto window : windows) {
+                client.resize(window, w + delta * 8, h + delta * 6);
+            }
+        } else if (!std::strcmp(pattern, "popup")) {
+            if (frame % 2 == 0) {
+                if (popup != XCB_NONE) {
+                    client.destroyWindow(popup);
+                }
+                popup = client.createWindow(frame % client.width() / 2, 100, 200, 300, true);
+                client.fill(popup, 0xe0e0e0, 0, 0, 200, 300);
+            }
+        } else {
+            std::fprintf(stderr, "synthclient: unknown pattern %s\n", pattern);
+            return 2;
+        }
+        client.sync();
+    }
+    return 0;
+}
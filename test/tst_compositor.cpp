@@ -1,11 +1,24 @@
 #include <QtTest>
 #include <QX11Info>
 #include <QRasterWindow>
+#include <QQuickWindow>
+
+#include <algorithm>
+#include <cstring>
 
 #include "xephyr.h"
+#include "waitforwindow.h"
 #include "compositor.h"
 #include "clientwindow.h"
 #include "windowpixmap.h"
+#include "xidmap.h"
+#include "occlusiontable.h"
+#include "eventrecording.h"
+#include "framescheduler.h"
+#include "replayregistry.h"
+#include "xcbasyncreplies.h"
+#include "windowshadowitem.h"
+#include "xrendercompositor.h"
 
 #define VERIFY_SINGLE_SIGNAL(spy, value) \
     (spy).clear(); \
@@ -20,12 +33,15 @@
 struct EwmhConnection
 {
     xcb_ewmh_connection_t connection;
+    ClientWindow::Atoms atoms;
 
     EwmhConnection()
     {
+        auto atomCookies = ClientWindow::internAtoms(QX11Info::connection());
         xcb_ewmh_init_atoms_replies(&connection,
                                     xcb_ewmh_init_atoms(QX11Info::connection(), &connection),
                                     Q_NULLPTR);
+        atoms = ClientWindow::internAtomsReplies(QX11Info::connection(), atomCookies);
     }
 
     ~EwmhConnection()
@@ -37,25 +53,6 @@ struct EwmhConnection
 class CompositorTest : public QObject
 {
     Q_OBJECT
-private:
-    QSharedPointer<ClientWindow> getWindowCreated(Compositor &c)
-    {
-        QSignalSpy windowCreatedSignalSpy(&c, SIGNAL(windowCreated(ClientWindow*)));
-        if (!QTest::qVerify(windowCreatedSignalSpy.wait(1000),
-                            "windowCreatedSignalSpy.wait(1000)",
-                            "", __FILE__, __LINE__))
-        {
-            return QSharedPointer<ClientWindow>();
-        }
-        if (!QTest::qCompare(windowCreatedSignalSpy.count(), 1,
-                             "windowCreatedSignalSpy.count()", "1",
-                             __FILE__, __LINE__))
-        {
-            return QSharedPointer<ClientWindow>();
-        }
-        return windowCreatedSignalSpy.first().first().value<ClientWindow *>()->sharedFromThis();
-    }
-
 private Q_SLOTS:
     void testWindowCtor()
     {
@@ -63,7 +60,7 @@ private Q_SLOTS:
         QWindow window;
         window.setGeometry(0, 0, 300, 300);
 
-        ClientWindow xcbWindow(&ewmh.connection, window.winId());
+        ClientWindow xcbWindow(&ewmh.connection, ewmh.atoms, window.winId());
         QVERIFY(xcbWindow.isValid());
         QCOMPARE(xcbWindow.geometry(), window.geometry());
     }
@@ -76,10 +73,33 @@ private Q_SLOTS:
         auto id = window.winId();
         window.destroy();
 
-        ClientWindow xcbWindow(&ewmh.connection, id);
+        ClientWindow xcbWindow(&ewmh.connection, ewmh.atoms, id);
         QVERIFY(!xcbWindow.isValid());
     }
 
+    void testWindowBatchCtor()
+    {
+        EwmhConnection ewmh;
+        QWindow window1;
+        window1.setGeometry(0, 0, 300, 300);
+        QWindow window2;
+        window2.setGeometry(10, 10, 200, 200);
+        QWindow window3;
+        window3.create();
+        auto goneId = window3.winId();
+        window3.destroy();
+
+        QVector<xcb_window_t> ids;
+        ids << window1.winId() << goneId << window2.winId();
+        auto windows = ClientWindow::create(&ewmh.connection, ewmh.atoms, ids);
+        QCOMPARE(windows.size(), 3);
+        QVERIFY(windows[0]->isValid());
+        QCOMPARE(windows[0]->geometry(), window1.geometry());
+        QVERIFY(!windows[1]->isValid());
+        QVERIFY(windows[2]->isValid());
+        QCOMPARE(windows[2]->geometry(), window2.geometry());
+    }
+
     void testWindowCreate()
     {
         Compositor comp;
@@ -93,6 +113,18 @@ private Q_SLOTS:
         QCOMPARE(spy.count(), 1);
     }
 
+    void testXEventsCounter()
+    {
+        Compositor comp;
+        QCoreApplication::processEvents();
+        auto before = comp.xEvents();
+
+        QWindow w;
+        w.create();
+        QVERIFY(getWindowCreated(comp));
+        QVERIFY(comp.xEvents() > before);
+    }
+
     void testWindowGeometryChanges()
     {
         Compositor comp;
@@ -154,6 +186,385 @@ private Q_SLOTS:
         QVERIFY(!w->isValid());
     }
 
+    void testXidMap()
+    {
+        XidMap<int> map;
+        QMap<xcb_window_t, int> reference;
+        qsrand(1);
+        for (int i = 0; i < 100000; i++) {
+            xcb_window_t key = 0x200000 + qrand() % 1000;
+            switch (qrand() % 3) {
+            case 0:
+                map.insert(key, i);
+                reference.insert(key, i);
+                break;
+            case 1:
+                QCOMPARE(map.remove(key), reference.remove(key) > 0);
+                break;
+            default:
+                QCOMPARE(map.contains(key), reference.contains(key));
+                QCOMPARE(map.value(key, -1), reference.value(key, -1));
+            }
+            QCOMPARE(map.size(), reference.size());
+        }
+
+        int count = 0;
+        for (auto i = map.constBegin(); i != map.constEnd(); ++i) {
+            QCOMPARE(i.value(), reference.value(i.key()));
+            count++;
+        }
+        QCOMPARE(count, reference.size());
+    }
+
+    void testEventRecording()
+    {
+        QTemporaryFile file;
+        QVERIFY(file.open());
+
+        xcb_configure_notify_event_t configure;
+        std::memset(&configure, 0, sizeof(configure));
+        configure.response_type = XCB_CONFIGURE_NOTIFY;
+        configure.event = 0x100;
+        configure.window = 0x200001;
+        configure.width = 300;
+        {
+            EventRecorder recorder(file.fileName());
+            QVERIFY(recorder.isOpen());
+            recorder.begin(0x100, QSize(640, 480), 91,
+                           { { 0x200001, QRect(0, 0, 100, 100), true, false } });
+            recorder.recordPixmapNamed(0x200001, 0x400001, 0x400002);
+            recorder.recordEvent(reinterpret_cast<xcb_generic_event_t *>(&configure));
+            recorder.recordPixmapRemoved(0x400002);
+            QCOMPARE(recorder.records(), qint64(3));
+        }
+
+        EventRecording recording(file.fileName());
+        QVERIFY(recording.isValid());
+        QCOMPARE(recording.root(), xcb_window_t(0x100));
+        QCOMPARE(recording.rootSize(), QSize(640, 480));
+        QCOMPARE(int(recording.damageNotify()), 91);
+        QCOMPARE(recording.windows().size(), 1);
+        QCOMPARE(recording.windows().first().geometry, QRect(0, 0, 100, 100));
+        QVERIFY(recording.windows().first().mapped);
+
+        EventRecord::Record record;
+        QVERIFY(recording.next(&record));
+        QCOMPARE(record.type, EventRecord::PixmapNamed);
+        QCOMPARE(record.damage, xcb_damage_damage_t(0x400002));
+        QVERIFY(recording.next(&record));
+        QCOMPARE(record.type, EventRecord::Event);
+        QCOMPARE(record.event.size(), int(sizeof(configure)));
+        QVERIFY(!std::memcmp(record.event.constData(), &configure, sizeof(configure)));
+        QVERIFY(recording.next(&record));
+        QCOMPARE(record.type, EventRecord::PixmapRemoved);
+        QVERIFY(!recording.next(&record));
+    }
+
+    void testReplayMatchesCompositor()
+    {
+        Compositor comp;
+        QCoreApplication::processEvents();
+        QHash<xcb_window_t, QSharedPointer<ClientWindow> > live;
+        connect(&comp, &Compositor::windowCreated, [&live](ClientWindow *w) {
+            live.insert(w->window(), w->sharedFromThis());
+        });
+
+        QTemporaryFile file;
+        QVERIFY(file.open());
+        auto connection = QX11Info::connection();
+        auto root = QX11Info::appRootWindow();
+        QVector<xcb_window_t> windows;
+        {
+            EventRecorder recorder(file.fileName());
+            QVERIFY(recorder.isOpen());
+            comp.setEventRecorder(&recorder);
+
+            // Everything both handle: creation, mapping, geometry, restacking, destruction
+            for (int i = 0; i < 4; i++) {
+                auto window = xcb_generate_id(connection);
+                xcb_create_window(connection, XCB_COPY_FROM_PARENT, window, root, 10 * i, 10 * i, 100, 100, 0,
+                                  XCB_WINDOW_CLASS_INPUT_OUTPUT, XCB_COPY_FROM_PARENT, 0, Q_NULLPTR);
+                xcb_map_window(connection, window);
+                windows.append(window);
+            }
+            const uint32_t geometry[] = { 200, 150, 300, 200 };
+            xcb_configure_window(connection, windows[0], XCB_CONFIG_WINDOW_X | XCB_CONFIG_WINDOW_Y |
+                                 XCB_CONFIG_WINDOW_WIDTH | XCB_CONFIG_WINDOW_HEIGHT, geometry);
+            const uint32_t top[] = { XCB_STACK_MODE_ABOVE };
+            xcb_configure_window(connection, windows[0], XCB_CONFIG_WINDOW_STACK_MODE, top);
+            const uint32_t bottom[] = { XCB_STACK_MODE_BELOW };
+            xcb_configure_window(connection, windows[2], XCB_CONFIG_WINDOW_STACK_MODE, bottom);
+            const uint32_t aboveSibling[] = { windows[3], XCB_STACK_MODE_ABOVE };
+            xcb_configure_window(connection, windows[2],
+                                 XCB_CONFIG_WINDOW_SIBLING | XCB_CONFIG_WINDOW_STACK_MODE, aboveSibling);
+            xcb_unmap_window(connection, windows[2]);
+            xcb_destroy_window(connection, windows[3]);
+            std::free(xcb_get_input_focus_reply(connection, xcb_get_input_focus(connection), Q_NULLPTR));
+            QTRY_VERIFY(live.value(windows[3]) && !live.value(windows[3])->isValid());
+            QTest::qWait(200);
+            comp.setEventRecorder(Q_NULLPTR);
+        }
+
+        EventRecording recording(file.fileName());
+        QVERIFY(recording.isValid());
+        EwmhConnection ewmh;
+        ReplayRegistry registry(&ewmh.connection, ewmh.atoms, recording.root(), recording.damageNotify());
+        for (const auto &w : recording.windows()) {
+            registry.addWindow(w.window, w.geometry, w.mapped);
+        }
+        EventRecord::Record record;
+        while (recording.next(&record)) {
+            switch (record.type) {
+            case EventRecord::Event:
+                registry.dispatch(reinterpret_cast<const xcb_generic_event_t *>(record.event.constData()));
+                break;
+            case EventRecord::PixmapNamed:
+                registry.addPixmap(record.window, record.pixmap, record.damage);
+                break;
+            case EventRecord::PixmapRemoved:
+                registry.removePixmap(record.damage);
+                break;
+            }
+        }
+        QCoreApplication::processEvents();
+
+        // Same windows in the same state and order, whatever else is on the root window
+        QVector<xcb_window_t> compositorOrder, replayOrder;
+        for (auto window : windows) {
+            auto w = live.value(window);
+            QVERIFY(w);
+            auto replayed = registry.window(window);
+            QCOMPARE(bool(replayed), w->isValid());
+            if (!replayed) {
+                continue;
+            }
+            QCOMPARE(replayed->geometry(), w->geometry());
+            QCOMPARE(replayed->isMapped(), w->isMapped());
+            compositorOrder.append(window);
+            replayOrder.append(window);
+        }
+        std::sort(compositorOrder.begin(), compositorOrder.end(), [&live](xcb_window_t a, xcb_window_t b) {
+            return live.value(a)->zIndex() < live.value(b)->zIndex();
+        });
+        std::sort(replayOrder.begin(), replayOrder.end(), [&registry](xcb_window_t a, xcb_window_t b) {
+            return registry.stacking().indexOf(a) < registry.stacking().indexOf(b);
+        });
+        QCOMPARE(replayOrder, compositorOrder);
+        QCOMPARE(compositorOrder, QVector<xcb_window_t>({ windows[1], windows[2], windows[0] }));
+
+        for (auto window : windows.mid(0, 3)) {
+            xcb_destroy_window(connection, window);
+        }
+        xcb_flush(connection);
+    }
+
+    void testOcclusionTable()
+    {
+        OcclusionTable table;
+        QRect screen(0, 0, 640, 480);
+        table.append(QRect(10, 10, 100, 100), true);   // covered by the next one
+        table.append(QRect(0, 0, 200, 200), true);
+        table.append(QRect(50, 50, 300, 300), false);  // nothing above it
+        table.append(QRect(700, 0, 100, 100), true);   // off screen
+        table.append(QRect(60, 60, 10, 10), false);    // covered, but by a transparent window only
+        table.append(QRect(55, 55, 100, 100), false);
+
+        QVector<bool> occluded;
+        table.compute(screen, &occluded);
+        QCOMPARE(occluded, QVector<bool>() << true << false << false << true << false << false);
+
+        // Stale entries from the previous frame must not cover anything
+        table.clear();
+        table.append(QRect(10, 10, 100, 100), true);
+        table.compute(screen, &occluded);
+        QCOMPARE(occluded, QVector<bool>() << false);
+
+        // More windows than one group of four, the covering one last
+        table.clear();
+        for (int i = 0; i < 9; i++) {
+            table.append(QRect(i, i, 10, 10), false);
+        }
+        table.append(screen, true);
+        table.compute(screen, &occluded);
+        QCOMPARE(occluded.count(true), 9);
+        QVERIFY(!occluded.last());
+    }
+
+    void testShadowImage()
+    {
+        auto image = WindowShadowItem::shadowImage(10);
+        QCOMPARE(image.size(), QSize(22, 22));
+
+        // Transparent at the outer edge, opaque where it is stretched over the item
+        QCOMPARE(qAlpha(image.pixel(0, 11)), 0);
+        QCOMPARE(qAlpha(image.pixel(10, 10)), 255);
+        QCOMPARE(qAlpha(image.pixel(11, 11)), 255);
+        QCOMPARE(qAlpha(image.pixel(21, 21)), 0);
+
+        // Fades in monotonically, symmetric, and the corner is the product of the sides
+        for (int i = 1; i <= 10; i++) {
+            QVERIFY(qAlpha(image.pixel(i, 11)) > qAlpha(image.pixel(i - 1, 11)));
+            QCOMPARE(image.pixel(i, 11), image.pixel(21 - i, 11));
+            QCOMPARE(image.pixel(11, i), image.pixel(i, 11));
+        }
+        auto side = qAlpha(image.pixel(5, 11)) / 255.0;
+        QVERIFY(qAbs(qAlpha(image.pixel(5, 5)) - side * side * 255) <= 1);
+    }
+
+    void testOccluded()
+    {
+        Compositor comp;
+        QCoreApplication::processEvents();
+
+        QRasterWindow below;
+        below.setGeometry(50, 50, 100, 100);
+        below.show();
+        auto b = getWindowCreated(comp);
+        QVERIFY(b);
+
+        QRasterWindow above;
+        above.setGeometry(0, 0, 300, 300);
+        above.show();
+        auto a = getWindowCreated(comp);
+        QVERIFY(a);
+
+        // Only once the window above has finished appearing
+        QVERIFY(!b->isOccluded());
+        QSignalSpy occludedSpy(b.data(), SIGNAL(occludedChanged(bool)));
+        QVERIFY(occludedSpy.wait());
+        QVERIFY(b->isOccluded());
+        QVERIFY(!a->isOccluded());
+        QCOMPARE(comp.occludedWindows(), 1);
+
+        above.hide();
+        QVERIFY(occludedSpy.wait());
+        QVERIFY(!b->isOccluded());
+        QCOMPARE(comp.occludedWindows(), 0);
+    }
+
+    void testWindowRestack()
+    {
+        Compositor comp;
+        QCoreApplication::processEvents();
+        QWindow win1;
+        win1.create();
+        auto w1 = getWindowCreated(comp);
+        QWindow win2;
+        win2.create();
+        auto w2 = getWindowCreated(comp);
+        QVERIFY(w1);
+        QVERIFY(w2);
+        QVERIFY(w1->zIndex() < w2->zIndex());
+
+        QSignalSpy zIndexSpy(w1.data(), SIGNAL(zIndexChanged(int)));
+        win1.raise();
+        QVERIFY(zIndexSpy.wait());
+        QVERIFY(w1->zIndex() > w2->zIndex());
+
+        zIndexSpy.clear();
+        win1.lower();
+        QVERIFY(zIndexSpy.wait());
+        QVERIFY(w1->zIndex() < w2->zIndex());
+    }
+
+    void testAsyncReplies()
+    {
+        auto connection = QX11Info::connection();
+        auto replies = XcbAsyncReplies::instance(connection);
+
+        // Continuations run in request order, and errors reach them instead of the event queue
+        QList<int> order;
+        bool gotReply = true;
+        int errorCode = 0;
+        for (int i = 0; i < 3; i++) {
+            replies->await<xcb_get_input_focus_reply_t>(xcb_get_input_focus(connection), this,
+                    [&order, i](xcb_get_input_focus_reply_t *reply, xcb_generic_error_t *) {
+                if (reply) {
+                    order.append(i);
+                }
+            });
+        }
+        replies->await<xcb_get_geometry_reply_t>(xcb_get_geometry(connection, XCB_NONE), this,
+                [&order, &gotReply, &errorCode](xcb_get_geometry_reply_t *reply, xcb_generic_error_t *error) {
+            order.append(3);
+            gotReply = reply != Q_NULLPTR;
+            errorCode = error ? error->error_code : 0;
+        });
+        QTRY_COMPARE(order, QList<int>() << 0 << 1 << 2 << 3);
+        QVERIFY(!gotReply);
+        QCOMPARE(errorCode, int(XCB_DRAWABLE));
+        QCOMPARE(replies->pendingCount(), 0);
+
+        // Nothing runs for a deleted context, but later requests still complete
+        auto context = new QObject;
+        bool deletedCalled = false;
+        bool aliveCalled = false;
+        replies->await<xcb_get_input_focus_reply_t>(xcb_get_input_focus(connection), context,
+                [&deletedCalled](xcb_get_input_focus_reply_t *, xcb_generic_error_t *) {
+            deletedCalled = true;
+        });
+        replies->await<xcb_get_input_focus_reply_t>(xcb_get_input_focus(connection), this,
+                [&aliveCalled](xcb_get_input_focus_reply_t *, xcb_generic_error_t *) {
+            aliveCalled = true;
+        });
+        delete context;
+        QTRY_VERIFY(aliveCalled);
+        QVERIFY(!deletedCalled);
+
+        // A broken connection drops everything pending without running it. It stays registered
+        // with XcbAsyncReplies, so it isn't disconnected.
+        auto broken = xcb_connect("invalid-host-name:99", Q_NULLPTR);
+        QVERIFY(xcb_connection_has_error(broken));
+        auto brokenReplies = XcbAsyncReplies::instance(broken);
+        bool brokenCalled = false;
+        brokenReplies->await<xcb_get_input_focus_reply_t>(xcb_get_input_focus(broken), this,
+                [&brokenCalled](xcb_get_input_focus_reply_t *, xcb_generic_error_t *) {
+            brokenCalled = true;
+        });
+        QTRY_COMPARE(brokenReplies->pendingCount(), 0);
+        QVERIFY(!brokenCalled);
+    }
+
+    void testActiveWindowCache()
+    {
+        EwmhConnection ewmh;
+        Compositor comp;
+        QCoreApplication::processEvents();
+        QWindow win;
+        win.create();
+        auto w = getWindowCreated(comp);
+        QVERIFY(w);
+        QWindow child(&win);
+        child.create();
+        QWindow other;
+        other.create();
+        auto o = getWindowCreated(comp);
+        QVERIFY(o);
+
+        QSignalSpy activeSpy(&comp, SIGNAL(activeWindowChanged()));
+        auto misses = comp.topLevelCacheMisses();
+        xcb_ewmh_set_active_window(&ewmh.connection, QX11Info::appScreen(), child.winId());
+        xcb_flush(QX11Info::connection());
+        QVERIFY(activeSpy.wait());
+        QCOMPARE(comp.activeWindow(), w.data());
+        QCOMPARE(comp.topLevelCacheMisses(), misses + 1);
+
+        // Top-level windows are found directly, without the cache
+        auto hits = comp.topLevelCacheHits();
+        xcb_ewmh_set_active_window(&ewmh.connection, QX11Info::appScreen(), other.winId());
+        xcb_flush(QX11Info::connection());
+        QVERIFY(activeSpy.wait());
+        QCOMPARE(comp.activeWindow(), o.data());
+        QCOMPARE(comp.topLevelCacheHits(), hits);
+
+        xcb_ewmh_set_active_window(&ewmh.connection, QX11Info::appScreen(), child.winId());
+        xcb_flush(QX11Info::connection());
+        QVERIFY(activeSpy.wait());
+        QCOMPARE(comp.activeWindow(), w.data());
+        QCOMPARE(comp.topLevelCacheMisses(), misses + 1);
+        QCOMPARE(comp.topLevelCacheHits(), hits + 1);
+    }
+
     void testWindowPixmap()
     {
         Compositor comp;
@@ -161,39 +572,250 @@ private Q_SLOTS:
         QRasterWindow win;
         win.setGeometry(0, 0, 300, 300);
         win.show();
-        auto w = getWindowCreated(comp);
+        auto w = getWindowPixmap(comp);
         QVERIFY(w);
         auto pixmap = w->pixmap();
         QVERIFY(pixmap);
+        QVERIFY(pixmap->isReady());
         QVERIFY(pixmap == w->pixmap());
         QCOMPARE(pixmap->size(), QSize(300, 300));
 
+        // Contents of a new pixmap are damaged as a whole
+        QCOMPARE(pixmap->damageRegion(), QRegion(0, 0, 300, 300));
+        pixmap->clearDamage();
+        QCOMPARE(WindowPixmap::flushDamageAcknowledgements(QX11Info::connection()), 1);
+
         QSignalSpy damageSpy(pixmap.data(), SIGNAL(damaged()));
         win.update();
         QVERIFY(damageSpy.wait());
         QCOMPARE(damageSpy.count(), 1);
+        QVERIFY(pixmap->isDamaged());
+        QVERIFY(QRect(0, 0, 300, 300).contains(pixmap->damageRegion().boundingRect()));
         damageSpy.clear();
 
         win.update();
         QVERIFY(!damageSpy.wait(500));
 
         pixmap->clearDamage();
+        QVERIFY(pixmap->damageRegion().isEmpty());
+        QCOMPARE(WindowPixmap::flushDamageAcknowledgements(QX11Info::connection()), 1);
+        QCOMPARE(WindowPixmap::flushDamageAcknowledgements(QX11Info::connection()), 0);
         win.update();
         QVERIFY(damageSpy.wait());
         QCOMPARE(damageSpy.count(), 1);
         QVERIFY(w->pixmap() == pixmap);
 
+        QSignalSpy pixmapSpy(w.data(), SIGNAL(pixmapChanged(WindowPixmap*)));
         win.resize(400, 400);
-        QVERIFY(QSignalSpy(w.data(), SIGNAL(geometryChanged(QRect))).wait());
+        QVERIFY(pixmapSpy.wait());
         auto pixmap2 = w->pixmap();
         QVERIFY(pixmap2 != pixmap);
         QCOMPARE(pixmap2->size(), QSize(400, 400));
+        pixmap2->clearDamage();
 
         QSignalSpy damageSpy2(pixmap2.data(), SIGNAL(damaged()));
         win.update();
         QVERIFY(damageSpy2.wait());
         QCOMPARE(damageSpy2.count(), 1);
     }
+
+    void testRenderConnection()
+    {
+        Compositor comp;
+        QCoreApplication::processEvents();
+        QRasterWindow win;
+        win.setGeometry(0, 0, 300, 300);
+        win.show();
+        auto w = getWindowPixmap(comp);
+        QVERIFY(w);
+        auto pixmap = w->pixmap();
+        QVERIFY(pixmap);
+        QCOMPARE(pixmap->renderConnection(), pixmap->connection());
+
+        // Damage acknowledged on another connection re-arms reporting like on the pixmap's own
+        auto connection = xcb_connect(Q_NULLPTR, Q_NULLPTR);
+        QVERIFY(!xcb_connection_has_error(connection));
+        pixmap->setRenderConnection(connection);
+        pixmap->clearDamage();
+        QCOMPARE(WindowPixmap::flushDamageAcknowledgements(connection), 1);
+
+        QSignalSpy damageSpy(pixmap.data(), SIGNAL(damaged()));
+        win.update();
+        QVERIFY(damageSpy.wait());
+        QCOMPARE(damageSpy.count(), 1);
+
+        pixmap->setRenderConnection(Q_NULLPTR);
+        QCOMPARE(pixmap->renderConnection(), pixmap->connection());
+        xcb_disconnect(connection);
+    }
+
+    void testAcknowledgeDamage()
+    {
+        Compositor comp;
+        QCoreApplication::processEvents();
+        QRasterWindow win;
+        win.setGeometry(0, 0, 300, 300);
+        win.show();
+        auto w = getWindowPixmap(comp);
+        QVERIFY(w);
+        auto pixmap = w->pixmap();
+        QVERIFY(pixmap);
+        QVERIFY(pixmap->isDamaged());
+
+        // The region stays for the scene, but the server reports new damage again
+        auto serial = pixmap->damageSerial();
+        pixmap->acknowledgeDamage();
+        QCOMPARE(WindowPixmap::flushDamageAcknowledgements(QX11Info::connection()), 1);
+        QCOMPARE(pixmap->damageRegion(), QRegion(0, 0, 300, 300));
+
+        win.update();
+        QTRY_VERIFY(pixmap->damageSerial() != serial);
+        QVERIFY(pixmap->isDamaged());
+
+        pixmap->clearDamage();
+        pixmap->acknowledgeDamage();
+        QCOMPARE(WindowPixmap::flushDamageAcknowledgements(QX11Info::connection()), 1);
+    }
+
+    void testAdaptiveSwapInterval()
+    {
+        if (!FrameScheduler::isAdaptiveSwapSupported()) {
+            QSKIP("GLX_EXT_swap_control_tear is not supported");
+        }
+        QQuickWindow window;
+        FrameScheduler scheduler(&window);
+        scheduler.setSwapInterval(-1);
+        QCOMPARE(scheduler.swapInterval(), -1);
+        QVERIFY(!scheduler.isAdaptiveSwapActive());
+
+        // Qt would have left the driver's default in place
+        window.setGeometry(0, 0, 100, 100);
+        window.show();
+        QTRY_VERIFY(scheduler.isAdaptiveSwapActive());
+    }
+
+    void testBypass()
+    {
+        Compositor comp;
+        comp.setBypassEnabled(true);
+        QCoreApplication::processEvents();
+        QSignalSpy bypassSpy(&comp, SIGNAL(bypassActiveChanged(bool)));
+
+        QRasterWindow fullScreen;
+        fullScreen.setGeometry(comp.rootGeometry());
+        fullScreen.show();
+        QVERIFY(bypassSpy.wait(3000));
+        QVERIFY(comp.isBypassActive());
+
+        // A window on top ends bypass at once
+        QRasterWindow other;
+        other.setGeometry(0, 0, 100, 100);
+        other.show();
+        QVERIFY(bypassSpy.wait());
+        QVERIFY(!comp.isBypassActive());
+
+        // ...and it comes back only after the delay
+        other.hide();
+        QVERIFY(!bypassSpy.wait(500));
+        QVERIFY(bypassSpy.wait(3000));
+        QVERIFY(comp.isBypassActive());
+
+        fullScreen.hide();
+        QVERIFY(bypassSpy.wait());
+        QVERIFY(!comp.isBypassActive());
+    }
+
+    void testBypassRequestedSmallWindow()
+    {
+        Compositor comp;
+        comp.setBypassEnabled(true);
+        QCoreApplication::processEvents();
+        QSignalSpy bypassSpy(&comp, SIGNAL(bypassActiveChanged(bool)));
+
+        // _NET_WM_BYPASS_COMPOSITOR=1 on a window that doesn't cover the screen is ignored
+        QRasterWindow win;
+        win.setGeometry(0, 0, 100, 100);
+        win.create();
+        auto connection = QX11Info::connection();
+        auto cookie = xcb_intern_atom(connection, 0, std::strlen("_NET_WM_BYPASS_COMPOSITOR"),
+                                      "_NET_WM_BYPASS_COMPOSITOR");
+        auto reply = xcb_intern_atom_reply(connection, cookie, Q_NULLPTR);
+        QVERIFY(reply);
+        auto atom = reply->atom;
+        std::free(reply);
+        const uint32_t requested = 1;
+        xcb_change_property(connection, XCB_PROP_MODE_REPLACE, win.winId(), atom, XCB_ATOM_CARDINAL, 32, 1,
+                            &requested);
+        win.show();
+        QVERIFY(!bypassSpy.wait(3000));
+        QVERIFY(!comp.isBypassActive());
+
+        // Covering the screen, it is honored
+        win.setGeometry(comp.rootGeometry());
+        QVERIFY(bypassSpy.wait(3000));
+        QVERIFY(comp.isBypassActive());
+    }
+    void testXRenderSeparateDamage()
+    {
+        auto connection = QX11Info::connection();
+        if (!XRenderCompositor::isSupported(connection)) {
+            QSKIP("XRender 0.10 is not available");
+        }
+        Compositor comp;
+        XRenderCompositor renderer(&comp);
+        QCoreApplication::processEvents();
+
+        auto root = QX11Info::appRootWindow();
+        auto createWindow = [=](int16_t x, int16_t y) {
+            auto window = xcb_generate_id(connection);
+            xcb_create_window(connection, XCB_COPY_FROM_PARENT, window, root, x, y, 100, 100, 0,
+                              XCB_WINDOW_CLASS_INPUT_OUTPUT, XCB_COPY_FROM_PARENT, 0, Q_NULLPTR);
+            xcb_map_window(connection, window);
+            return window;
+        };
+        auto fill = [=](xcb_window_t window, uint32_t color) {
+            auto gc = xcb_generate_id(connection);
+            xcb_create_gc(connection, gc, window, XCB_GC_FOREGROUND, &color);
+            const xcb_rectangle_t rect = { 0, 0, 100, 100 };
+            xcb_poly_fill_rectangle(connection, window, gc, 1, &rect);
+            xcb_free_gc(connection, gc);
+        };
+        // What's on the screen, read through the overlay window that covers it
+        auto pixel = [=](int16_t x, int16_t y) {
+            auto cookie = xcb_get_image(connection, XCB_IMAGE_FORMAT_Z_PIXMAP, root, x, y, 1, 1, ~0u);
+            auto image = xcb_get_image_reply(connection, cookie, Q_NULLPTR);
+            uint32_t value = 0;
+            if (image) {
+                std::memcpy(&value, xcb_get_image_data(image),
+                            qMin<size_t>(sizeof(value), xcb_get_image_data_length(image)));
+                std::free(image);
+            }
+            return value & 0xffffff;
+        };
+
+        auto a = createWindow(0, 0);
+        auto b = createWindow(300, 300);
+        fill(a, 0xff0000);
+        fill(b, 0xff0000);
+        xcb_flush(connection);
+        QTRY_COMPARE(pixel(50, 50), 0xff0000u);
+        QTRY_COMPARE(pixel(350, 350), 0xff0000u);
+        QTest::qWait(100);
+
+        // Damaged together, so repainted in the same frame: both have to reach the overlay,
+        // not just the one composited last
+        QSignalSpy frameSpy(&renderer, SIGNAL(frameFinished()));
+        fill(a, 0x00ff00);
+        fill(b, 0x00ff00);
+        xcb_flush(connection);
+        QVERIFY(frameSpy.wait());
+        QTRY_COMPARE(pixel(50, 50), 0x00ff00u);
+        QTRY_COMPARE(pixel(350, 350), 0x00ff00u);
+
+        xcb_destroy_window(connection, a);
+        xcb_destroy_window(connection, b);
+        xcb_flush(connection);
+    }
 };
 
 static Xephyr xephyr(QByteArrayLiteral(":981"));
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <QtTest>
+
+#include "compositor.h"
+#include "clientwindow.h"
+
+// Next window the compositor creates. Fails the current test and returns null if none
+// shows up within a second.
+inline QSharedPointer<ClientWindow> getWindowCreated(Compositor &c)
+{
+    QSignalSpy windowCreatedSignalSpy(&c, SIGNAL(windowCreated(ClientWindow*)));
+    if (!QTest::qVerify(windowCreatedSignalSpy.wait(1000),
+                        "windowCreatedSignalSpy.wait(1000)",
+                        "", __FILE__, __LINE__))
+    {
+        return QSharedPointer<ClientWindow>();
+    }
+    if (!QTest::qCompare(windowCreatedSignalSpy.count(), 1,
+                         "windowCreatedSignalSpy.count()", "1",
+                         __FILE__, __LINE__))
+    {
+        return QSharedPointer<ClientWindow>();
+    }
+    return windowCreatedSignalSpy.first().first().value<ClientWindow *>()->sharedFromThis();
+}
+
+// Like getWindowCreated(), but also waits until the window has its first pixmap
+inline QSharedPointer<ClientWindow> getWindowPixmap(Compositor &c)
+{
+    auto w = getWindowCreated(c);
+    if (!w || w->pixmap()) {
+        return w;
+    }
+    if (!QTest::qVerify(QSignalSpy(w.data(), SIGNAL(pixmapChanged(WindowPixmap*))).wait(),
+                        "QSignalSpy(w.data(), SIGNAL(pixmapChanged(WindowPixmap*))).wait()",
+                        "", __FILE__, __LINE__))
+    {
+        return QSharedPointer<ClientWindow>();
+    }
+    return w;
+}
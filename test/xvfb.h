@@ -0,0 +1,41 @@
+#pragma once
+
+#include <QProcess>
+
+// Headless X server with software GL, for benchmarks that have to run without a display.
+// The server picks a free display itself and prints it once it accepts connections, so
+// runs don't need display numbers of their own and don't wait longer than that.
+class Xvfb : public QProcess
+{
+public:
+    Xvfb()
+    {
+        start(QStringLiteral("Xvfb -ac -noreset -displayfd 1 +extension GLX +extension Composite "
+                             "-screen 0 1280x1024x24"));
+        if (waitForStarted()) {
+            while (!canReadLine() && waitForReadyRead(10000)) {
+            }
+            auto number = readLine().trimmed();
+            if (!number.isEmpty()) {
+                display_ = ':' + number;
+            }
+        }
+        qputenv("DISPLAY", display_);
+        qputenv("LIBGL_ALWAYS_SOFTWARE", "1");
+    }
+
+    ~Xvfb() Q_DECL_OVERRIDE
+    {
+        terminate();
+        waitForFinished();
+    }
+
+    // Empty if the server didn't start
+    QByteArray display() const
+    {
+        return display_;
+    }
+
+private:
+    QByteArray display_;
+};
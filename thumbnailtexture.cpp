@@ -0,0 +1,196 @@
+#include "thumbnailtexture.h"
+
+#include <QHash>
+#include <QMutex>
+#include <QOpenGLContext>
+#include <QOpenGLShaderProgram>
+#include <QVector2D>
+
+#include "windowtexture.h"
+
+QAtomicInteger<qint64> ThumbnailTexture::totalBytes_;
+QAtomicInteger<qint64> ThumbnailTexture::renders_;
+
+static const char vertexShader[] =
+        "attribute highp vec2 vertex;\n"
+        "varying highp vec2 coord;\n"
+        "void main() {\n"
+        "    coord = vertex;\n"
+        "    gl_Position = vec4(vertex * 2.0 - 1.0, 0.0, 1.0);\n"
+        "}\n";
+
+// Four linearly filtered taps: with offset 0 a 2x2 box, with one source texel a 4x4 box
+static const char fragmentShader[] =
+        "uniform sampler2D source;\n"
+        "uniform highp vec2 offset;\n"
+        "varying highp vec2 coord;\n"
+        "void main() {\n"
+        "    gl_FragColor = 0.25 * (texture2D(source, coord - offset) +\n"
+        "                           texture2D(source, coord + offset) +\n"
+        "                           texture2D(source, coord + vec2(offset.x, -offset.y)) +\n"
+        "                           texture2D(source, coord + vec2(-offset.x, offset.y)));\n"
+        "}\n";
+
+// Shader and framebuffer shared by the thumbnails of a context
+class ThumbnailRenderer : public QObject,
+                          public QOpenGLFunctions
+{
+    Q_OBJECT
+public:
+    // Renderer of the current context; must be called from the render thread
+    static ThumbnailRenderer *current();
+
+    QOpenGLShaderProgram program;
+    uint framebuffer;
+
+private Q_SLOTS:
+    void contextDestroyed();
+
+private:
+    explicit ThumbnailRenderer(QOpenGLContext *);
+
+    QOpenGLContext *context_;
+};
+
+static QMutex renderersMutex;
+static QHash<QOpenGLContext *, ThumbnailRenderer *> renderers;
+
+ThumbnailRenderer *ThumbnailRenderer::current()
+{
+    auto context = QOpenGLContext::currentContext();
+    Q_ASSERT(context);
+
+    QMutexLocker lock(&renderersMutex);
+    auto &renderer = renderers[context];
+    if (!renderer) {
+        renderer = new ThumbnailRenderer(context);
+    }
+    return renderer;
+}
+
+ThumbnailRenderer::ThumbnailRenderer(QOpenGLContext *context)
+    : QOpenGLFunctions(context),
+      framebuffer(0),
+      context_(context)
+{
+    program.addShaderFromSourceCode(QOpenGLShader::Vertex, vertexShader);
+    program.addShaderFromSourceCode(QOpenGLShader::Fragment, fragmentShader);
+    program.bindAttributeLocation("vertex", 0);
+    program.link();
+    glGenFramebuffers(1, &framebuffer);
+    connect(context, SIGNAL(aboutToBeDestroyed()), SLOT(contextDestroyed()), Qt::DirectConnection);
+}
+
+void ThumbnailRenderer::contextDestroyed()
+{
+    {
+        QMutexLocker lock(&renderersMutex);
+        renderers.remove(context_);
+    }
+    glDeleteFramebuffers(1, &framebuffer);
+    program.removeAllShaders();
+    deleteLater();
+}
+
+ThumbnailTexture::ThumbnailTexture(const QSize &windowSize, int reduction, bool hasAlpha)
+    : QOpenGLFunctions(QOpenGLContext::currentContext()),
+      size_(qMax(windowSize.width() >> reduction, 1), qMax(windowSize.height() >> reduction, 1)),
+      reduction_(reduction),
+      hasAlpha_(hasAlpha),
+      texture_(0),
+      bytes_(0)
+{
+    glGenTextures(1, &texture_);
+    glBindTexture(GL_TEXTURE_2D, texture_);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, size_.width(), size_.height(), 0, GL_RGBA, GL_UNSIGNED_BYTE,
+                 Q_NULLPTR);
+
+    setFiltering(Linear);
+    setMipmapFiltering(Linear);
+    setHorizontalWrapMode(ClampToEdge);
+    setVerticalWrapMode(ClampToEdge);
+    updateBindOptions(true);
+
+    // The mipmap chain adds a third
+    bytes_ = qint64(size_.width()) * size_.height() * 4 * 4 / 3;
+    totalBytes_.fetchAndAddRelaxed(bytes_);
+}
+
+ThumbnailTexture::~ThumbnailTexture()
+{
+    totalBytes_.fetchAndAddRelaxed(-bytes_);
+    if (texture_ && QOpenGLContext::currentContext()) {
+        glDeleteTextures(1, &texture_);
+    }
+}
+
+void ThumbnailTexture::render(WindowTexture *source)
+{
+    auto renderer = ThumbnailRenderer::current();
+    if (!renderer->program.isLinked()) {
+        return;
+    }
+
+    GLint previousFramebuffer = 0;
+    glGetIntegerv(GL_FRAMEBUFFER_BINDING, &previousFramebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, renderer->framebuffer);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture_, 0);
+    glViewport(0, 0, size_.width(), size_.height());
+    glDisable(GL_BLEND);
+    glDisable(GL_SCISSOR_TEST);
+    glDisable(GL_DEPTH_TEST);
+    glDisable(GL_STENCIL_TEST);
+    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+
+    glActiveTexture(GL_TEXTURE0);
+    source->bind();
+    renderer->program.bind();
+    renderer->program.setUniformValue("source", 0);
+    auto texels = reduction_ == 2 ? qreal(1) : 0;
+    auto sourceSize = source->textureSize();
+    renderer->program.setUniformValue("offset", QVector2D(texels / sourceSize.width(),
+                                                          texels / sourceSize.height()));
+
+    // Rows keep the source's order, so the thumbnail is Y-inverted like the source
+    static const GLfloat vertices[] = { 0, 0, 1, 0, 0, 1, 1, 1 };
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, vertices);
+    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+    glDisableVertexAttribArray(0);
+    renderer->program.release();
+
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, 0, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, previousFramebuffer);
+    glBindTexture(GL_TEXTURE_2D, texture_);
+    glGenerateMipmap(GL_TEXTURE_2D);
+    renders_.fetchAndAddRelaxed(1);
+}
+
+int ThumbnailTexture::textureId() const
+{
+    return static_cast<int>(texture_);
+}
+
+QSize ThumbnailTexture::textureSize() const
+{
+    return size_;
+}
+
+bool ThumbnailTexture::hasAlphaChannel() const
+{
+    return hasAlpha_;
+}
+
+bool ThumbnailTexture::hasMipmaps() const
+{
+    return true;
+}
+
+void ThumbnailTexture::bind()
+{
+    glBindTexture(GL_TEXTURE_2D, texture_);
+    updateBindOptions();
+}
+
+#include "thumbnailtexture.moc"
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <QAtomicInteger>
+#include <QOpenGLFunctions>
+#include <QSGTexture>
+#include <QSize>
+
+class WindowTexture;
+
+// Downscaled, mipmapped copy of a window texture, so a window shown much smaller than it
+// is doesn't alias. The base level is the window size divided by 2^reduction, drawn from
+// the window texture with a box filter; the other levels are generated from it.
+// Render thread only.
+class ThumbnailTexture : public QSGTexture,
+                         protected QOpenGLFunctions
+{
+    Q_OBJECT
+public:
+    // The four taps of the box filter cover at most 4x4 source texels. Smaller thumbnails
+    // sample the mipmap levels below.
+    static const int MaxReduction = 2;
+
+    ThumbnailTexture(const QSize &windowSize, int reduction, bool hasAlpha);
+    ~ThumbnailTexture() Q_DECL_OVERRIDE;
+
+    int reduction() const
+    {
+        return reduction_;
+    }
+
+    // Redraws all levels from the source, which must be up to date. Changes GL state
+    // (viewport, blending, program); the caller has to restore what the scene graph expects.
+    void render(WindowTexture *source);
+
+    // Memory taken by all levels
+    qint64 bytes() const
+    {
+        return bytes_;
+    }
+
+    // Totals of all thumbnails
+    static qint64 totalBytes()
+    {
+        return totalBytes_.load();
+    }
+
+    static qint64 renders()
+    {
+        return renders_.load();
+    }
+
+    int textureId() const Q_DECL_OVERRIDE;
+    QSize textureSize() const Q_DECL_OVERRIDE;
+    bool hasAlphaChannel() const Q_DECL_OVERRIDE;
+    bool hasMipmaps() const Q_DECL_OVERRIDE;
+    void bind() Q_DECL_OVERRIDE;
+
+private:
+    QSize size_;
+    int reduction_;
+    bool hasAlpha_;
+    uint texture_;
+    qint64 bytes_;
+
+    static QAtomicInteger<qint64> totalBytes_;
+    static QAtomicInteger<qint64> renders_;
+};
@@ -0,0 +1,147 @@
+#include "windownode.h"
+
+#include <QSGSimpleMaterial>
+
+struct WindowState
+{
+    QSGTexture *texture;
+    QSGTexture::Filtering filtering;
+    float brightness;
+    bool opaque;
+};
+
+class WindowShader : public QSGSimpleMaterialShader<WindowState>
+{
+    QSG_DECLARE_SIMPLE_SHADER(WindowShader, WindowState)
+public:
+    WindowShader()
+        : brightnessLocation_(-1),
+          opaqueLocation_(-1)
+    {
+    }
+
+    const char *vertexShader() const Q_DECL_OVERRIDE
+    {
+        return "attribute highp vec4 vertex;\n"
+               "attribute highp vec2 coord;\n"
+               "uniform highp mat4 qt_Matrix;\n"
+               "varying highp vec2 texCoord;\n"
+               "void main() {\n"
+               "    texCoord = coord;\n"
+               "    gl_Position = qt_Matrix * vertex;\n"
+               "}\n";
+    }
+
+    // The alpha of textures without one may be undefined, so it's forced to 1 for them.
+    // Colors are premultiplied: brightness added before premultiplication is brightness * alpha.
+    const char *fragmentShader() const Q_DECL_OVERRIDE
+    {
+        return "uniform lowp float qt_Opacity;\n"
+               "uniform lowp float brightness;\n"
+               "uniform lowp float opaque;\n"
+               "uniform lowp sampler2D source;\n"
+               "varying highp vec2 texCoord;\n"
+               "void main() {\n"
+               "    lowp vec4 color = texture2D(source, texCoord);\n"
+               "    color.a = max(color.a, opaque);\n"
+               "    color.rgb = clamp(color.rgb + brightness * color.a, 0.0, color.a);\n"
+               "    gl_FragColor = color * qt_Opacity;\n"
+               "}\n";
+    }
+
+    QList<QByteArray> attributes() const Q_DECL_OVERRIDE
+    {
+        return QList<QByteArray>() << "vertex" << "coord";
+    }
+
+    void resolveUniforms() Q_DECL_OVERRIDE
+    {
+        brightnessLocation_ = program()->uniformLocation("brightness");
+        opaqueLocation_ = program()->uniformLocation("opaque");
+    }
+
+    void updateState(const WindowState *state, const WindowState *) Q_DECL_OVERRIDE
+    {
+        program()->setUniformValue(brightnessLocation_, state->brightness);
+        program()->setUniformValue(opaqueLocation_, state->opaque ? 1.0f : 0.0f);
+        state->texture->setFiltering(state->filtering);
+        state->texture->bind();
+    }
+
+private:
+    int brightnessLocation_;
+    int opaqueLocation_;
+};
+
+static WindowState *state(QSGMaterial *material)
+{
+    return static_cast<QSGSimpleMaterial<WindowState> *>(material)->state();
+}
+
+WindowNode::WindowNode()
+    : yInverted_(false),
+      geometry_(QSGGeometry::defaultAttributes_TexturedPoint2D(), 4)
+{
+    setGeometry(&geometry_);
+
+    auto material = WindowShader::createMaterial();
+    material->state()->texture = Q_NULLPTR;
+    material->state()->filtering = QSGTexture::Nearest;
+    material->state()->brightness = 0;
+    material->state()->opaque = true;
+    setMaterial(material);
+    setFlag(OwnsMaterial);
+}
+
+WindowNode::~WindowNode()
+{
+}
+
+void WindowNode::setTexture(QSGTexture *texture, bool yInverted)
+{
+    texture_.reset(texture);
+    yInverted_ = yInverted;
+
+    // Translucent windows need blending; the renderer adds it for opacity below 1 anyway
+    auto opaque = texture && !texture->hasAlphaChannel();
+    state(material())->texture = texture;
+    state(material())->opaque = opaque;
+    material()->setFlag(QSGMaterial::Blending, !opaque);
+    markDirty(DirtyMaterial);
+    updateGeometry();
+}
+
+void WindowNode::setRect(const QRectF &rect)
+{
+    if (rect != rect_) {
+        rect_ = rect;
+        updateGeometry();
+    }
+}
+
+void WindowNode::setBrightness(qreal brightness)
+{
+    auto value = float(qBound(-1.0, brightness, 1.0));
+    if (value != state(material())->brightness) {
+        state(material())->brightness = value;
+        markDirty(DirtyMaterial);
+    }
+}
+
+void WindowNode::setFiltering(QSGTexture::Filtering filtering)
+{
+    if (filtering != state(material())->filtering) {
+        state(material())->filtering = filtering;
+        markDirty(DirtyMaterial);
+    }
+}
+
+void WindowNode::updateGeometry()
+{
+    auto sourceRect = texture_ ? texture_->normalizedTextureSubRect() : QRectF(0, 0, 1, 1);
+    if (yInverted_) {
+        sourceRect = QRectF(sourceRect.left(), sourceRect.bottom(), sourceRect.width(), -sourceRect.height());
+    }
+    QSGGeometry::updateTexturedRectGeometry(&geometry_, rect_, sourceRect);
+    markDirty(DirtyGeometry);
+}
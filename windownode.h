@@ -0,0 +1,38 @@
+#pragma once
+
+#include <QScopedPointer>
+#include <QSGGeometryNode>
+#include <QSGTexture>
+
+// Window contents drawn in a single pass: the vertical mirror of Y-inverted textures is
+// in the texture coordinates, brightness and the inherited opacity are applied by the
+// material. Dimming a window this way needs no effect item, FBO or extra pass.
+// Owns its texture.
+class WindowNode : public QSGGeometryNode
+{
+public:
+    WindowNode();
+    ~WindowNode() Q_DECL_OVERRIDE;
+
+    QSGTexture *texture() const
+    {
+        return texture_.data();
+    }
+    // Replaces and deletes the previous texture
+    void setTexture(QSGTexture *, bool yInverted);
+
+    void setRect(const QRectF &);
+
+    // Added to the color channels, -1 to 1; 0 draws the window as is
+    void setBrightness(qreal);
+
+    void setFiltering(QSGTexture::Filtering);
+
+private:
+    void updateGeometry();
+
+    QScopedPointer<QSGTexture> texture_;
+    bool yInverted_;
+    QRectF rect_;
+    QSGGeometry geometry_;
+};
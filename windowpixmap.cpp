@@ -2,41 +2,82 @@
 
 #include <xcb/composite.h>
 
-WindowPixmap::WindowPixmap(xcb_connection_t *connection, xcb_window_t window, QObject *parent)
+#include "xcbasyncreplies.h"
+
+// Merging many small rectangles costs more than repainting their bounding rectangle
+static const int MaxDamageRects = 32;
+
+QMutex WindowPixmap::pendingMutex_;
+QHash<xcb_connection_t *, int> WindowPixmap::pendingAcknowledgements_;
+QAtomicInteger<quint64> WindowPixmap::acknowledgementFlushes_;
+
+WindowPixmap::WindowPixmap(xcb_connection_t *connection, xcb_window_t window,
+                           xcb_visualid_t visual, QObject *parent)
     : QObject(parent),
       connection_(connection),
+      renderConnection_(connection),
       window_(window),
-      valid_(false),
+      valid_(true),
+      ready_(false),
+      drawn_(false),
       pixmap_(XCB_NONE),
       damage_(XCB_NONE),
-      damaged_(false),
-      visual_(XCB_NONE)
+      damageSerial_(0),
+      visual_(visual)
 {
     pixmap_ = xcb_generate_id(connection);
     xcb_composite_name_window_pixmap(connection_, window_, pixmap_);
 
-    auto geometryCookie = xcb_get_geometry(connection_, pixmap_);
-    auto geometry = xcb_get_geometry_reply(connection_, geometryCookie, Q_NULLPTR);
-    if (!geometry) {
-        pixmap_ = XCB_NONE;
-        return;
-    }
+    damage_ = xcb_generate_id(connection);
+    xcb_damage_create(connection_, damage_, pixmap_, XCB_DAMAGE_REPORT_LEVEL_DELTA_RECTANGLES);
 
-    auto attributesCookie = xcb_get_window_attributes(connection_, window_);
+    // Naming fails if the window got unmapped in the meantime. Don't wait for it here.
+    auto geometryCookie = xcb_get_geometry(connection_, pixmap_);
+    XcbAsyncReplies::instance(connection_)->await<xcb_get_geometry_reply_t>(geometryCookie, this,
+            [this](xcb_get_geometry_reply_t *reply, xcb_generic_error_t *error)
+    {
+        if (error || !reply) {
+            invalidate();
+            return;
+        }
 
-    damage_ = xcb_generate_id(connection);
-    xcb_damage_create(connection_, damage_, pixmap_, XCB_DAMAGE_REPORT_LEVEL_NON_EMPTY);
+        // Damage events that came before this one weren't delivered to us, and the
+        // contents are new anyway
+        size_ = QSize(reply->width, reply->height);
+        damageRegion_ = QRect(QPoint(), size_);
+        ready_ = true;
+        Q_EMIT ready();
+    });
+}
 
-    auto attributes = xcb_get_window_attributes_reply(connection_, attributesCookie, Q_NULLPTR);
+WindowPixmap::WindowPixmap(xcb_connection_t *connection, xcb_window_t window, xcb_pixmap_t pixmap,
+                           xcb_damage_damage_t damage, const QSize &size, DetachedTag)
+    : QObject(Q_NULLPTR),
+      connection_(connection),
+      renderConnection_(connection),
+      window_(window),
+      valid_(true),
+      ready_(true),
+      drawn_(false),
+      pixmap_(pixmap),
+      damage_(damage),
+      size_(size),
+      damageSerial_(0),
+      visual_(XCB_NONE)
+{
+}
 
-    if (geometry && attributes) {
-        size_ = QSize(geometry->width, geometry->height);
-        valid_ = true;
-        visual_ = attributes->visual;
-    }
+QSharedPointer<WindowPixmap> WindowPixmap::create(xcb_connection_t *connection, xcb_window_t window,
+                                                  xcb_visualid_t visual)
+{
+    return QSharedPointer<WindowPixmap>(new WindowPixmap(connection, window, visual));
+}
 
-    std::free(geometry);
-    std::free(attributes);
+QSharedPointer<WindowPixmap> WindowPixmap::createDetached(xcb_connection_t *connection, xcb_window_t window,
+                                                          xcb_pixmap_t pixmap, xcb_damage_damage_t damage,
+                                                          const QSize &size)
+{
+    return QSharedPointer<WindowPixmap>(new WindowPixmap(connection, window, pixmap, damage, size, Detached));
 }
 
 WindowPixmap::~WindowPixmap()
@@ -49,24 +90,71 @@ WindowPixmap::~WindowPixmap()
         xcb_free_pixmap(connection_, pixmap_);
     }
 
-    xcb_flush(connection_);
     Q_EMIT destroyed(this);
 }
 
+void WindowPixmap::invalidate()
+{
+    if (valid_) {
+        valid_ = false;
+        Q_EMIT invalidated();
+    }
+}
+
 void WindowPixmap::clearDamage()
 {
-    if (damaged_) {
-        xcb_damage_subtract(connection_, damage_, XCB_NONE, XCB_NONE);
-        xcb_flush(connection_);
-        damaged_ = false;
+    if (isDamaged()) {
+        queueAcknowledgement();
+        damageRegion_ = QRegion();
+    }
+}
+
+void WindowPixmap::acknowledgeDamage()
+{
+    if (isDamaged()) {
+        queueAcknowledgement();
+    }
+}
+
+void WindowPixmap::queueAcknowledgement()
+{
+    xcb_damage_subtract(renderConnection_, damage_, XCB_NONE, XCB_NONE);
+    QMutexLocker lock(&pendingMutex_);
+    pendingAcknowledgements_[renderConnection_]++;
+}
+
+int WindowPixmap::flushDamageAcknowledgements(xcb_connection_t *connection)
+{
+    int acknowledgements;
+    {
+        QMutexLocker lock(&pendingMutex_);
+        acknowledgements = pendingAcknowledgements_.take(connection);
+    }
+    if (acknowledgements) {
+        xcb_flush(connection);
+        acknowledgementFlushes_.fetchAndAddRelaxed(1);
     }
+    return acknowledgements;
 }
 
 void WindowPixmap::xcbEvent(const xcb_damage_notify_event_t *e)
 {
     Q_ASSERT(e->damage == damage_);
-    if (e->drawable == pixmap_ && !damaged_) {
-        damaged_ = true;
+    if (e->drawable != pixmap_) {
+        return;
+    }
+
+    auto wasDamaged = isDamaged();
+    damageSerial_++;
+    damageRegion_ += QRect(e->area.x, e->area.y, e->area.width, e->area.height);
+    if (damageRegion_.rectCount() > MaxDamageRects) {
+        damageRegion_ = damageRegion_.boundingRect();
+    }
+    if (!wasDamaged) {
         Q_EMIT damaged();
     }
+    if (!drawn_) {
+        drawn_ = true;
+        Q_EMIT drawn();
+    }
 }
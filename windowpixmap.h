@@ -1,7 +1,12 @@
 #pragma once
 
+#include <QAtomicInteger>
+#include <QHash>
+#include <QMutex>
 #include <QObject>
+#include <QSharedPointer>
 #include <QEnableSharedFromThis>
+#include <QRegion>
 #include <QSize>
 
 #include <xcb/xcb.h>
@@ -11,17 +16,39 @@ class WindowPixmap : public QObject, public QEnableSharedFromThis<WindowPixmap>
 {
     Q_OBJECT
 
-    Q_PROPERTY(QSize size READ size CONSTANT)
-    Q_PROPERTY(bool valid READ isValid CONSTANT)
+    Q_PROPERTY(QSize size READ size NOTIFY ready)
+    Q_PROPERTY(bool valid READ isValid NOTIFY invalidated)
 public:
-    WindowPixmap(xcb_connection_t *, xcb_window_t, QObject *parent = Q_NULLPTR);
+    // Names the window pixmap without waiting for the server. The pixmap becomes ready
+    // (and gets its size) when the server confirms it, or invalid if naming failed.
+    WindowPixmap(xcb_connection_t *, xcb_window_t, xcb_visualid_t, QObject *parent = Q_NULLPTR);
     ~WindowPixmap() Q_DECL_OVERRIDE;
 
+    static QSharedPointer<WindowPixmap> create(xcb_connection_t *, xcb_window_t, xcb_visualid_t);
+    // Takes over existing pixmap and damage objects of the given size without sending
+    // anything. Lets benchmarks run the damage handler without an X server.
+    static QSharedPointer<WindowPixmap> createDetached(xcb_connection_t *, xcb_window_t, xcb_pixmap_t,
+                                                       xcb_damage_damage_t, const QSize &);
+
     xcb_connection_t *connection() const
     {
         return connection_;
     }
 
+    // Connection for requests the render thread sends about this pixmap: damage
+    // acknowledgements and MIT-SHM reads. The pixmap's own connection unless the
+    // compositor gave it a separate one. The server has confirmed the pixmap and its
+    // damage object by the time the render thread sees it (ClientWindow::pixmap()),
+    // so they can be used from another connection without further synchronization.
+    xcb_connection_t *renderConnection() const
+    {
+        return renderConnection_;
+    }
+    void setRenderConnection(xcb_connection_t *connection)
+    {
+        renderConnection_ = connection ? connection : connection_;
+    }
+
     xcb_window_t window() const
     {
         return window_;
@@ -52,26 +79,87 @@ public:
         return valid_;
     }
 
+    bool isReady() const
+    {
+        return ready_;
+    }
+
+    // True once the server reported any damage, i.e. the client has drawn into the pixmap
+    bool isDrawn() const
+    {
+        return drawn_;
+    }
+
     bool isDamaged() const
     {
-        return damaged_;
+        return !damageRegion_.isEmpty();
+    }
+
+    // Damaged area in pixmap coordinates, accumulated since the last clearDamage()
+    const QRegion &damageRegion() const
+    {
+        return damageRegion_;
     }
 
+    // Only queues the DamageSubtract request on renderConnection(), it's sent by
+    // flushDamageAcknowledgements()
     void clearDamage();
 
+    // Incremented with every damage notification, whether damageRegion() was cleared or not
+    quint32 damageSerial() const
+    {
+        return damageSerial_;
+    }
+
+    // Lets the server report further damage without clearing damageRegion(), for users
+    // that redraw all of the pixmap anyway and leave the region to the scene. Queued like
+    // clearDamage().
+    void acknowledgeDamage();
+
+    // Sends the damage acknowledgements queued on a connection with a single flush, to be
+    // called once per frame. Returns the number of acknowledgements sent.
+    static int flushDamageAcknowledgements(xcb_connection_t *);
+
+    // Flushes done by flushDamageAcknowledgements() on any connection, each one write to the socket
+    static quint64 acknowledgementFlushes()
+    {
+        return acknowledgementFlushes_.load();
+    }
+
     void xcbEvent(const xcb_damage_notify_event_t *);
 
 Q_SIGNALS:
     void damaged();
+    void ready();
+    void drawn();
+    void invalidated();
     void destroyed(WindowPixmap *);
 
 private:
+    enum DetachedTag { Detached };
+
+    WindowPixmap(xcb_connection_t *, xcb_window_t, xcb_pixmap_t, xcb_damage_damage_t, const QSize &,
+                 DetachedTag);
+
+    void invalidate();
+
     xcb_connection_t *connection_;
+    xcb_connection_t *renderConnection_;
     xcb_window_t window_;
     bool valid_;
+    bool ready_;
+    bool drawn_;
     xcb_pixmap_t pixmap_;
     xcb_damage_damage_t damage_;
     QSize size_;
-    bool damaged_;
+    QRegion damageRegion_;
+    quint32 damageSerial_;
     xcb_visualid_t visual_;
+
+    void queueAcknowledgement();
+
+    // Queued acknowledgements per connection
+    static QMutex pendingMutex_;
+    static QHash<xcb_connection_t *, int> pendingAcknowledgements_;
+    static QAtomicInteger<quint64> acknowledgementFlushes_;
 };
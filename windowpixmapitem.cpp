@@ -1,19 +1,26 @@
 #include "windowpixmapitem.h"
 
-#include <QSGSimpleTextureNode>
+#include <QSGNode>
 
 #include "clientwindow.h"
+#include "windownode.h"
 #include "windowpixmap.h"
-#include "glxtexturefrompixmap.h"
+#include "windowshadowitem.h"
+#include "windowthumbnailitem.h"
+#include "windowtexture.h"
+#include "framescheduler.h"
 
 void WindowPixmapItem::registerQmlTypes()
 {
     qmlRegisterUncreatableType<ClientWindow>("Compositor", 1, 0, "ClientWindow", QString());
     qmlRegisterType<WindowPixmap>();
     qmlRegisterType<WindowPixmapItem>("Compositor", 1, 0, "WindowPixmap");
+    qmlRegisterType<WindowThumbnailItem>("Compositor", 1, 0, "WindowThumbnail");
+    qmlRegisterType<WindowShadowItem>("Compositor", 1, 0, "WindowShadow");
 }
 
 WindowPixmapItem::WindowPixmapItem()
+    : brightness_(0)
 {
     setFlag(ItemHasContents);
 }
@@ -37,50 +44,93 @@ void WindowPixmapItem::setClientWindow(ClientWindow *w)
     connect(clientWindow_.data(), SIGNAL(geometryChanged(QRect)), SLOT(updateImplicitSize()));
     connect(clientWindow_.data(), SIGNAL(mapStateChanged(bool)), SLOT(updateImplicitSize()));
     connect(clientWindow_.data(), SIGNAL(mapStateChanged(bool)), SLOT(update()));
+    connect(clientWindow_.data(), SIGNAL(pixmapChanged(WindowPixmap*)), SLOT(watchPixmap()));
+    connect(clientWindow_.data(), SIGNAL(occludedChanged(bool)), SLOT(update()));
     updateImplicitSize();
 
-    update();
+    watchPixmap();
     Q_EMIT clientWindowChanged();
 }
 
+// Runs on the GUI thread, where the pixmaps live; updatePaintNode only picks up the texture
+void WindowPixmapItem::watchPixmap()
+{
+    if (watchedPixmap_) {
+        watchedPixmap_->disconnect(this);
+    }
+    watchedPixmap_ = clientWindow_ ? clientWindow_->pixmap() : QSharedPointer<WindowPixmap>();
+    if (watchedPixmap_) {
+        connect(watchedPixmap_.data(), SIGNAL(damaged()), SLOT(pixmapDamaged()), Qt::UniqueConnection);
+    }
+    update();
+}
+
 QSGNode *WindowPixmapItem::updatePaintNode(QSGNode *old, UpdatePaintNodeData *)
 {
-    auto node = static_cast<QSGSimpleTextureNode *>(old);
-    auto pixmap = clientWindow_->pixmap();
-    if (!clientWindow_ || !pixmap || !pixmap->isValid()) {
-        delete node;
+    // The opacity node only exists to block the subtree of an occluded window
+    auto root = static_cast<QSGOpacityNode *>(old);
+    auto pixmap = clientWindow_ ? clientWindow_->pixmap() : QSharedPointer<WindowPixmap>();
+    if (!pixmap || !pixmap->isValid()) {
+        delete root;
         return Q_NULLPTR;
     }
 
-    if (!node) {
-        node = new QSGSimpleTextureNode;
+    if (!root) {
+        root = new QSGOpacityNode;
+        auto child = new WindowNode;
+        child->setFlag(QSGNode::OwnedByParent);
+        root->appendChildNode(child);
     }
+    auto node = static_cast<WindowNode *>(root->firstChild());
+
+    auto occluded = clientWindow_->isOccluded();
+    root->setOpacity(occluded ? 0 : 1);
 
-    auto texture = static_cast<GLXTextureFromPixmap *>(node->texture());
-    if (texture && pixmap_ != pixmap) {
-        delete texture;
-        texture = Q_NULLPTR;
+    auto texture = static_cast<WindowTexture *>(node->texture());
+    if (!texture || pixmap_ != pixmap) {
+        texture = WindowTexture::create(pixmap.data());
+        node->setTexture(texture, texture->isYInverted());
     }
     pixmap_ = pixmap;
 
-    if (!texture) {
-        texture = new GLXTextureFromPixmap(pixmap->pixmap(), pixmap->visual(), pixmap->size());
-        node->setTexture(texture);
-        node->setOwnsTexture(true);
-        if (texture->isYInverted()) {
-            node->setTextureCoordinatesTransform(QSGSimpleTextureNode::MirrorVertically);
-        } else {
-            node->setTextureCoordinatesTransform(QSGSimpleTextureNode::NoTransform);
-        }
-        connect(pixmap.data(), SIGNAL(damaged()), SLOT(update()));
-    }
-    node->setRect(0, 0, width(), height());
-    if (pixmap->isDamaged()) {
-        texture->rebind();
-        node->markDirty(QSGNode::DirtyMaterial);
+    // While a resized window waits for its new pixmap, the old one is stretched over it
+    node->setRect(QRectF(0, 0, width(), height()));
+    node->setBrightness(brightness_);
+    node->setFiltering(smooth() ? QSGTexture::Linear : QSGTexture::Nearest);
+
+    // Damage of an occluded window is kept until it becomes visible. It's subtracted before
+    // the contents are read: drawing in between is reported again instead of being lost.
+    if (pixmap->isDamaged() && !occluded) {
+        auto damage = pixmap->damageRegion();
         pixmap->clearDamage();
+        texture->update(damage);
+        node->markDirty(QSGNode::DirtyMaterial);
+        clientWindow_->pixmapRendered(pixmap.data());
+    }
+    return root;
+}
+
+void WindowPixmapItem::setBrightness(qreal brightness)
+{
+    if (brightness != brightness_) {
+        brightness_ = brightness;
+        update();
+        Q_EMIT brightnessChanged(brightness);
+    }
+}
+
+void WindowPixmapItem::pixmapDamaged()
+{
+    if (!clientWindow_ || clientWindow_->isOccluded()) {
+        return;
+    }
+
+    auto scheduler = FrameScheduler::forWindow(window());
+    if (scheduler) {
+        scheduler->scheduleUpdate(this);
+    } else {
+        update();
     }
-    return node;
 }
 
 void WindowPixmapItem::updateImplicitSize()
@@ -11,6 +11,7 @@ class WindowPixmapItem : public QQuickItem
     Q_OBJECT
 
     Q_PROPERTY(ClientWindow *clientWindow READ clientWindow WRITE setClientWindow NOTIFY clientWindowChanged)
+    Q_PROPERTY(qreal brightness READ brightness WRITE setBrightness NOTIFY brightnessChanged)
 public:
     WindowPixmapItem();
     ~WindowPixmapItem() Q_DECL_OVERRIDE;
@@ -21,18 +22,30 @@ public:
     }
     void setClientWindow(ClientWindow *);
 
+    // Added to the color channels when drawing, -1 to 1; negative values dim the window
+    qreal brightness() const
+    {
+        return brightness_;
+    }
+    void setBrightness(qreal);
+
     static void registerQmlTypes();
 
 Q_SIGNALS:
     void clientWindowChanged();
+    void brightnessChanged(qreal brightness);
 
 protected:
     QSGNode *updatePaintNode(QSGNode *, UpdatePaintNodeData *) Q_DECL_OVERRIDE;
 
 private Q_SLOTS:
     void updateImplicitSize();
+    void watchPixmap();
+    void pixmapDamaged();
 
 private:
     QSharedPointer<ClientWindow> clientWindow_;
     QSharedPointer<WindowPixmap> pixmap_;
+    QSharedPointer<WindowPixmap> watchedPixmap_;
+    qreal brightness_;
 };
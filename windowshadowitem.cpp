@@ -0,0 +1,278 @@
+#include "windowshadowitem.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include <QAtomicInteger>
+#include <QHash>
+#include <QMutex>
+#include <QQuickWindow>
+#include <QSGGeometryNode>
+#include <QSGSimpleMaterial>
+#include <QSharedPointer>
+#include <QVector>
+#include <QVector4D>
+
+struct ShadowState
+{
+    QSGTexture *texture;
+    QColor color;
+
+    // Equal states are drawn in one batch
+    int compare(const ShadowState *other) const
+    {
+        if (texture != other->texture) {
+            return texture < other->texture ? -1 : 1;
+        }
+        auto rgba = color.rgba();
+        auto otherRgba = other->color.rgba();
+        return rgba == otherRgba ? 0 : (rgba < otherRgba ? -1 : 1);
+    }
+};
+
+class ShadowShader : public QSGSimpleMaterialShader<ShadowState>
+{
+    QSG_DECLARE_SIMPLE_COMPARABLE_SHADER(ShadowShader, ShadowState)
+public:
+    ShadowShader()
+        : colorLocation_(-1)
+    {
+    }
+
+    const char *vertexShader() const Q_DECL_OVERRIDE
+    {
+        return "attribute highp vec4 vertex;\n"
+               "attribute highp vec2 coord;\n"
+               "uniform highp mat4 qt_Matrix;\n"
+               "varying highp vec2 texCoord;\n"
+               "void main() {\n"
+               "    texCoord = coord;\n"
+               "    gl_Position = qt_Matrix * vertex;\n"
+               "}\n";
+    }
+
+    const char *fragmentShader() const Q_DECL_OVERRIDE
+    {
+        return "uniform lowp float qt_Opacity;\n"
+               "uniform lowp vec4 color;\n"
+               "uniform lowp sampler2D source;\n"
+               "varying highp vec2 texCoord;\n"
+               "void main() {\n"
+               "    gl_FragColor = color * (texture2D(source, texCoord).a * qt_Opacity);\n"
+               "}\n";
+    }
+
+    QList<QByteArray> attributes() const Q_DECL_OVERRIDE
+    {
+        return QList<QByteArray>() << "vertex" << "coord";
+    }
+
+    void resolveUniforms() Q_DECL_OVERRIDE
+    {
+        colorLocation_ = program()->uniformLocation("color");
+    }
+
+    void updateState(const ShadowState *state, const ShadowState *) Q_DECL_OVERRIDE
+    {
+        auto &color = state->color;
+        auto alpha = color.alphaF();
+        program()->setUniformValue(colorLocation_, QVector4D(color.redF() * alpha, color.greenF() * alpha,
+                                                             color.blueF() * alpha, alpha));
+        state->texture->bind();
+    }
+
+private:
+    int colorLocation_;
+};
+
+// 4x4 vertices: the outer edge of the shadow, the item's edges, and the fade in between.
+// Only the eight quads around the item are drawn; the window covers the middle one, and
+// blending a full-window fill under it would cost as much as drawing the window again.
+class ShadowNode : public QSGGeometryNode
+{
+public:
+    ShadowNode()
+        : radius(0),
+          geometry_(QSGGeometry::defaultAttributes_TexturedPoint2D(), 16, 48)
+    {
+        geometry_.setDrawingMode(GL_TRIANGLES);
+        auto indices = geometry_.indexDataAsUShort();
+        for (int row = 0; row < 3; row++) {
+            for (int column = 0; column < 3; column++) {
+                if (row == 1 && column == 1) {
+                    continue;
+                }
+                quint16 corner = row * 4 + column;
+                const quint16 quad[] = { corner, quint16(corner + 1), quint16(corner + 4),
+                                         quint16(corner + 1), quint16(corner + 5), quint16(corner + 4) };
+                std::copy(quad, quad + 6, indices);
+                indices += 6;
+            }
+        }
+        setGeometry(&geometry_);
+
+        auto material = ShadowShader::createMaterial();
+        material->setFlag(QSGMaterial::Blending);
+        setMaterial(material);
+        setFlag(OwnsMaterial);
+    }
+
+    ShadowState *state()
+    {
+        return static_cast<QSGSimpleMaterial<ShadowState> *>(material())->state();
+    }
+
+    void setRect(const QRectF &rect)
+    {
+        const qreal xs[] = { rect.left() - radius, rect.left(), rect.right(), rect.right() + radius };
+        const qreal ys[] = { rect.top() - radius, rect.top(), rect.bottom(), rect.bottom() + radius };
+
+        // Inner lines are at the middle of the opaque texels, so the stretched part is flat
+        float size = 2 * (radius + 1);
+        const float coords[] = { 0, (radius + 0.5f) / size, (radius + 1.5f) / size, 1 };
+
+        auto vertices = geometry_.vertexDataAsTexturedPoint2D();
+        for (int row = 0; row < 4; row++) {
+            for (int column = 0; column < 4; column++) {
+                vertices[row * 4 + column].set(xs[column], ys[row], coords[column], coords[row]);
+            }
+        }
+        markDirty(DirtyGeometry);
+    }
+
+    int radius;
+    QSharedPointer<QSGTexture> texture;
+
+private:
+    QSGGeometry geometry_;
+};
+
+// Each window has its own GL context, so textures are shared per window and radius. The
+// last node using one deletes it, on the render thread.
+static QMutex texturesMutex;
+static QHash<QPair<QQuickWindow *, int>, QWeakPointer<QSGTexture>> textures;
+static QAtomicInteger<qint64> texturesBytes;
+
+static QSharedPointer<QSGTexture> sharedTexture(QQuickWindow *window, int radius)
+{
+    QMutexLocker lock(&texturesMutex);
+    auto &entry = textures[qMakePair(window, radius)];
+    auto texture = entry.toStrongRef();
+    if (!texture) {
+        auto image = WindowShadowItem::shadowImage(radius);
+        qint64 bytes = image.byteCount();
+        texture.reset(window->createTextureFromImage(image), [bytes](QSGTexture *t) {
+            texturesBytes.fetchAndAddRelaxed(-bytes);
+            delete t;
+        });
+        texture->setFiltering(QSGTexture::Linear);
+        texture->setHorizontalWrapMode(QSGTexture::ClampToEdge);
+        texture->setVerticalWrapMode(QSGTexture::ClampToEdge);
+        texturesBytes.fetchAndAddRelaxed(bytes);
+        entry = texture;
+    }
+    return texture;
+}
+
+qint64 WindowShadowItem::textureBytes()
+{
+    return texturesBytes.load();
+}
+
+QImage WindowShadowItem::shadowImage(int radius)
+{
+    radius = qMax(radius, 1);
+    int size = 2 * (radius + 1);
+
+    // The item's edge blurred with a Gaussian centered half way out, so it has faded in at
+    // the edge and out at radius. Blurring a rectangle is separable, so one side's profile
+    // is all that needs the kernel.
+    auto sigma = radius / 4.0;
+    auto alpha = [=](qreal distance) {
+        return 0.5 * std::erfc((distance - radius / 2.0) / (sigma * M_SQRT2));
+    };
+
+    // Texels 0 to radius span the fade, from the outer edge to the middle of the first
+    // opaque texel; normalized so those two are exactly 0 and 1
+    QVector<float> profile(size);
+    auto distance = [=](int texel) {
+        return radius - (texel + 0.5) * radius / (radius + 0.5);
+    };
+    auto outer = alpha(distance(0));
+    auto inner = alpha(distance(radius));
+    for (int i = 0; i <= radius; i++) {
+        auto value = float((alpha(distance(i)) - outer) / (inner - outer));
+        profile[i] = value;
+        profile[size - 1 - i] = value;
+    }
+
+    QImage image(size, size, QImage::Format_ARGB32_Premultiplied);
+    for (int y = 0; y < size; y++) {
+        auto line = reinterpret_cast<QRgb *>(image.scanLine(y));
+        auto row = profile[y] * 255;
+        for (int x = 0; x < size; x++) {
+            auto a = uint(profile[x] * row + 0.5f);
+            line[x] = (a << 24) | (a << 16) | (a << 8) | a;
+        }
+    }
+    return image;
+}
+
+WindowShadowItem::WindowShadowItem()
+    : radius_(10),
+      color_(Qt::black)
+{
+    setFlag(ItemHasContents);
+}
+
+WindowShadowItem::~WindowShadowItem()
+{
+}
+
+void WindowShadowItem::setRadius(int radius)
+{
+    radius = qMax(radius, 0);
+    if (radius != radius_) {
+        radius_ = radius;
+        update();
+        Q_EMIT radiusChanged(radius);
+    }
+}
+
+void WindowShadowItem::setColor(const QColor &color)
+{
+    if (color != color_) {
+        color_ = color;
+        update();
+        Q_EMIT colorChanged(color);
+    }
+}
+
+void WindowShadowItem::geometryChanged(const QRectF &newGeometry, const QRectF &oldGeometry)
+{
+    QQuickItem::geometryChanged(newGeometry, oldGeometry);
+    update();
+}
+
+QSGNode *WindowShadowItem::updatePaintNode(QSGNode *old, UpdatePaintNodeData *)
+{
+    auto node = static_cast<ShadowNode *>(old);
+    if (radius_ <= 0 || color_.alpha() == 0 || width() <= 0 || height() <= 0) {
+        delete node;
+        return Q_NULLPTR;
+    }
+
+    if (!node) {
+        node = new ShadowNode;
+    }
+
+    if (!node->texture || node->radius != radius_) {
+        node->texture = sharedTexture(window(), radius_);
+        node->radius = radius_;
+    }
+    node->state()->texture = node->texture.data();
+    node->state()->color = color_;
+    node->markDirty(QSGNode::DirtyMaterial);
+    node->setRect(boundingRect());
+    return node;
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <QColor>
+#include <QImage>
+#include <QQuickItem>
+
+// Drop shadow drawn as the border of a nine-patch around the item, fading out over radius
+// pixels outside of it. Nothing is drawn over the item's own area. Every shadow with the same radius in a window
+// samples one small texture, so unlike a cached RectangularGlow there is no offscreen
+// buffer per item, resizing costs nothing, and shadows of the same color batch together.
+class WindowShadowItem : public QQuickItem
+{
+    Q_OBJECT
+
+    Q_PROPERTY(int radius READ radius WRITE setRadius NOTIFY radiusChanged)
+    Q_PROPERTY(QColor color READ color WRITE setColor NOTIFY colorChanged)
+public:
+    WindowShadowItem();
+    ~WindowShadowItem() Q_DECL_OVERRIDE;
+
+    int radius() const
+    {
+        return radius_;
+    }
+    void setRadius(int);
+
+    QColor color() const
+    {
+        return color_;
+    }
+    void setColor(const QColor &);
+
+    // Texture contents for a radius: 2 * (radius + 1) texels square, premultiplied white
+    // with the shadow's alpha. The middle two rows and columns are opaque and get stretched
+    // along the item's edges.
+    static QImage shadowImage(int radius);
+
+    // Memory taken by the shared textures of all windows
+    static qint64 textureBytes();
+
+Q_SIGNALS:
+    void radiusChanged(int radius);
+    void colorChanged(const QColor &color);
+
+protected:
+    QSGNode *updatePaintNode(QSGNode *, UpdatePaintNodeData *) Q_DECL_OVERRIDE;
+    void geometryChanged(const QRectF &newGeometry, const QRectF &oldGeometry) Q_DECL_OVERRIDE;
+
+private:
+    int radius_;
+    QColor color_;
+};
@@ -0,0 +1,68 @@
+#include "windowtexture.h"
+
+#include <QAtomicInt>
+#include <QDebug>
+#include <QOpenGLContext>
+#include <QOpenGLFunctions>
+
+#include "glxtexturefrompixmap.h"
+#include "shmtexture.h"
+#include "windowpixmap.h"
+
+static QAtomicInt currentBackend(WindowTexture::AutoBackend);
+
+WindowTexture::Backend WindowTexture::backend()
+{
+    return static_cast<Backend>(currentBackend.load());
+}
+
+void WindowTexture::setBackend(Backend backend)
+{
+    currentBackend.store(backend);
+}
+
+// With llvmpipe and friends, binding a pixmap copies all of it on every damage
+static bool isSoftwareRenderer()
+{
+    static const bool software = []() {
+        auto renderer = QByteArray(reinterpret_cast<const char *>(
+                QOpenGLContext::currentContext()->functions()->glGetString(GL_RENDERER)));
+        auto result = renderer.contains("llvmpipe") || renderer.contains("softpipe") ||
+                renderer.contains("Software Rasterizer");
+        if (result) {
+            qDebug() << "Software renderer" << renderer << "- using MIT-SHM window textures";
+        }
+        return result;
+    }();
+    return software;
+}
+
+void WindowTexture::prepareBackend()
+{
+    // The GLX visuals are only needed for texture-from-pixmap
+    if (backend() == SharedMemory || (backend() == AutoBackend && isSoftwareRenderer())) {
+        return;
+    }
+    GLXTextureFromPixmap::prepareVisuals();
+}
+
+WindowTexture *WindowTexture::create(WindowPixmap *pixmap)
+{
+    auto useShm = false;
+    switch (backend()) {
+    case TextureFromPixmap:
+        break;
+    case SharedMemory:
+        useShm = ShmTexture::isSupported(pixmap->renderConnection());
+        break;
+    default:
+        useShm = ShmTexture::isSupported(pixmap->renderConnection()) &&
+                (isSoftwareRenderer() || !GLXTextureFromPixmap::isSupported(pixmap->visual()));
+        break;
+    }
+
+    if (useShm) {
+        return new ShmTexture(pixmap->renderConnection(), pixmap->pixmap(), pixmap->visual(), pixmap->size());
+    }
+    return new GLXTextureFromPixmap(pixmap->pixmap(), pixmap->visual(), pixmap->size());
+}
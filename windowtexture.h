@@ -0,0 +1,44 @@
+#pragma once
+
+#include <QRegion>
+#include <QSGTexture>
+
+class WindowPixmap;
+
+// Texture showing the contents of a window pixmap, for the render thread
+class WindowTexture : public QSGTexture
+{
+    Q_OBJECT
+public:
+    enum Backend {
+        // Texture-from-pixmap where it's available and not done in software, MIT-SHM otherwise
+        AutoBackend,
+        // GLX_EXT_texture_from_pixmap: the pixmap is bound as a texture
+        TextureFromPixmap,
+        // MIT-SHM: damaged rectangles are read into shared memory and uploaded
+        SharedMemory
+    };
+
+    // Backend for textures created from now on
+    static Backend backend();
+    static void setBackend(Backend);
+
+    // Needs a current GL context
+    static WindowTexture *create(WindowPixmap *);
+    // Sets up the backend that create() is going to pick, ahead of the first texture.
+    // Needs a current GL context.
+    static void prepareBackend();
+
+    // Texture contents are updated with the given damage before the next draw
+    virtual void update(const QRegion &damage) = 0;
+
+    // Whether the first row of the texture is the bottom row of the window
+    virtual bool isYInverted() const = 0;
+
+    // Memory held besides the pixmap itself: copies of its contents, in the GL texture or
+    // on the client side. 0 where the texture is the pixmap.
+    virtual qint64 bytes() const
+    {
+        return 0;
+    }
+};
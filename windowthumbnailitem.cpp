@@ -0,0 +1,270 @@
+#include "windowthumbnailitem.h"
+
+#include <cmath>
+
+#include <QAtomicInteger>
+#include <QQuickWindow>
+#include <QSGGeometryNode>
+#include <QSGTextureMaterial>
+
+#include "clientwindow.h"
+#include "thumbnailtexture.h"
+#include "windowpixmap.h"
+#include "windowtexture.h"
+
+static QAtomicInteger<qint64> totalBytes;
+
+// Textures of the node are owned by it, so they go away on the render thread
+class ThumbnailNode : public QSGGeometryNode
+{
+public:
+    ThumbnailNode()
+        : geometry_(QSGGeometry::defaultAttributes_TexturedPoint2D(), 4),
+          reportedBytes(0),
+          reportedActive(false)
+    {
+        setGeometry(&geometry_);
+        setMaterial(&material_);
+        setOpaqueMaterial(&opaqueMaterial_);
+        material_.setFiltering(QSGTexture::Linear);
+        opaqueMaterial_.setFiltering(QSGTexture::Linear);
+    }
+
+    ~ThumbnailNode()
+    {
+        totalBytes.fetchAndAddRelaxed(-reportedBytes);
+    }
+
+    void setTexture(QSGTexture *texture, bool yInverted, const QRectF &rect)
+    {
+        material_.setTexture(texture);
+        opaqueMaterial_.setTexture(texture);
+        auto mipmapFiltering = texture->hasMipmaps() ? QSGTexture::Linear : QSGTexture::None;
+        material_.setMipmapFiltering(mipmapFiltering);
+        opaqueMaterial_.setMipmapFiltering(mipmapFiltering);
+
+        auto sourceRect = texture->normalizedTextureSubRect();
+        if (yInverted) {
+            sourceRect = QRectF(sourceRect.left(), sourceRect.bottom(), sourceRect.width(), -sourceRect.height());
+        }
+        QSGGeometry::updateTexturedRectGeometry(&geometry_, rect, sourceRect);
+        markDirty(DirtyMaterial | DirtyGeometry);
+    }
+
+    QScopedPointer<WindowTexture> source;
+    QScopedPointer<ThumbnailTexture> thumbnail;
+
+private:
+    QSGGeometry geometry_;
+    QSGTextureMaterial material_;
+    QSGOpaqueTextureMaterial opaqueMaterial_;
+
+public:
+    qint64 reportedBytes;
+    bool reportedActive;
+};
+
+WindowThumbnailItem::WindowThumbnailItem()
+    : threshold_(0.5),
+      maxRefreshRate_(5),
+      renderedSerial_(0),
+      cacheBytes_(0),
+      thumbnailActive_(false)
+{
+    setFlag(ItemHasContents);
+    refreshTimer_.setSingleShot(true);
+    connect(&refreshTimer_, SIGNAL(timeout()), SLOT(refresh()));
+    connect(this, SIGNAL(visibleChanged()), SLOT(scheduleRefresh()));
+    connect(this, SIGNAL(windowChanged(QQuickWindow*)), SLOT(watchWindow(QQuickWindow*)));
+}
+
+WindowThumbnailItem::~WindowThumbnailItem()
+{
+}
+
+qint64 WindowThumbnailItem::totalCacheBytes()
+{
+    return totalBytes.load();
+}
+
+void WindowThumbnailItem::setClientWindow(ClientWindow *w)
+{
+    if (w == clientWindow_.data()) {
+        return;
+    }
+
+    if (clientWindow_) {
+        clientWindow_->disconnect(this);
+    }
+
+    clientWindow_ = w ? w->sharedFromThis() : QSharedPointer<ClientWindow>();
+    if (clientWindow_) {
+        connect(clientWindow_.data(), SIGNAL(mapStateChanged(bool)), SLOT(update()));
+        connect(clientWindow_.data(), SIGNAL(pixmapChanged(WindowPixmap*)), SLOT(watchPixmap()));
+    }
+
+    watchPixmap();
+    Q_EMIT clientWindowChanged();
+}
+
+void WindowThumbnailItem::watchPixmap()
+{
+    if (watchedPixmap_) {
+        watchedPixmap_->disconnect(this);
+    }
+    watchedPixmap_ = clientWindow_ ? clientWindow_->pixmap() : QSharedPointer<WindowPixmap>();
+    if (watchedPixmap_) {
+        connect(watchedPixmap_.data(), SIGNAL(damaged()), SLOT(scheduleRefresh()));
+    } else {
+        refreshTimer_.stop();
+    }
+    update();
+}
+
+void WindowThumbnailItem::watchWindow(QQuickWindow *window)
+{
+    if (watchedWindow_) {
+        watchedWindow_->disconnect(this);
+    }
+    watchedWindow_ = window;
+    if (window) {
+        connect(window, SIGNAL(afterAnimating()), SLOT(checkShownSize()));
+    }
+}
+
+void WindowThumbnailItem::setThreshold(qreal threshold)
+{
+    if (threshold != threshold_) {
+        threshold_ = threshold;
+        update();
+        Q_EMIT thresholdChanged(threshold);
+    }
+}
+
+void WindowThumbnailItem::setMaxRefreshRate(int rate)
+{
+    rate = qMax(rate, 1);
+    if (rate != maxRefreshRate_) {
+        maxRefreshRate_ = rate;
+        Q_EMIT maxRefreshRateChanged(rate);
+    }
+}
+
+void WindowThumbnailItem::geometryChanged(const QRectF &newGeometry, const QRectF &oldGeometry)
+{
+    QQuickItem::geometryChanged(newGeometry, oldGeometry);
+    update();
+}
+
+void WindowThumbnailItem::scheduleRefresh()
+{
+    if (refreshTimer_.isActive()) {
+        return;
+    }
+    auto wait = lastRefresh_.isValid() ? 1000 / maxRefreshRate_ - lastRefresh_.elapsed() : 0;
+    refreshTimer_.start(int(qMax<qint64>(wait, 0)));
+}
+
+void WindowThumbnailItem::refresh()
+{
+    if (!clientWindow_ || !isVisible()) {
+        return;
+    }
+
+    auto pixmap = clientWindow_->pixmap();
+    if (pixmap != pixmap_ || (pixmap && pixmap->damageSerial() != renderedSerial_)) {
+        lastRefresh_.start();
+        update();
+    }
+}
+
+void WindowThumbnailItem::checkShownSize()
+{
+    // Scaled by an ancestor so that another level fits better. Runs only when the scene is
+    // about to be drawn anyway.
+    if (clientWindow_ && isVisible() && mapRectToScene(boundingRect()).size() != shownSize_) {
+        update();
+    }
+}
+
+void WindowThumbnailItem::setCache(qint64 bytes, bool thumbnailActive)
+{
+    if (bytes != cacheBytes_ || thumbnailActive != thumbnailActive_) {
+        cacheBytes_ = bytes;
+        thumbnailActive_ = thumbnailActive;
+        Q_EMIT cacheChanged();
+    }
+}
+
+QSGNode *WindowThumbnailItem::updatePaintNode(QSGNode *old, UpdatePaintNodeData *)
+{
+    auto node = static_cast<ThumbnailNode *>(old);
+    auto pixmap = clientWindow_ ? clientWindow_->pixmap() : QSharedPointer<WindowPixmap>();
+    if (!pixmap || !pixmap->isValid() || pixmap->size().isEmpty() || width() <= 0 || height() <= 0) {
+        if (node && (node->reportedBytes || node->reportedActive)) {
+            QMetaObject::invokeMethod(this, "setCache", Qt::QueuedConnection,
+                                      Q_ARG(qint64, 0), Q_ARG(bool, false));
+        }
+        delete node;
+        pixmap_.reset();
+        return Q_NULLPTR;
+    }
+
+    if (!node) {
+        node = new ThumbnailNode;
+    }
+
+    auto refresh = pixmap->damageSerial() != renderedSerial_;
+    if (pixmap != pixmap_) {
+        node->thumbnail.reset();
+        node->source.reset();
+        pixmap_ = pixmap;
+    }
+    if (!node->source) {
+        node->source.reset(WindowTexture::create(pixmap.data()));
+        refresh = true;
+    }
+
+    // Levels are only worth it when at least one halving fits into the size on screen
+    shownSize_ = mapRectToScene(boundingRect()).size();
+    auto scale = qMax(shownSize_.width() / pixmap->size().width(), shownSize_.height() / pixmap->size().height());
+    int reduction = 0;
+    if (scale > 0 && scale < threshold_) {
+        reduction = qMin(int(std::floor(std::log2(1 / scale))), int(ThumbnailTexture::MaxReduction));
+    }
+    if (reduction <= 0) {
+        node->thumbnail.reset();
+    } else if (!node->thumbnail || node->thumbnail->reduction() != reduction) {
+        node->thumbnail.reset(new ThumbnailTexture(pixmap->size(), reduction, node->source->hasAlphaChannel()));
+        refresh = true;
+    }
+
+    // The whole pixmap is read again; its damage region belongs to the WindowPixmap item.
+    // Acknowledged first, so drawing during the read is reported again.
+    if (refresh) {
+        renderedSerial_ = pixmap->damageSerial();
+        pixmap->acknowledgeDamage();
+        node->source->update(QRect(QPoint(), pixmap->size()));
+        if (node->thumbnail) {
+            node->thumbnail->render(node->source.data());
+            window()->resetOpenGLState();
+        }
+    }
+
+    if (node->thumbnail) {
+        node->setTexture(node->thumbnail.data(), node->source->isYInverted(), boundingRect());
+    } else {
+        node->setTexture(node->source.data(), node->source->isYInverted(), boundingRect());
+    }
+
+    auto bytes = node->source->bytes() + (node->thumbnail ? node->thumbnail->bytes() : 0);
+    bool active = node->thumbnail;
+    if (bytes != node->reportedBytes || active != node->reportedActive) {
+        totalBytes.fetchAndAddRelaxed(bytes - node->reportedBytes);
+        node->reportedBytes = bytes;
+        node->reportedActive = active;
+        QMetaObject::invokeMethod(this, "setCache", Qt::QueuedConnection,
+                                  Q_ARG(qint64, bytes), Q_ARG(bool, active));
+    }
+    return node;
+}
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <QElapsedTimer>
+#include <QPointer>
+#include <QQuickItem>
+#include <QSharedPointer>
+#include <QTimer>
+
+class ClientWindow;
+class WindowPixmap;
+
+// Window contents for overviews, task switchers and scale animations. Shown below
+// threshold times the window size on screen, the window is drawn from a mipmapped
+// thumbnail (ThumbnailTexture) instead of the full-size texture; at or above it, the
+// window texture is drawn as is and no thumbnail is kept.
+//
+// Contents follow damage at most maxRefreshRate times per second in both cases, and
+// don't take damage away from the WindowPixmap item of the same window. Nothing runs
+// while the window isn't damaged.
+class WindowThumbnailItem : public QQuickItem
+{
+    Q_OBJECT
+
+    Q_PROPERTY(ClientWindow *clientWindow READ clientWindow WRITE setClientWindow NOTIFY clientWindowChanged)
+    Q_PROPERTY(qreal threshold READ threshold WRITE setThreshold NOTIFY thresholdChanged)
+    Q_PROPERTY(int maxRefreshRate READ maxRefreshRate WRITE setMaxRefreshRate NOTIFY maxRefreshRateChanged)
+    Q_PROPERTY(bool thumbnailActive READ isThumbnailActive NOTIFY cacheChanged)
+    Q_PROPERTY(qint64 cacheBytes READ cacheBytes NOTIFY cacheChanged)
+public:
+    WindowThumbnailItem();
+    ~WindowThumbnailItem() Q_DECL_OVERRIDE;
+
+    ClientWindow *clientWindow() const
+    {
+        return clientWindow_.data();
+    }
+    void setClientWindow(ClientWindow *);
+
+    // Fraction of the window size below which the thumbnail is used; 0.5 by default
+    qreal threshold() const
+    {
+        return threshold_;
+    }
+    void setThreshold(qreal);
+
+    int maxRefreshRate() const
+    {
+        return maxRefreshRate_;
+    }
+    void setMaxRefreshRate(int);
+
+    bool isThumbnailActive() const
+    {
+        return thumbnailActive_;
+    }
+
+    // Memory of this item's textures: the thumbnail, and the window texture it is made from
+    // where that holds a copy of the window (MIT-SHM)
+    qint64 cacheBytes() const
+    {
+        return cacheBytes_;
+    }
+
+    // Memory of all items' textures
+    static qint64 totalCacheBytes();
+
+Q_SIGNALS:
+    void clientWindowChanged();
+    void thresholdChanged(qreal threshold);
+    void maxRefreshRateChanged(int maxRefreshRate);
+    void cacheChanged();
+
+protected:
+    QSGNode *updatePaintNode(QSGNode *, UpdatePaintNodeData *) Q_DECL_OVERRIDE;
+    void geometryChanged(const QRectF &newGeometry, const QRectF &oldGeometry) Q_DECL_OVERRIDE;
+
+private Q_SLOTS:
+    void watchPixmap();
+    void watchWindow(QQuickWindow *);
+    void scheduleRefresh();
+    void refresh();
+    void checkShownSize();
+    void setCache(qint64 bytes, bool thumbnailActive);
+
+private:
+    QSharedPointer<ClientWindow> clientWindow_;
+    // The pixmap whose damage starts refreshTimer_
+    QSharedPointer<WindowPixmap> watchedPixmap_;
+    QPointer<QQuickWindow> watchedWindow_;
+    QSharedPointer<WindowPixmap> pixmap_;
+    qreal threshold_;
+    int maxRefreshRate_;
+    QTimer refreshTimer_;
+    QElapsedTimer lastRefresh_;
+
+    // Written during sync
+    quint32 renderedSerial_;
+    QSizeF shownSize_;
+
+    qint64 cacheBytes_;
+    bool thumbnailActive_;
+};
@@ -0,0 +1,124 @@
+#include "xcbasyncreplies.h"
+
+#include <QCoreApplication>
+#include <QThread>
+
+// Replies that arrive without accompanying events don't wake up the event loop. Polling
+// starts at MinPollInterval and doubles up to MaxPollInterval until the queue is empty.
+static const int MinPollInterval = 1;
+static const int MaxPollInterval = 100;
+
+XcbAsyncReplies *XcbAsyncReplies::instance(xcb_connection_t *connection)
+{
+    static QHash<xcb_connection_t *, XcbAsyncReplies *> instances;
+    static QMutex instancesMutex;
+
+    QMutexLocker lock(&instancesMutex);
+    auto &instance = instances[connection];
+    if (!instance) {
+        instance = new XcbAsyncReplies(connection);
+        instance->moveToThread(QCoreApplication::instance()->thread());
+    }
+    return instance;
+}
+
+XcbAsyncReplies::~XcbAsyncReplies()
+{
+    if (filterInstalled_ && QCoreApplication::instance()) {
+        QCoreApplication::instance()->removeNativeEventFilter(this);
+    }
+}
+
+XcbAsyncReplies::XcbAsyncReplies(xcb_connection_t *connection, QObject *parent)
+    : QObject(parent),
+      connection_(connection),
+      pollTimer_(this),
+      pollInterval_(MinPollInterval),
+      filterInstalled_(false)
+{
+    pollTimer_.setSingleShot(true);
+    connect(&pollTimer_, SIGNAL(timeout()), SLOT(processReplies()));
+}
+
+int XcbAsyncReplies::pendingCount() const
+{
+    QMutexLocker lock(&mutex_);
+    return pending_.size();
+}
+
+void XcbAsyncReplies::enqueue(unsigned int sequence, QObject *context,
+                              const std::function<void (void *, xcb_generic_error_t *)> &continuation)
+{
+    PendingRequest request;
+    request.sequence = sequence;
+    request.context = context;
+    request.continuation = continuation;
+
+    {
+        QMutexLocker lock(&mutex_);
+        pending_.enqueue(request);
+    }
+
+    if (QThread::currentThread() == thread()) {
+        schedule();
+    } else {
+        QMetaObject::invokeMethod(this, "schedule", Qt::QueuedConnection);
+    }
+}
+
+void XcbAsyncReplies::schedule()
+{
+    if (!filterInstalled_) {
+        QCoreApplication::instance()->installNativeEventFilter(this);
+        filterInstalled_ = true;
+    }
+
+    pollInterval_ = MinPollInterval;
+    if (!pollTimer_.isActive()) {
+        pollTimer_.start(0);
+    }
+}
+
+bool XcbAsyncReplies::nativeEventFilter(const QByteArray &eventType, void *, long *)
+{
+    // Replies often come with events; continuations run after the event has been handled
+    if (eventType == "xcb_generic_event_t" && pendingCount() && pollTimer_.remainingTime() != 0) {
+        pollTimer_.start(0);
+    }
+    return false;
+}
+
+void XcbAsyncReplies::processReplies()
+{
+    xcb_flush(connection_);
+
+    QMutexLocker lock(&mutex_);
+    if (xcb_connection_has_error(connection_)) {
+        pending_.clear();
+        return;
+    }
+
+    while (!pending_.isEmpty()) {
+        void *reply = Q_NULLPTR;
+        xcb_generic_error_t *error = Q_NULLPTR;
+        if (!xcb_poll_for_reply(connection_, pending_.head().sequence, &reply, &error)) {
+            break;
+        }
+
+        auto request = pending_.dequeue();
+        lock.unlock();
+        if (request.context) {
+            request.continuation(reply, error);
+        }
+        std::free(reply);
+        std::free(error);
+        lock.relock();
+    }
+
+    if (pending_.isEmpty()) {
+        pollInterval_ = MinPollInterval;
+    } else {
+        pollTimer_.start(pollInterval_);
+        pollInterval_ = qMin(pollInterval_ * 2, MaxPollInterval);
+    }
+}
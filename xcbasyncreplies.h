@@ -0,0 +1,76 @@
+#pragma once
+
+#include <functional>
+
+#include <QAbstractNativeEventFilter>
+#include <QHash>
+#include <QMutex>
+#include <QObject>
+#include <QPointer>
+#include <QQueue>
+#include <QTimer>
+
+#include <xcb/xcb.h>
+
+// Completes X requests from the event loop instead of blocking in *_reply().
+// Continuations run on the thread that owns the XcbAsyncReplies object, in
+// request order, and only while their context object is alive. Requests must
+// be sent with checked cookies, so that errors are delivered to the
+// continuation instead of the event queue. Reply and error are freed after the
+// continuation returns.
+//
+// Qt's event reader thread may read replies off the socket, so there is nothing to wait on:
+// replies are collected after every dispatched X event, and by a timer that backs off
+// while replies are outstanding. Nothing runs while nothing is pending.
+class XcbAsyncReplies : public QObject,
+                        public QAbstractNativeEventFilter
+{
+    Q_OBJECT
+public:
+    ~XcbAsyncReplies() Q_DECL_OVERRIDE;
+
+    template<typename Reply>
+    using Continuation = std::function<void (Reply *reply, xcb_generic_error_t *error)>;
+
+    // Continuations are run on the GUI thread
+    static XcbAsyncReplies *instance(xcb_connection_t *);
+
+    // May be called from any thread
+    template<typename Reply, typename Cookie>
+    void await(Cookie cookie, QObject *context, Continuation<Reply> continuation)
+    {
+        enqueue(cookie.sequence, context, [continuation](void *reply, xcb_generic_error_t *error) {
+            continuation(static_cast<Reply *>(reply), error);
+        });
+    }
+
+    int pendingCount() const;
+
+    bool nativeEventFilter(const QByteArray &eventType, void *message, long *result) Q_DECL_OVERRIDE;
+
+public Q_SLOTS:
+    void processReplies();
+
+private Q_SLOTS:
+    void schedule();
+
+private:
+    explicit XcbAsyncReplies(xcb_connection_t *, QObject *parent = Q_NULLPTR);
+
+    struct PendingRequest
+    {
+        unsigned int sequence;
+        QPointer<QObject> context;
+        std::function<void (void *, xcb_generic_error_t *)> continuation;
+    };
+
+    void enqueue(unsigned int sequence, QObject *context,
+                 const std::function<void (void *, xcb_generic_error_t *)> &continuation);
+
+    xcb_connection_t *connection_;
+    mutable QMutex mutex_;
+    QQueue<PendingRequest> pending_;
+    QTimer pollTimer_;
+    int pollInterval_;
+    bool filterInstalled_;
+};
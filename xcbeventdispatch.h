@@ -0,0 +1,56 @@
+#pragma once
+
+#include <xcb/xcb.h>
+#include <xcb/damage.h>
+#include <xcb/xcb_event.h>
+
+// Per-event hot path, shared by Compositor and bench_dispatch (which runs it against
+// a stand-in registry, without an X server).
+
+// Decodes an event read from the X connection and passes it to handler->xcbEvent() for
+// its type. DamageNotify gets its response type from the server, so it's passed in.
+// Returns false for events the handler doesn't care about.
+template<typename Handler>
+bool xcbDecodeEvent(Handler *handler, uint8_t damageNotify, const xcb_generic_event_t *event)
+{
+    auto responseType = XCB_EVENT_RESPONSE_TYPE(event);
+    if (responseType == damageNotify) {
+        return handler->xcbEvent(reinterpret_cast<const xcb_damage_notify_event_t *>(event));
+    }
+
+    switch (responseType) {
+    case XCB_CREATE_NOTIFY:
+        return handler->xcbEvent(reinterpret_cast<const xcb_create_notify_event_t *>(event));
+    case XCB_DESTROY_NOTIFY:
+        return handler->xcbEvent(reinterpret_cast<const xcb_destroy_notify_event_t *>(event));
+    case XCB_REPARENT_NOTIFY:
+        return handler->xcbEvent(reinterpret_cast<const xcb_reparent_notify_event_t *>(event));
+    case XCB_CONFIGURE_NOTIFY:
+        return handler->xcbEvent(reinterpret_cast<const xcb_configure_notify_event_t *>(event));
+    case XCB_MAP_NOTIFY:
+        return handler->xcbEvent(reinterpret_cast<const xcb_map_notify_event_t *>(event));
+    case XCB_UNMAP_NOTIFY:
+        return handler->xcbEvent(reinterpret_cast<const xcb_unmap_notify_event_t *>(event));
+    case XCB_GRAVITY_NOTIFY:
+        return handler->xcbEvent(reinterpret_cast<const xcb_gravity_notify_event_t *>(event));
+    case XCB_CIRCULATE_NOTIFY:
+        return handler->xcbEvent(reinterpret_cast<const xcb_circulate_notify_event_t *>(event));
+    case XCB_PROPERTY_NOTIFY:
+        return handler->xcbEvent(reinterpret_cast<const xcb_property_notify_event_t *>(event));
+    default:
+        return false;
+    }
+}
+
+// Passes the event to the registered object with the given ID (window or damage),
+// if there is one
+template<typename Registry, typename T>
+bool xcbDeliverEvent(const Registry &registry, uint32_t id, const T *e)
+{
+    auto i = registry.constFind(id);
+    if (i == registry.constEnd()) {
+        return false;
+    }
+    (*i)->xcbEvent(e);
+    return true;
+}
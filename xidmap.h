@@ -0,0 +1,261 @@
+#pragma once
+
+#include <utility>
+
+#include <QVector>
+
+#include <xcb/xcb.h>
+
+// Open-addressing hash map keyed by X resource IDs (windows, damages, pixmaps).
+// Used instead of QMap on the event hot path: entries live in one flat array and
+// a lookup is usually a single cache line. Linear probing with backward-shift
+// deletion, so there are no tombstones. XCB_NONE can't be used as a key.
+template<typename T>
+class XidMap
+{
+    struct Entry
+    {
+        uint32_t key;
+        T value;
+
+        Entry()
+            : key(XCB_NONE), value()
+        {
+        }
+    };
+
+public:
+    class const_iterator
+    {
+    public:
+        const_iterator()
+            : entries_(Q_NULLPTR), index_(0), capacity_(0)
+        {
+        }
+
+        uint32_t key() const
+        {
+            return entries_[index_].key;
+        }
+
+        const T &value() const
+        {
+            return entries_[index_].value;
+        }
+
+        const T &operator*() const
+        {
+            return value();
+        }
+
+        const T *operator->() const
+        {
+            return &value();
+        }
+
+        const_iterator &operator++()
+        {
+            index_++;
+            skipEmpty();
+            return *this;
+        }
+
+        bool operator==(const const_iterator &other) const
+        {
+            return index_ == other.index_;
+        }
+
+        bool operator!=(const const_iterator &other) const
+        {
+            return index_ != other.index_;
+        }
+
+    private:
+        friend class XidMap;
+
+        const_iterator(const Entry *entries, int index, int capacity)
+            : entries_(entries), index_(index), capacity_(capacity)
+        {
+        }
+
+        void skipEmpty()
+        {
+            while (index_ < capacity_ && entries_[index_].key == XCB_NONE) {
+                index_++;
+            }
+        }
+
+        const Entry *entries_;
+        int index_;
+        int capacity_;
+    };
+
+    XidMap()
+        : size_(0), shift_(32)
+    {
+    }
+
+    int size() const
+    {
+        return size_;
+    }
+
+    bool isEmpty() const
+    {
+        return size_ == 0;
+    }
+
+    const_iterator constBegin() const
+    {
+        const_iterator i(entries_.constData(), 0, entries_.size());
+        i.skipEmpty();
+        return i;
+    }
+
+    const_iterator constEnd() const
+    {
+        return const_iterator(entries_.constData(), entries_.size(), entries_.size());
+    }
+
+    const_iterator begin() const
+    {
+        return constBegin();
+    }
+
+    const_iterator end() const
+    {
+        return constEnd();
+    }
+
+    const_iterator constFind(uint32_t key) const
+    {
+        auto i = indexOf(key);
+        return i < 0 ? constEnd() : const_iterator(entries_.constData(), i, entries_.size());
+    }
+
+    bool contains(uint32_t key) const
+    {
+        return indexOf(key) >= 0;
+    }
+
+    T value(uint32_t key, const T &defaultValue = T()) const
+    {
+        auto i = indexOf(key);
+        return i < 0 ? defaultValue : entries_.at(i).value;
+    }
+
+    void insert(uint32_t key, const T &value)
+    {
+        Q_ASSERT(key != XCB_NONE);
+        if ((size_ + 1) * 4 > entries_.size() * 3) {
+            rehash(entries_.isEmpty() ? MinCapacity : entries_.size() * 2);
+        }
+
+        auto mask = entries_.size() - 1;
+        for (auto i = home(key); ; i = (i + 1) & mask) {
+            auto &entry = entries_[i];
+            if (entry.key == key) {
+                entry.value = value;
+                return;
+            }
+            if (entry.key == XCB_NONE) {
+                entry.key = key;
+                entry.value = value;
+                size_++;
+                return;
+            }
+        }
+    }
+
+    T take(uint32_t key)
+    {
+        auto i = indexOf(key);
+        if (i < 0) {
+            return T();
+        }
+        T result = std::move(entries_[i].value);
+        erase(i);
+        return result;
+    }
+
+    bool remove(uint32_t key)
+    {
+        auto i = indexOf(key);
+        if (i < 0) {
+            return false;
+        }
+        erase(i);
+        return true;
+    }
+
+    void clear()
+    {
+        entries_.clear();
+        size_ = 0;
+        shift_ = 32;
+    }
+
+private:
+    static const int MinCapacity = 16;
+
+    int home(uint32_t key) const
+    {
+        // Fibonacci hashing: XIDs of one client differ only in low bits
+        return static_cast<int>((key * 2654435769u) >> shift_);
+    }
+
+    int indexOf(uint32_t key) const
+    {
+        if (entries_.isEmpty() || key == XCB_NONE) {
+            return -1;
+        }
+
+        auto mask = entries_.size() - 1;
+        auto entries = entries_.constData();
+        for (auto i = home(key); ; i = (i + 1) & mask) {
+            if (entries[i].key == key) {
+                return i;
+            }
+            if (entries[i].key == XCB_NONE) {
+                return -1;
+            }
+        }
+    }
+
+    void erase(int i)
+    {
+        auto mask = entries_.size() - 1;
+        for (auto j = (i + 1) & mask; entries_.at(j).key != XCB_NONE; j = (j + 1) & mask) {
+            // Entry j can fill the hole at i unless its home slot lies cyclically in (i, j]
+            auto k = home(entries_.at(j).key);
+            auto stays = (i <= j) ? (i < k && k <= j) : (i < k || k <= j);
+            if (!stays) {
+                entries_[i] = std::move(entries_[j]);
+                i = j;
+            }
+        }
+        entries_[i] = Entry();
+        size_--;
+    }
+
+    void rehash(int capacity)
+    {
+        QVector<Entry> old;
+        old.swap(entries_);
+        entries_.resize(capacity);
+        shift_ = 32;
+        for (auto c = capacity; c > 1; c >>= 1) {
+            shift_--;
+        }
+        size_ = 0;
+        for (const auto &entry : old) {
+            if (entry.key != XCB_NONE) {
+                insert(entry.key, entry.value);
+            }
+        }
+    }
+
+    QVector<Entry> entries_;
+    int size_;
+    int shift_;
+};
@@ -0,0 +1,387 @@
+#include "xrendercompositor.h"
+
+#include <algorithm>
+#include <cstdlib>
+
+#include <QDebug>
+#include <QVector>
+#include <QWindow>
+#include <QX11Info>
+
+#include <xcb/xcb_renderutil.h>
+
+#include "clientwindow.h"
+#include "compositor.h"
+#include "windowpixmap.h"
+#include "xcbasyncreplies.h"
+
+// Frames are started at most this often, in milliseconds
+static const int FrameInterval = 16;
+
+static const xcb_render_color_t Background = { 0, 0, 0, 0xffff };
+
+static xcb_render_pictformat_t visualFormat(xcb_connection_t *connection, xcb_visualid_t visual)
+{
+    auto formats = xcb_render_util_query_formats(connection);
+    auto format = formats ? xcb_render_util_find_visual_format(formats, visual) : Q_NULLPTR;
+    return format ? format->format : XCB_NONE;
+}
+
+bool XRenderCompositor::isSupported(xcb_connection_t *connection)
+{
+    // Solid fill pictures, used for window opacity, need RENDER 0.10
+    auto cookie = xcb_render_query_version(connection, 0, 10);
+    auto version = xcb_render_query_version_reply(connection, cookie, Q_NULLPTR);
+    if (!version) {
+        return false;
+    }
+    auto supported = version->major_version > 0 || version->minor_version >= 10;
+    std::free(version);
+    return supported;
+}
+
+XRenderCompositor::XRenderCompositor(Compositor *compositor, QObject *parent)
+    : QObject(parent),
+      compositor_(compositor),
+      connection_(QX11Info::connection()),
+      overlay_(compositor->overlayWindow()->winId()),
+      visual_(XCB_NONE),
+      depth_(0),
+      format_(XCB_NONE),
+      overlayPicture_(XCB_NONE),
+      buffer_(XCB_NONE),
+      bufferPicture_(XCB_NONE),
+      frameInFlight_(false),
+      framePending_(false),
+      frames_(0),
+      drawnWindows_(0)
+{
+    frameTimer_.setSingleShot(true);
+    frameTimer_.setTimerType(Qt::PreciseTimer);
+    connect(&frameTimer_, SIGNAL(timeout()), SLOT(paint()));
+
+    auto attributesCookie = xcb_get_window_attributes(connection_, overlay_);
+    auto geometryCookie = xcb_get_geometry(connection_, overlay_);
+    auto attributes = xcb_get_window_attributes_reply(connection_, attributesCookie, Q_NULLPTR);
+    auto geometry = xcb_get_geometry_reply(connection_, geometryCookie, Q_NULLPTR);
+    if (attributes && geometry) {
+        visual_ = attributes->visual;
+        depth_ = geometry->depth;
+        format_ = visualFormat(connection_, visual_);
+    }
+    std::free(attributes);
+    std::free(geometry);
+    if (format_ == XCB_NONE) {
+        qWarning() << "No XRender format for the overlay window";
+        return;
+    }
+
+    overlayPicture_ = xcb_generate_id(connection_);
+    xcb_render_create_picture(connection_, overlayPicture_, overlay_, format_, 0, Q_NULLPTR);
+    createBuffer();
+
+    connect(compositor, SIGNAL(windowCreated(ClientWindow*)), SLOT(addWindow(ClientWindow*)));
+    connect(compositor, SIGNAL(rootGeometryChanged(QRect)), SLOT(rootGeometryChanged(QRect)));
+    connect(compositor, SIGNAL(bypassActiveChanged(bool)), SLOT(bypassActiveChanged(bool)));
+}
+
+XRenderCompositor::~XRenderCompositor()
+{
+    for (const auto &w : windows_) {
+        if (w.picture != XCB_NONE) {
+            xcb_render_free_picture(connection_, w.picture);
+        }
+    }
+    destroyBuffer();
+    if (overlayPicture_ != XCB_NONE) {
+        xcb_render_free_picture(connection_, overlayPicture_);
+    }
+    xcb_flush(connection_);
+}
+
+void XRenderCompositor::createBuffer()
+{
+    size_ = compositor_->rootGeometry().size();
+    buffer_ = xcb_generate_id(connection_);
+    xcb_create_pixmap(connection_, depth_, buffer_, overlay_, size_.width(), size_.height());
+    bufferPicture_ = xcb_generate_id(connection_);
+    xcb_render_create_picture(connection_, bufferPicture_, buffer_, format_, 0, Q_NULLPTR);
+    addDamage(QRect(QPoint(), size_));
+}
+
+void XRenderCompositor::destroyBuffer()
+{
+    if (bufferPicture_ != XCB_NONE) {
+        xcb_render_free_picture(connection_, bufferPicture_);
+        bufferPicture_ = XCB_NONE;
+    }
+    if (buffer_ != XCB_NONE) {
+        xcb_free_pixmap(connection_, buffer_);
+        buffer_ = XCB_NONE;
+    }
+}
+
+void XRenderCompositor::addWindow(ClientWindow *clientWindow)
+{
+    if (windows_.contains(clientWindow) || !clientWindow->isValid()) {
+        return;
+    }
+
+    Window w;
+    w.clientWindow = clientWindow->sharedFromThis();
+    w.picture = XCB_NONE;
+    auto &window = *windows_.insert(clientWindow, w);
+
+    connect(clientWindow, SIGNAL(invalidated()), SLOT(windowInvalidated()));
+    connect(clientWindow, SIGNAL(geometryChanged(QRect)), SLOT(windowGeometryChanged(QRect)));
+    connect(clientWindow, SIGNAL(mapStateChanged(bool)), SLOT(windowChanged()));
+    connect(clientWindow, SIGNAL(zIndexChanged(int)), SLOT(windowChanged()));
+    connect(clientWindow, SIGNAL(opacityChanged(qreal)), SLOT(windowChanged()));
+    connect(clientWindow, SIGNAL(pixmapChanged(WindowPixmap*)), SLOT(windowPixmapChanged(WindowPixmap*)));
+    updatePicture(&window);
+}
+
+void XRenderCompositor::windowInvalidated()
+{
+    auto clientWindow = static_cast<ClientWindow *>(sender());
+    auto i = windows_.find(clientWindow);
+    if (i == windows_.end()) {
+        return;
+    }
+
+    clientWindow->disconnect(this);
+    if (i->pixmap) {
+        i->pixmap->disconnect(this);
+    }
+    if (i->picture != XCB_NONE) {
+        xcb_render_free_picture(connection_, i->picture);
+    }
+    addDamage(i->rect);
+    windows_.erase(i);
+}
+
+void XRenderCompositor::windowGeometryChanged(const QRect &)
+{
+    // The old position is repainted too, when the frame is drawn
+    windowChanged();
+}
+
+void XRenderCompositor::windowChanged()
+{
+    auto i = windows_.find(static_cast<ClientWindow *>(sender()));
+    if (i == windows_.end()) {
+        return;
+    }
+    addDamage(i->rect);
+    addDamage(QRect(i->clientWindow->geometry().topLeft(),
+                    i->pixmap ? i->pixmap->size() : i->clientWindow->geometry().size()));
+}
+
+void XRenderCompositor::windowPixmapChanged(WindowPixmap *)
+{
+    auto i = windows_.find(static_cast<ClientWindow *>(sender()));
+    if (i == windows_.end()) {
+        return;
+    }
+    updatePicture(&*i);
+    addDamage(i->rect);
+    if (i->pixmap) {
+        addDamage(QRect(i->clientWindow->geometry().topLeft(), i->pixmap->size()));
+    }
+}
+
+void XRenderCompositor::updatePicture(Window *w)
+{
+    auto pixmap = w->clientWindow->pixmap();
+    if (pixmap == w->pixmap) {
+        return;
+    }
+
+    if (w->pixmap) {
+        w->pixmap->disconnect(this);
+    }
+    if (w->picture != XCB_NONE) {
+        xcb_render_free_picture(connection_, w->picture);
+        w->picture = XCB_NONE;
+    }
+    w->pixmap = pixmap;
+    if (!pixmap || !pixmap->isValid()) {
+        return;
+    }
+
+    auto format = visualFormat(connection_, pixmap->visual());
+    if (format == XCB_NONE) {
+        qWarning() << "No XRender format for visual" << pixmap->visual();
+        return;
+    }
+    w->picture = xcb_generate_id(connection_);
+    xcb_render_create_picture(connection_, w->picture, pixmap->pixmap(), format, 0, Q_NULLPTR);
+    // Damage itself is read from the pixmap when the frame is painted
+    connect(pixmap.data(), SIGNAL(damaged()), SLOT(scheduleFrame()));
+}
+
+void XRenderCompositor::rootGeometryChanged(const QRect &)
+{
+    if (format_ == XCB_NONE) {
+        return;
+    }
+    destroyBuffer();
+    createBuffer();
+}
+
+void XRenderCompositor::bypassActiveChanged(bool active)
+{
+    // Windows drew directly to the screen, the back buffer is still up to date
+    if (!active) {
+        addDamage(QRect(QPoint(), size_));
+    }
+}
+
+void XRenderCompositor::addDamage(const QRegion &region)
+{
+    if (region.isEmpty()) {
+        return;
+    }
+    damage_ += region;
+    scheduleFrame();
+}
+
+void XRenderCompositor::scheduleFrame()
+{
+    if (frameInFlight_) {
+        framePending_ = true;
+        return;
+    }
+    if (frameTimer_.isActive()) {
+        return;
+    }
+    auto wait = lastFrame_.isValid() ? FrameInterval - lastFrame_.elapsed() : 0;
+    frameTimer_.start(int(qMax<qint64>(wait, 0)));
+}
+
+void XRenderCompositor::setClip(xcb_render_picture_t picture, const QRegion &region)
+{
+    QVector<xcb_rectangle_t> rects;
+    rects.reserve(region.rectCount());
+    for (const auto &r : region.rects()) {
+        xcb_rectangle_t rect = { int16_t(r.x()), int16_t(r.y()), uint16_t(r.width()), uint16_t(r.height()) };
+        rects.append(rect);
+    }
+    xcb_render_set_picture_clip_rectangles(connection_, picture, 0, 0, rects.size(), rects.constData());
+}
+
+void XRenderCompositor::paint()
+{
+    if (format_ == XCB_NONE || compositor_->isBypassActive()) {
+        damage_ = QRegion();
+        return;
+    }
+
+    // Top to bottom, only what can be drawn
+    QVector<Window *> windows;
+    windows.reserve(windows_.size());
+    for (auto &w : windows_) {
+        if (w.clientWindow->isMapped() && w.picture != XCB_NONE && w.pixmap->isValid()) {
+            windows.append(&w);
+        }
+    }
+    std::sort(windows.begin(), windows.end(), [](const Window *a, const Window *b) {
+        return a->clientWindow->zIndex() > b->clientWindow->zIndex();
+    });
+
+    // Damage is acknowledged before the pixmaps are read, so nothing drawn after that is lost
+    auto region = damage_;
+    damage_ = QRegion();
+    for (auto w : windows) {
+        w->rect = QRect(w->clientWindow->geometry().topLeft(), w->pixmap->size());
+        if (w->pixmap->isDamaged()) {
+            region += w->pixmap->damageRegion().translated(w->rect.topLeft());
+            w->pixmap->clearDamage();
+            w->clientWindow->pixmapRendered(w->pixmap.data());
+        }
+    }
+    // Pixmaps queue their acknowledgements on the compositor's render connection
+    WindowPixmap::flushDamageAcknowledgements(compositor_->renderConnection());
+
+    region &= QRect(QPoint(), size_);
+    if (region.isEmpty()) {
+        return;
+    }
+
+    Q_EMIT frameStarted();
+    frameInFlight_ = true;
+    lastFrame_.start();
+
+    // Opaque windows cover what's below them, translucent ones are blended later
+    auto uncovered = region;
+    QVector<QPair<Window *, QRegion> > translucent;
+    for (auto w : windows) {
+        auto clip = uncovered & w->rect;
+        if (clip.isEmpty()) {
+            continue;
+        }
+        if (!w->clientWindow->isOpaque()) {
+            translucent.append(qMakePair(w, clip));
+            continue;
+        }
+        setClip(bufferPicture_, clip);
+        xcb_render_composite(connection_, XCB_RENDER_PICT_OP_SRC, w->picture, XCB_NONE, bufferPicture_,
+                             0, 0, 0, 0, w->rect.x(), w->rect.y(), w->rect.width(), w->rect.height());
+        uncovered -= clip;
+        drawnWindows_.fetchAndAddRelaxed(1);
+    }
+
+    if (!uncovered.isEmpty()) {
+        setClip(bufferPicture_, uncovered);
+        auto bounds = uncovered.boundingRect();
+        xcb_rectangle_t rect = { int16_t(bounds.x()), int16_t(bounds.y()),
+                                 uint16_t(bounds.width()), uint16_t(bounds.height()) };
+        xcb_render_fill_rectangles(connection_, XCB_RENDER_PICT_OP_SRC, bufferPicture_, Background, 1, &rect);
+    }
+
+    for (int i = translucent.size() - 1; i >= 0; i--) {
+        auto w = translucent.at(i).first;
+        xcb_render_picture_t mask = XCB_NONE;
+        if (w->clientWindow->opacity() < 1) {
+            uint16_t alpha = qRound(w->clientWindow->opacity() * 0xffff);
+            xcb_render_color_t color = { 0, 0, 0, alpha };
+            mask = xcb_generate_id(connection_);
+            xcb_render_create_solid_fill(connection_, mask, color);
+        }
+        setClip(bufferPicture_, translucent.at(i).second);
+        xcb_render_composite(connection_, XCB_RENDER_PICT_OP_OVER, w->picture, mask, bufferPicture_,
+                             0, 0, 0, 0, w->rect.x(), w->rect.y(), w->rect.width(), w->rect.height());
+        if (mask != XCB_NONE) {
+            xcb_render_free_picture(connection_, mask);
+        }
+        drawnWindows_.fetchAndAddRelaxed(1);
+    }
+
+    // The buffer is the source now, and a source's clip applies too: the last window's would
+    // limit the copy to that window
+    const uint32_t noClip[] = { XCB_NONE };
+    xcb_render_change_picture(connection_, bufferPicture_, XCB_RENDER_CP_CLIP_MASK, noClip);
+    setClip(overlayPicture_, region);
+    auto bounds = region.boundingRect();
+    xcb_render_composite(connection_, XCB_RENDER_PICT_OP_SRC, bufferPicture_, XCB_NONE, overlayPicture_,
+                         bounds.x(), bounds.y(), 0, 0, bounds.x(), bounds.y(), bounds.width(), bounds.height());
+
+    // The reply comes after the server executed everything above
+    auto cookie = xcb_get_input_focus(connection_);
+    XcbAsyncReplies::instance(connection_)->await<xcb_get_input_focus_reply_t>(cookie, this,
+            [this](xcb_get_input_focus_reply_t *, xcb_generic_error_t *) {
+        frameDone();
+    });
+    xcb_flush(connection_);
+    frames_.fetchAndAddRelaxed(1);
+}
+
+void XRenderCompositor::frameDone()
+{
+    frameInFlight_ = false;
+    Q_EMIT frameFinished();
+    if (framePending_) {
+        framePending_ = false;
+        scheduleFrame();
+    }
+}
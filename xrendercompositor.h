@@ -0,0 +1,107 @@
+#pragma once
+
+#include <QAtomicInteger>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QObject>
+#include <QRegion>
+#include <QSharedPointer>
+#include <QTimer>
+
+#include <xcb/xcb.h>
+#include <xcb/render.h>
+
+class ClientWindow;
+class Compositor;
+class WindowPixmap;
+
+// Composites window pixmaps onto the overlay window with XRender, without GL and without
+// QML. Meant for hosts where GL would be rendered in software anyway: the server blends
+// the pixmaps it already has, and only damaged parts of the screen are repainted.
+//
+// Windows are drawn at their geometry, in zIndex order, when mapped. Opaque windows are
+// copied top to bottom, each clipped to what the windows above left uncovered; translucent
+// ones are blended afterwards, bottom to top. Everything goes to a back buffer first and
+// the repainted region is copied to the overlay window, so there's no flicker.
+//
+// One frame is in flight at a time: the next one is painted after the server processed
+// the previous one, at most once per FrameInterval.
+class XRenderCompositor : public QObject
+{
+    Q_OBJECT
+
+    Q_PROPERTY(qint64 frames READ frames)
+public:
+    explicit XRenderCompositor(Compositor *, QObject *parent = Q_NULLPTR);
+    ~XRenderCompositor() Q_DECL_OVERRIDE;
+
+    // Frames painted so far
+    qint64 frames() const
+    {
+        return frames_.load();
+    }
+
+    // Window pixmaps composited, summed over frames
+    qint64 drawnWindows() const
+    {
+        return drawnWindows_.load();
+    }
+
+    static bool isSupported(xcb_connection_t *);
+
+Q_SIGNALS:
+    // Painting started, and the server finished processing the frame
+    void frameStarted();
+    void frameFinished();
+
+private Q_SLOTS:
+    void addWindow(ClientWindow *);
+    void windowInvalidated();
+    void windowGeometryChanged(const QRect &);
+    void windowChanged();
+    void windowPixmapChanged(WindowPixmap *);
+    void rootGeometryChanged(const QRect &);
+    void bypassActiveChanged(bool);
+    void scheduleFrame();
+    void paint();
+
+private:
+    struct Window
+    {
+        QSharedPointer<ClientWindow> clientWindow;
+        // Picture of the current pixmap
+        QSharedPointer<WindowPixmap> pixmap;
+        xcb_render_picture_t picture;
+        // Where the window was drawn last; repainted when it moves away
+        QRect rect;
+    };
+
+    void createBuffer();
+    void destroyBuffer();
+    void updatePicture(Window *);
+    void addDamage(const QRegion &);
+    void setClip(xcb_render_picture_t, const QRegion &);
+    void frameDone();
+
+    Compositor *compositor_;
+    xcb_connection_t *connection_;
+    xcb_window_t overlay_;
+    xcb_visualid_t visual_;
+    uint8_t depth_;
+    QSize size_;
+
+    xcb_render_pictformat_t format_;
+    xcb_render_picture_t overlayPicture_;
+    xcb_pixmap_t buffer_;
+    xcb_render_picture_t bufferPicture_;
+
+    QHash<ClientWindow *, Window> windows_;
+    QRegion damage_;
+
+    QTimer frameTimer_;
+    QElapsedTimer lastFrame_;
+    bool frameInFlight_;
+    bool framePending_;
+    QAtomicInteger<qint64> frames_;
+    QAtomicInteger<qint64> drawnWindows_;
+};